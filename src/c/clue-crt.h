@@ -10,8 +10,13 @@
  * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
  */
 
+#ifndef CLUE_CRT_H
+#define CLUE_CRT_H
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 #define CLUE_CONSTRUCTOR __attribute__ ((constructor))
 
@@ -38,6 +43,7 @@ typedef union clue_slot
 	clue_bool_t b;
 	clue_optr_t o;
 	clue_fptr_t p;
+	void* h;                       /* host data owned by the run-time */
 } clue_slot_t;
 
 typedef struct
@@ -46,11 +52,19 @@ typedef struct
 	clue_optr_t o;
 } clue_ptr_pair_t;
 
-extern int clue_cleanup_start(void);
-extern void clue_cleanup_push(void* ptr);
-extern void clue_cleanup_end(int cs);
+#define CLUE_SCRATCH_SIZE 256
+
+extern const char* clue_ptrtostring(clue_int_t po, clue_optr_t pd,
+		char* scratch);
+extern void clue_releasestring(const char* s, char* scratch);
+extern void clue_flush_all(void);
 
-extern const char* clue_ptrtostring(clue_int_t po, clue_optr_t pd);
+extern void clue_printf_text(const char* s, int len);
+extern void clue_printf_int(const char* spec, clue_int_t i);
+extern void clue_printf_char(const char* spec, clue_int_t c);
+extern void clue_printf_real(const char* spec, clue_real_t r);
+extern void clue_printf_string(const char* spec,
+		clue_int_t po, clue_optr_t pd);
 
 extern clue_int_t _main(clue_int_t sp, clue_optr_t stack,
 		clue_int_t argc,
@@ -60,3 +74,4 @@ extern clue_slot_t __stdin[1];
 extern clue_slot_t __stdout[1];
 extern clue_slot_t __stderr[1];
 
+#endif
@@ -17,54 +17,43 @@
 
 static clue_slot_t clue_stack[1024];
 
-static void* cleanup_stack[128];
-static int cleanup_sp = 0;
+/* Converts a Clue string into a C string. This is done in a single pass
+ * into scratch, which must be CLUE_SCRATCH_SIZE bytes and is normally on the
+ * caller's stack; only strings too long for it are copied to the heap.
+ * Either way, the result must be released with clue_releasestring(). */
 
-int clue_cleanup_start(void)
+const char* clue_ptrtostring(clue_int_t po, clue_optr_t pd, char* scratch)
 {
-	return cleanup_sp;
-}
-
-void clue_cleanup_push(void* ptr)
-{
-	cleanup_sp++;
-	cleanup_stack[cleanup_sp] = ptr;
-}
-
-void clue_cleanup_end(int cs)
-{
-	while (cleanup_sp > cs)
-	{
-		free(cleanup_stack[cleanup_sp]);
-		cleanup_sp--;
-	}
-}
-
-const char* clue_ptrtostring(clue_int_t po, clue_optr_t pd)
-{
-	int len = 0;
-
-	/* Count string length */
+	clue_optr_t p = pd + (int)po;
+	char* s = scratch;
+	size_t size = CLUE_SCRATCH_SIZE;
+	size_t len = 0;
 
 	for (;;)
 	{
-		int c = pd[(int)po+len].i;
-		len++;
+		if (len == size)
+		{
+			size *= 2;
+			if (s == scratch)
+			{
+				s = malloc(size);
+				memcpy(s, scratch, len);
+			}
+			else
+				s = realloc(s, size);
+		}
+
+		char c = p[len].i;
+		s[len++] = c;
 		if (c == '\0')
-			break;
+			return s;
 	}
+}
 
-	/* Allocate string. */
-
-	char* s = malloc(len);
-
-	/* Copy string data */
-
-	int i;
-	for (i = 0; i < len; i++)
-		s[i] = pd[(int)po+i].i;
-
-	return s;
+void clue_releasestring(const char* s, char* scratch)
+{
+	if (s != scratch)
+		free((void*) s);
 }
 
 clue_optr_t clue_makestring(const char* s)
@@ -91,5 +80,9 @@ int main(int argc, const char* argv[])
 	clueargv[(argc*2)+0].i = 0;
 	clueargv[(argc*2)+1].o = NULL;
 
+	/* Anything still buffered by the Clue stdio has to be written out. */
+
+	atexit(clue_flush_all);
+
 	_main(0, clue_stack, argc, 0, clueargv);
 }
@@ -18,6 +18,11 @@
 #include <time.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "clue-crt.h"
 
 /****************************************************************************
@@ -28,11 +33,388 @@ clue_slot_t __stdin[1];
 clue_slot_t __stdout[1];
 clue_slot_t __stderr[1];
 
+/* A Clue FILE pointer points at a slot holding the address of one of
+ * these. The buffer is Clue memory (one byte per slot), and is handed to
+ * the host a chunk at a time. The standard streams are bound to their
+ * clue_files the first time they're used. */
+
+#define CLUE_BUFSIZ 4096
+
+enum
+{
+	CLUE_FILE_READ = 1,
+	CLUE_FILE_WRITE = 2,
+	CLUE_FILE_UNBUFFERED = 4,
+	CLUE_FILE_WRITING = 8,         /* buffer holds output, not input */
+	CLUE_FILE_EOF = 16,
+};
+
+struct clue_file
+{
+	struct clue_file* next;
+	FILE* host;
+	int flags;
+	int count;                     /* bytes in the buffer */
+	int pos;                       /* next byte to be read */
+	clue_slot_t self[1];           /* what the Clue FILE* points at */
+	clue_slot_t buffer[CLUE_BUFSIZ];
+};
+
+static struct clue_file clue_stdin;
+static struct clue_file clue_stdout;
+static struct clue_file clue_stderr;
+static struct clue_file* clue_files = NULL;
+
+static void clue_bind_file(struct clue_file* f, clue_optr_t pd, FILE* host,
+		int flags)
+{
+	f->host = host;
+	f->flags = flags;
+	f->next = clue_files;
+	clue_files = f;
+	pd[0].h = f;
+}
+
+static struct clue_file* clue_file_of(clue_optr_t pd)
+{
+	if (!pd[0].h)
+	{
+		if (pd == __stdin)
+			clue_bind_file(&clue_stdin, pd, stdin, CLUE_FILE_READ);
+		else if (pd == __stdout)
+			clue_bind_file(&clue_stdout, pd, stdout, CLUE_FILE_WRITE);
+		else if (pd == __stderr)
+			clue_bind_file(&clue_stderr, pd, stderr,
+					CLUE_FILE_WRITE | CLUE_FILE_UNBUFFERED);
+		else
+			assert(!"not a FILE");
+	}
+
+	return pd[0].h;
+}
+
+/* Hands any pending output to the host, or discards any pending input. */
+
+static int clue_flush(struct clue_file* f)
+{
+	int result = 0;
+
+	if ((f->flags & CLUE_FILE_WRITING) && f->count)
+	{
+		char bytes[CLUE_BUFSIZ];
+		for (int i = 0; i < f->count; i++)
+			bytes[i] = f->buffer[i].i;
+
+		if (fwrite(bytes, 1, f->count, f->host) != f->count)
+			result = EOF;
+		if (f->flags & CLUE_FILE_UNBUFFERED)
+			fflush(f->host);
+	}
+
+	f->count = f->pos = 0;
+	f->flags &= ~CLUE_FILE_WRITING;
+	return result;
+}
+
+void clue_flush_all(void)
+{
+	for (struct clue_file* f = clue_files; f; f = f->next)
+	{
+		clue_flush(f);
+		fflush(f->host);
+	}
+}
+
+/* Refills an empty input buffer. Returns 0 at end of file. */
+
+static int clue_fill(struct clue_file* f)
+{
+	if (f->flags & CLUE_FILE_EOF)
+		return 0;
+	if (f->flags & CLUE_FILE_WRITING)
+		clue_flush(f);
+
+	/* Make sure any prompt has appeared before waiting for input. */
+
+	if (f == &clue_stdin)
+	{
+		clue_flush(clue_file_of(__stdout));
+		fflush(stdout);
+	}
+
+	char bytes[CLUE_BUFSIZ];
+	ssize_t len = read(fileno(f->host), bytes, CLUE_BUFSIZ);
+	if (len <= 0)
+	{
+		f->flags |= CLUE_FILE_EOF;
+		return 0;
+	}
+
+	for (int i = 0; i < len; i++)
+		f->buffer[i].i = (unsigned char) bytes[i];
+	f->count = len;
+	f->pos = 0;
+	return len;
+}
+
+static int clue_getc(struct clue_file* f)
+{
+	if ((f->pos == f->count) || (f->flags & CLUE_FILE_WRITING))
+	{
+		if (!clue_fill(f))
+			return EOF;
+	}
+
+	return f->buffer[f->pos++].i;
+}
+
+/* Makes room for at least one byte of output. */
+
+static void clue_start_write(struct clue_file* f)
+{
+	if (!(f->flags & CLUE_FILE_WRITING))
+		f->count = f->pos = 0;
+	else if (f->count == CLUE_BUFSIZ)
+		clue_flush(f);
+
+	f->flags |= CLUE_FILE_WRITING;
+}
+
+static void clue_write_bytes(struct clue_file* f, const char* s, int len)
+{
+	while (len > 0)
+	{
+		clue_start_write(f);
+
+		int chunk = CLUE_BUFSIZ - f->count;
+		if (chunk > len)
+			chunk = len;
+		for (int i = 0; i < chunk; i++)
+			f->buffer[f->count + i].i = (unsigned char) s[i];
+		f->count += chunk;
+		s += chunk;
+		len -= chunk;
+	}
+
+	if (f->flags & CLUE_FILE_UNBUFFERED)
+		clue_flush(f);
+}
+
+clue_ptr_pair_t _fopen(clue_int_t sp, clue_optr_t stack,
+		clue_int_t namepo, clue_optr_t namepd,
+		clue_int_t modepo, clue_optr_t modepd)
+{
+	clue_ptr_pair_t _r;
+	char namescratch[CLUE_SCRATCH_SIZE];
+	char modescratch[CLUE_SCRATCH_SIZE];
+	const char* name = clue_ptrtostring(namepo, namepd, namescratch);
+	const char* mode = clue_ptrtostring(modepo, modepd, modescratch);
+
+	_r.i = 0;
+	_r.o = NULL;
+
+	FILE* host = fopen(name, mode);
+	if (host)
+	{
+		int flags = (mode[0] == 'r') ? CLUE_FILE_READ : CLUE_FILE_WRITE;
+		if (strchr(mode, '+'))
+			flags = CLUE_FILE_READ | CLUE_FILE_WRITE;
+
+		struct clue_file* f = calloc(1, sizeof(struct clue_file));
+		clue_bind_file(f, f->self, host, flags);
+
+		_r.i = 1;
+		_r.o = f->self;
+	}
+
+	clue_releasestring(name, namescratch);
+	clue_releasestring(mode, modescratch);
+	return _r;
+}
+
+clue_int_t _fclose(clue_int_t sp, clue_optr_t stack,
+		clue_int_t po, clue_optr_t pd)
+{
+	struct clue_file* f = clue_file_of(pd);
+	int result = clue_flush(f);
+	if (fclose(f->host) != 0)
+		result = EOF;
+
+	struct clue_file** p = &clue_files;
+	while (*p != f)
+		p = &(*p)->next;
+	*p = f->next;
+
+	pd[0].h = NULL;
+	if ((f != &clue_stdin) && (f != &clue_stdout) && (f != &clue_stderr))
+		free(f);
+	return result;
+}
+
+clue_int_t _fflush(clue_int_t sp, clue_optr_t stack,
+		clue_int_t po, clue_optr_t pd)
+{
+	if (!pd)
+	{
+		clue_flush_all();
+		return 0;
+	}
+
+	struct clue_file* f = clue_file_of(pd);
+	int result = clue_flush(f);
+	fflush(f->host);
+	return result;
+}
+
+clue_int_t _fread(clue_int_t sp, clue_optr_t stack,
+		clue_int_t ptrpo, clue_optr_t ptrpd,
+		clue_int_t size, clue_int_t nmemb,
+		clue_int_t po, clue_optr_t pd)
+{
+	struct clue_file* f = clue_file_of(pd);
+	int total = size * nmemb;
+	int done = 0;
+
+	while (done < total)
+	{
+		if ((f->pos == f->count) || (f->flags & CLUE_FILE_WRITING))
+		{
+			if (!clue_fill(f))
+				break;
+		}
+
+		int chunk = f->count - f->pos;
+		if (chunk > (total - done))
+			chunk = total - done;
+		memcpy(&ptrpd[(int)ptrpo + done], &f->buffer[f->pos],
+				chunk * sizeof(clue_slot_t));
+		f->pos += chunk;
+		done += chunk;
+	}
+
+	return size ? (done / (int)size) : 0;
+}
+
+clue_int_t _fwrite(clue_int_t sp, clue_optr_t stack,
+		clue_int_t ptrpo, clue_optr_t ptrpd,
+		clue_int_t size, clue_int_t nmemb,
+		clue_int_t po, clue_optr_t pd)
+{
+	struct clue_file* f = clue_file_of(pd);
+	int total = size * nmemb;
+	int done = 0;
+
+	while (done < total)
+	{
+		clue_start_write(f);
+
+		int chunk = CLUE_BUFSIZ - f->count;
+		if (chunk > (total - done))
+			chunk = total - done;
+		for (int i = 0; i < chunk; i++)
+			f->buffer[f->count + i].i =
+				(int) ptrpd[(int)ptrpo + done + i].i & 0xff;
+		f->count += chunk;
+		done += chunk;
+	}
+
+	if (f->flags & CLUE_FILE_UNBUFFERED)
+		clue_flush(f);
+	return nmemb;
+}
+
+clue_ptr_pair_t _fgets(clue_int_t sp, clue_optr_t stack,
+		clue_int_t spo, clue_optr_t spd, clue_int_t size,
+		clue_int_t po, clue_optr_t pd)
+{
+	struct clue_file* f = clue_file_of(pd);
+	clue_ptr_pair_t _r;
+	int i = 0;
+
+	while (i < (size - 1))
+	{
+		int c = clue_getc(f);
+		if (c == EOF)
+			break;
+
+		spd[(int)spo + i].i = c;
+		i++;
+		if (c == '\n')
+			break;
+	}
+
+	if (i == 0)
+	{
+		_r.i = 0;
+		_r.o = NULL;
+		return _r;
+	}
+
+	spd[(int)spo + i].i = 0;
+	_r.i = spo;
+	_r.o = spd;
+	return _r;
+}
+
+clue_int_t _fputs(clue_int_t sp, clue_optr_t stack,
+		clue_int_t spo, clue_optr_t spd,
+		clue_int_t po, clue_optr_t pd)
+{
+	char scratch[CLUE_SCRATCH_SIZE];
+	const char* s = clue_ptrtostring(spo, spd, scratch);
+	clue_write_bytes(clue_file_of(pd), s, strlen(s));
+	clue_releasestring(s, scratch);
+	return 0;
+}
+
+clue_int_t _getc(clue_int_t sp, clue_optr_t stack,
+		clue_int_t po, clue_optr_t pd)
+{
+	return clue_getc(clue_file_of(pd));
+}
+
+clue_int_t _putc(clue_int_t sp, clue_optr_t stack,
+		clue_int_t c,
+		clue_int_t po, clue_optr_t pd)
+{
+	struct clue_file* f = clue_file_of(pd);
+
+	clue_start_write(f);
+	f->buffer[f->count++].i = (int) c & 0xff;
+	if (f->flags & CLUE_FILE_UNBUFFERED)
+		clue_flush(f);
+	return c;
+}
+
+static int clue_printf(struct clue_file* f, const char* format, ...)
+{
+	char buffer[256];
+	va_list ap;
+
+	va_start(ap, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+
+	if (len >= sizeof(buffer))
+	{
+		char* big = malloc(len + 1);
+		va_start(ap, format);
+		vsnprintf(big, len + 1, format, ap);
+		va_end(ap);
+		clue_write_bytes(f, big, len);
+		free(big);
+	}
+	else if (len > 0)
+		clue_write_bytes(f, buffer, len);
+
+	return len;
+}
+
 clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 		clue_int_t formatpo, clue_optr_t formatpd,
 		...)
 {
-	int cs = clue_cleanup_start();
+	struct clue_file* out = clue_file_of(__stdout);
 	int chars = 0;
 	va_list ap;
 
@@ -45,7 +427,6 @@ clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 		switch (c)
 		{
 			case '\0':
-				clue_cleanup_end(cs);
 				va_end(ap);
 				return chars;
 
@@ -80,7 +461,7 @@ clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 					case 'X':
 					{
 						int64_t i = (int64_t) va_arg(ap, clue_int_t);
-						chars += printf(formatbuffer, i);
+						chars += clue_printf(out, formatbuffer, i);
 						break;
 					}
 
@@ -94,21 +475,21 @@ clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 					case 'A':
 					{
 						clue_real_t r = va_arg(ap, clue_real_t);
-						chars += printf(formatbuffer, r);
+						chars += clue_printf(out, formatbuffer, r);
 						break;
 					}
 
 					case 'c':
 					{
-						clue_int_t c = va_arg(ap, clue_int_t);
-						putchar(c);
+						char c = va_arg(ap, clue_int_t);
+						clue_write_bytes(out, &c, 1);
 						chars++;
 						break;
 					}
 
 					case '%':
 					{
-						putchar('%');
+						clue_write_bytes(out, "%", 1);
 						chars++;
 						break;
 					}
@@ -117,11 +498,14 @@ clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 					{
 						clue_int_t po = va_arg(ap, clue_int_t);
 						clue_optr_t pd = va_arg(ap, clue_optr_t);
-						const char* s = clue_ptrtostring(po, pd);
+						char scratch[CLUE_SCRATCH_SIZE];
+						const char* s = clue_ptrtostring(po, pd, scratch);
+						size_t len = strlen(s);
 
-						chars += printf("%s", s);
+						clue_write_bytes(out, s, len);
+						chars += len;
 
-						free((void*) s);
+						clue_releasestring(s, scratch);
 						break;
 					}
 
@@ -130,7 +514,7 @@ clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 						clue_int_t po = va_arg(ap, clue_int_t);
 						clue_optr_t pd = va_arg(ap, clue_optr_t);
 
-						chars += printf("[PTR:%08X+%08X]",
+						chars += clue_printf(out, "[PTR:%08X+%08X]",
 								(unsigned int) (size_t)pd,
 								(unsigned int) (size_t)po);
 						break;
@@ -149,29 +533,59 @@ clue_int_t _printf(clue_int_t sp, clue_optr_t stack,
 			}
 
 			default:
-				putchar(c);
+			{
+				char cc = c;
+				clue_write_bytes(out, &cc, 1);
 				chars++;
+			}
 		}
 	}
 }
 
-clue_int_t _putc(clue_int_t sp, clue_optr_t stack,
-		clue_int_t c,
-		clue_int_t po, clue_optr_t pd)
+/* printf helpers. Each kind of argument has its own, so that the host
+ * printf() is passed the type the conversion expects. */
+
+void clue_printf_text(const char* s, int len)
 {
-	if (pd == __stdout)
-		return putc(c, stdout);
-	else if (pd == __stderr)
-		return putc(c, stderr);
-	return 0;
+	clue_write_bytes(clue_file_of(__stdout), s, len);
+}
+
+void clue_printf_int(const char* spec, clue_int_t i)
+{
+	clue_printf(clue_file_of(__stdout), spec, (long long) i);
+}
+
+void clue_printf_char(const char* spec, clue_int_t c)
+{
+	clue_printf(clue_file_of(__stdout), spec, (int) c);
+}
+
+void clue_printf_real(const char* spec, clue_real_t r)
+{
+	clue_printf(clue_file_of(__stdout), spec, (double) r);
+}
+
+void clue_printf_string(const char* spec, clue_int_t po, clue_optr_t pd)
+{
+	struct clue_file* out = clue_file_of(__stdout);
+	char scratch[CLUE_SCRATCH_SIZE];
+	const char* s = clue_ptrtostring(po, pd, scratch);
+
+	if (strcmp(spec, "%s") == 0)
+		clue_write_bytes(out, s, strlen(s));
+	else
+		clue_printf(out, spec, s);
+
+	clue_releasestring(s, scratch);
 }
 
 clue_int_t _atol(clue_int_t sp, clue_optr_t stack,
 		clue_int_t po, clue_optr_t pd)
 {
-	const char* s = clue_ptrtostring(po, pd);
+	char scratch[CLUE_SCRATCH_SIZE];
+	const char* s = clue_ptrtostring(po, pd, scratch);
 	clue_int_t result = atol(s);
-	free((void*) s);
+	clue_releasestring(s, scratch);
 	return result;
 }
 
@@ -284,3 +698,204 @@ void _free(clue_int_t sp, clue_optr_t stack,
 	free(pd);
 }
 
+/****************************************************************************
+ *                               MAPPED FILES                               *
+ ****************************************************************************/
+
+/* clue_mmap() maps the file on the host and reserves, but doesn't commit,
+ * an inaccessible array of slots to act as its Clue view. Touching the view
+ * faults; the handler decodes the window of the file containing the fault
+ * into the view and makes it readable. Only CLUE_MAP_RESIDENT windows are
+ * kept decoded at once, the oldest being given back to the kernel, so
+ * scanning a file costs a fixed amount of memory however big it is.
+ *
+ * Slot 0 of the view is never used, so that the Clue pointer has a
+ * non-zero offset and doesn't compare equal to NULL; the file's bytes start
+ * at slot 1 and are followed by a '\0'. */
+
+#define CLUE_MAP_WINDOW (64*1024)    /* bytes of view, not of file */
+#define CLUE_MAP_RESIDENT 256
+
+struct clue_mapping
+{
+	struct clue_mapping* next;
+	const unsigned char* data;     /* the file, as mapped by the host */
+	size_t length;                 /* of the file */
+	clue_slot_t* slots;            /* the view */
+	size_t size;                   /* of the view's reservation */
+};
+
+static struct clue_mapping* clue_mappings = NULL;
+static size_t clue_map_window;
+static char* clue_resident[CLUE_MAP_RESIDENT];
+static int clue_resident_next = 0;
+static struct sigaction clue_old_segv;
+
+static struct clue_mapping* clue_mapping_of(const char* address)
+{
+	for (struct clue_mapping* m = clue_mappings; m; m = m->next)
+	{
+		const char* start = (const char*) m->slots;
+		if ((address >= start) && (address < (start + m->size)))
+			return m;
+	}
+
+	return NULL;
+}
+
+/* Decodes the window containing address. Anything else is not ours, and
+ * neither are writes to a window that has already been decoded; in those
+ * cases the old handler is put back and the faulting access retried, so
+ * the program dies as it would have done anyway. */
+
+static void clue_map_fault(int sig, siginfo_t* info, void* context)
+{
+	char* address = info->si_addr;
+	struct clue_mapping* m = clue_mapping_of(address);
+	char* window = NULL;
+
+	if (m)
+	{
+		size_t offset = address - (char*) m->slots;
+		window = address - (offset % clue_map_window);
+
+		for (int i = 0; i < CLUE_MAP_RESIDENT; i++)
+			if (clue_resident[i] == window)
+				window = NULL;
+	}
+
+	if (!window)
+	{
+		sigaction(SIGSEGV, &clue_old_segv, NULL);
+		return;
+	}
+
+	char* old = clue_resident[clue_resident_next];
+	if (old)
+	{
+		madvise(old, clue_map_window, MADV_DONTNEED);
+		mprotect(old, clue_map_window, PROT_NONE);
+	}
+	clue_resident[clue_resident_next] = window;
+	clue_resident_next = (clue_resident_next + 1) % CLUE_MAP_RESIDENT;
+
+	mprotect(window, clue_map_window, PROT_READ | PROT_WRITE);
+
+	clue_slot_t* slot = (clue_slot_t*) window;
+	size_t first = slot - m->slots;
+	size_t count = clue_map_window / sizeof(clue_slot_t);
+	for (size_t i = 0; i < count; i++)
+	{
+		/* Slot 0 is padding; slot length+1 and beyond are zero. */
+
+		size_t index = first + i - 1;
+		if ((first + i) && (index < m->length))
+			slot[i].i = m->data[index];
+		else
+			slot[i].i = 0;
+	}
+
+	mprotect(window, clue_map_window, PROT_READ);
+}
+
+static void clue_map_init(void)
+{
+	if (clue_map_window)
+		return;
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	clue_map_window = (CLUE_MAP_WINDOW + page - 1) / page * page;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = clue_map_fault;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &clue_old_segv);
+}
+
+clue_ptr_pair_t _clue_mmap(clue_int_t sp, clue_optr_t stack,
+		clue_int_t namepo, clue_optr_t namepd,
+		clue_int_t lengthpo, clue_optr_t lengthpd)
+{
+	clue_ptr_pair_t _r;
+	_r.i = 0;
+	_r.o = NULL;
+
+	char scratch[CLUE_SCRATCH_SIZE];
+	const char* name = clue_ptrtostring(namepo, namepd, scratch);
+	int fd = open(name, O_RDONLY);
+	clue_releasestring(name, scratch);
+	if (fd == -1)
+		return _r;
+
+	struct stat st;
+	const unsigned char* data = NULL;
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return _r;
+	}
+	if (st.st_size)
+	{
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return _r;
+		}
+		madvise((void*) data, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	clue_map_init();
+
+	struct clue_mapping* m = malloc(sizeof(struct clue_mapping));
+	m->data = data;
+	m->length = st.st_size;
+	m->size = (m->length + 2) * sizeof(clue_slot_t);
+	m->size = (m->size + clue_map_window - 1) / clue_map_window *
+			clue_map_window;
+	m->slots = mmap(NULL, m->size, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (m->slots == MAP_FAILED)
+	{
+		if (data)
+			munmap((void*) data, m->length);
+		free(m);
+		return _r;
+	}
+
+	m->next = clue_mappings;
+	clue_mappings = m;
+
+	if (lengthpd)
+		lengthpd[(int)lengthpo].i = m->length;
+
+	_r.i = 1;
+	_r.o = m->slots;
+	return _r;
+}
+
+clue_int_t _clue_munmap(clue_int_t sp, clue_optr_t stack,
+		clue_int_t po, clue_optr_t pd)
+{
+	struct clue_mapping** p = &clue_mappings;
+	while (*p && ((*p)->slots != pd))
+		p = &(*p)->next;
+
+	struct clue_mapping* m = *p;
+	if (!m)
+		return -1;
+	*p = m->next;
+
+	for (int i = 0; i < CLUE_MAP_RESIDENT; i++)
+		if (clue_mapping_of(clue_resident[i]) == NULL)
+			clue_resident[i] = NULL;
+
+	munmap(m->slots, m->size);
+	if (m->data)
+		munmap((void*) m->data, m->length);
+	free(m);
+	return 0;
+}
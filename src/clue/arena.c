@@ -0,0 +1,135 @@
+/* arena.c
+ * Region allocator
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+
+/* Most of what the compiler allocates is small and lives exactly as long
+ * as the function being generated (register names, bits of expressions,
+ * pinfos and binfos), so it comes from function_arena, which is emptied
+ * after each function. Things which have to last until the end (symbol
+ * information and mangled names) come from program_arena. aprintf()
+ * allocates from whichever arena is current.
+ *
+ * Chunks are kept when an arena is reset and reused afterwards, so a
+ * compile only ever allocates as much as its largest function needs.
+ */
+
+#define CHUNK_SIZE (64*1024)
+#define ALIGNMENT 16
+
+struct arenachunk
+{
+	struct arenachunk* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+int report_memory = 0;
+
+struct arena program_arena = { "program" };
+struct arena function_arena = { "function" };
+struct arena* current_arena = &program_arena;
+
+/* Returns zeroed memory. */
+
+void* arena_alloc(struct arena* arena, size_t size)
+{
+	size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+
+	struct arenachunk* chunk = arena->current;
+	while (chunk && ((chunk->size - chunk->used) < size))
+		chunk = chunk->next;
+
+	if (!chunk)
+	{
+		size_t chunksize = (size > CHUNK_SIZE) ? size : CHUNK_SIZE;
+		chunk = malloc(sizeof(struct arenachunk) + chunksize);
+		if (!chunk)
+			die("out of memory");
+		chunk->size = chunksize;
+		chunk->used = 0;
+
+		/* New chunks go after the current one, so that they're used
+		 * straight away. */
+
+		if (arena->current)
+		{
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
+		}
+		else
+		{
+			chunk->next = arena->first;
+			arena->first = chunk;
+		}
+	}
+	arena->current = chunk;
+
+	void* p = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(p, 0, size);
+
+	arena->used += size;
+	arena->allocated += size;
+	if (arena->used > arena->highwater)
+		arena->highwater = arena->used;
+	return p;
+}
+
+/* Frees everything allocated from an arena. */
+
+void arena_reset(struct arena* arena)
+{
+	struct arenachunk* chunk;
+	for (chunk = arena->first; chunk; chunk = chunk->next)
+		chunk->used = 0;
+
+	arena->current = arena->first;
+	arena->used = 0;
+}
+
+const char* arena_vprintf(struct arena* arena, const char* fmt, va_list ap)
+{
+	va_list ap2;
+	va_copy(ap2, ap);
+	int len = vsnprintf(NULL, 0, fmt, ap2);
+	va_end(ap2);
+
+	char* p = arena_alloc(arena, len + 1);
+	vsnprintf(p, len + 1, fmt, ap);
+	return p;
+}
+
+const char* arena_printf(struct arena* arena, const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	const char* p = arena_vprintf(arena, fmt, ap);
+	va_end(ap);
+	return p;
+}
+
+/* Prints the arenas' high-water marks, if --memory-report was given. */
+
+void report_arenas(void)
+{
+	struct arena* arenas[] = { &program_arena, &function_arena };
+	int i;
+
+	if (!report_memory)
+		return;
+
+	for (i = 0; i < sizeof(arenas)/sizeof(*arenas); i++)
+		fprintf(stderr, "clue: %s arena: high-water mark %lu bytes\n",
+				arenas[i]->name, (unsigned long) arenas[i]->highwater);
+}
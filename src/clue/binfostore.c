@@ -13,10 +13,6 @@
 #include "globals.h"
 #include "avl.h"
 
-static avltree_t binfostore = NULL;
-static struct binfo** binfolist = NULL;
-static int binfocount = 0;
-static int iterator;
 
 static int compare_cb(const void* lhs, const void* rhs)
 {
@@ -36,64 +32,151 @@ struct binfo* lookup_binfo_of_basic_block(struct basic_block* bb)
 	struct binfo key;
 	key.bb = bb;
 
-	struct binfo* data = avl_search(binfostore, compare_cb, &key, 0);
+	struct binfo* data = avl_search(cgctx->binfostore, compare_cb, &key, 0);
 	if (!data)
 	{
-		data = calloc(sizeof(struct binfo), 1);
+		data = arena_alloc(current_arena, sizeof(struct binfo));
 		data->bb = bb;
-		avl_insert(&binfostore, compare_cb, data, NULL);
+		avl_insert(&cgctx->binfostore, compare_cb, data, NULL);
 	}
 
 	return data;
 }
 
-void reset_binfo(void)
+static void discard_cb(void* node)
 {
-	binfostore = NULL;
-	binfolist = NULL;
 }
 
-static void enumerate_cb(void* node)
+/* The binfos and the list belong to the current arena. */
+
+void reset_binfo(void)
 {
-	binfocount++;
+	avl_nuke(cgctx->binfostore, discard_cb);
+	cgctx->binfostore = NULL;
+	cgctx->binfolist = NULL;
 }
 
-static void iterate_cb(void* node)
+/* The depth-first search below uses an explicit stack rather than
+ * recursion, as functions can have thousands of basic blocks. Each block is
+ * pushed once to visit it and again, underneath its children, to emit it
+ * once they're all done. */
+
+struct dfsframe
 {
-	binfolist[iterator] = node;
-	iterator++;
-}
+	struct basic_block* bb;
+	int finished;
+};
+
+static struct dfsframe* dfsstack = NULL;
+static int dfsstack_size = 0;
 
-static int sortindex_cb(const void* p1, const void* p2)
+static void push_dfsframe(int* sp, struct basic_block* bb, int finished)
 {
-	struct binfo* const * o1 = p1;
-	struct binfo* const * o2 = p2;
-	int id1 = (*o1)->id;
-	int id2 = (*o2)->id;
+	if (*sp == dfsstack_size)
+	{
+		dfsstack_size = dfsstack_size ? (dfsstack_size * 2) : 64;
+		dfsstack = realloc(dfsstack, dfsstack_size * sizeof(struct dfsframe));
+	}
 
-	if (id1 < id2)
-		return -1;
-	else if (id1 > id2)
-		return 1;
-	return 0;
+	dfsstack[*sp].bb = bb;
+	dfsstack[*sp].finished = finished;
+	(*sp)++;
 }
 
-void get_binfo_list(struct binfo*** list, int* count)
+/* Appends everything reachable from bb that hasn't been seen yet to the
+ * binfo list, in reverse postorder. */
+
+static void add_reachable_blocks(struct basic_block* bb,
+		unsigned long generation, int size)
 {
-	if (!binfolist)
+	int start = cgctx->binfocount;
+	int sp = 0;
+
+	push_dfsframe(&sp, bb, 0);
+	while (sp > 0)
 	{
-		binfocount = 0;
-		avl_traverse(binfostore, enumerate_cb);
+		struct dfsframe frame = dfsstack[--sp];
+
+		if (frame.finished)
+		{
+			assert(cgctx->binfocount < size);
+			cgctx->binfolist[cgctx->binfocount++] =
+				lookup_binfo_of_basic_block(frame.bb);
+			continue;
+		}
+
+		if (frame.bb->generation == generation)
+			continue;
+		frame.bb->generation = generation;
+
+		/* Children are pushed backwards, so they're visited in order. */
+
+		push_dfsframe(&sp, frame.bb, 1);
+
+		struct basic_block* child;
+		FOR_EACH_PTR_REVERSE(frame.bb->children, child)
+		{
+			if (child->generation != generation)
+				push_dfsframe(&sp, child, 0);
+		}
+		END_FOR_EACH_PTR_REVERSE(child);
+	}
 
-		binfolist = calloc(sizeof(struct binfo*), binfocount);
-		iterator = 0;
-		avl_traverse(binfostore, iterate_cb);
+	/* That's postorder; turn it round. */
 
-		qsort(binfolist, binfocount, sizeof(struct binfo*),
-				sortindex_cb);
+	int i = start;
+	int j = cgctx->binfocount - 1;
+	while (i < j)
+	{
+		struct binfo* t = cgctx->binfolist[i];
+		cgctx->binfolist[i] = cgctx->binfolist[j];
+		cgctx->binfolist[j] = t;
+		i++;
+		j--;
 	}
+}
+
+/* Numbers a function's basic blocks in reverse postorder from the entry
+ * block, so that the entry is always 0 and (loops aside) every block comes
+ * after its parents. This is the order code is generated in, and also the
+ * order in which the rewriter and the register allocator visit blocks.
+ * Blocks which can only be reached by following parent links go at the
+ * end. */
+
+void number_basic_blocks(struct entrypoint* ep)
+{
+	unsigned long generation = ++bb_generation;
+	int size = ptr_list_size((struct ptr_list*) ep->bbs);
+
+	cgctx->binfolist = arena_alloc(current_arena,
+			sizeof(struct binfo*) * size);
+	cgctx->binfocount = 0;
+
+	add_reachable_blocks(ep->entry->bb, generation, size);
+
+	int i;
+	for (i = 0; i < cgctx->binfocount; i++)
+	{
+		struct basic_block* parent;
+		FOR_EACH_PTR(cgctx->binfolist[i]->bb->parents, parent)
+		{
+			if (parent->generation != generation)
+				add_reachable_blocks(parent, generation, size);
+		}
+		END_FOR_EACH_PTR(parent);
+	}
+
+	for (i = 0; i < cgctx->binfocount; i++)
+		cgctx->binfolist[i]->id = i;
+}
+
+/* Returns the blocks numbered by number_basic_blocks(), in order. */
+
+void get_binfo_list(struct binfo*** list, int* count)
+{
+	assert(cgctx->binfolist);
 
-	*list = binfolist;
-	*count = binfocount;
+	*list = cgctx->binfolist;
+	*count = cgctx->binfocount;
 }
 
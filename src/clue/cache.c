@@ -0,0 +1,437 @@
+/* cache.c
+ * On-disk cache of generated functions
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+#include "avl.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* With --cache, the generated code for each function is kept in a directory,
+ * in a file named after a hash of everything the code generator looks at:
+ * the backend, the compiler binary, the function's linearized instructions,
+ * and the names and types of the symbols it refers to. If the same function
+ * turns up again, its code is copied back out of the cache instead of being
+ * generated.
+ *
+ * sparse numbers pseudos and labels globally, so these are renumbered in
+ * order of first appearance before hashing; otherwise a function's key
+ * would depend on what came before it in the file.
+ */
+
+#define CACHE_FORMAT "clue function cache 1"
+
+const char* function_cache_dir = NULL;
+
+int function_cache_hits = 0;
+int function_cache_misses = 0;
+static const char* compiler_id = NULL;
+static const char* cache_filename = NULL;
+
+/* The key is two independent 64-bit hashes, to make collisions vanishingly
+ * unlikely. */
+
+static uint64_t hash1;
+static uint64_t hash2;
+
+static void hash_bytes(const char* data, size_t len)
+{
+	while (len--)
+	{
+		unsigned char c = *data++;
+		hash1 = (hash1 ^ c) * 0x100000001b3ULL;
+		hash2 = (hash2 + c + 1) * 0x9e3779b97f4a7c15ULL;
+		hash2 ^= hash2 >> 29;
+	}
+}
+
+static void hash_string(const char* s)
+{
+	/* Include the terminator, so that "ab"+"c" differs from "a"+"bc". */
+	hash_bytes(s, strlen(s) + 1);
+}
+
+static void hash_reset(void)
+{
+	hash1 = 0xcbf29ce484222325ULL;
+	hash2 = 0x84222325cbf29ce4ULL;
+}
+
+static const char* hash_result(void)
+{
+	return aprintf("%016llx%016llx", (unsigned long long) hash1,
+			(unsigned long long) hash2);
+}
+
+/* Identifies the compiler, so that rebuilding it invalidates the cache. */
+
+static const char* get_compiler_id(void)
+{
+	if (compiler_id)
+		return compiler_id;
+
+	hash_reset();
+	hash_string(__DATE__ " " __TIME__);
+
+	int fd = open("/proc/self/exe", O_RDONLY);
+	if (fd != -1)
+	{
+		char buffer[4096];
+		ssize_t len;
+		while ((len = read(fd, buffer, sizeof(buffer))) > 0)
+			hash_bytes(buffer, len);
+		close(fd);
+	}
+
+	compiler_id = arena_printf(&program_arena, "%s", hash_result());
+	return compiler_id;
+}
+
+/* Describes a type in enough detail to tell apart anything the code
+ * generator would treat differently. Structures are described by size
+ * only, so this always terminates. */
+
+static const char* show_type_for_cache(struct symbol* s)
+{
+	if (!s)
+		return "-";
+
+	switch (s->type)
+	{
+		case SYM_PTR:
+			return aprintf("p(%s)", show_type_for_cache(s->ctype.base_type));
+
+		case SYM_ARRAY:
+			return aprintf("a(%s)", show_type_for_cache(s->ctype.base_type));
+
+		case SYM_STRUCT:
+		case SYM_UNION:
+			return aprintf("s%d", s->bit_size);
+
+		case SYM_FN:
+		{
+			const char* desc = aprintf("f%d(%s", s->variadic,
+					show_type_for_cache(s->ctype.base_type));
+
+			struct symbol* arg;
+			FOR_EACH_PTR(s->arguments, arg)
+			{
+				desc = aprintf("%s,%s", desc, show_type_for_cache(arg));
+			}
+			END_FOR_EACH_PTR(arg);
+
+			return aprintf("%s)", desc);
+		}
+
+		default:
+			break;
+	}
+
+	if (s == &int_type)
+		return "i";
+	if (s == &fp_type)
+		return "r";
+	if (s == &ptr_ctype)
+		return "p";
+	if (s == &void_ctype)
+		return "v";
+
+	return aprintf("%d:%s", s->bit_size,
+			show_type_for_cache(s->ctype.base_type));
+}
+
+/* Renumbering of pseudos and labels. */
+
+struct renumbering
+{
+	const char* token;
+	int number;
+};
+
+static avltree_t renumberings = NULL;
+static int renumbering_count;
+
+static int compare_cb(const void* lhs, const void* rhs)
+{
+	const struct renumbering* n1 = lhs;
+	const struct renumbering* n2 = rhs;
+	return strcmp(n1->token, n2->token);
+}
+
+static void free_renumbering_cb(void* data)
+{
+	struct renumbering* r = data;
+	free((void*) r->token);
+	free(r);
+}
+
+static int renumber(const char* token, int len)
+{
+	struct renumbering key;
+	key.token = strndup(token, len);
+
+	struct renumbering* data = avl_search(renumberings, compare_cb, &key, 0);
+	if (data)
+	{
+		free((void*) key.token);
+		return data->number;
+	}
+
+	data = malloc(sizeof(struct renumbering));
+	data->token = key.token;
+	data->number = renumbering_count++;
+	avl_insert(&renumberings, compare_cb, data, NULL);
+	return data->number;
+}
+
+/* Hashes a line of show_instruction() output, replacing pseudo numbers
+ * (%r and %phi) and addresses (.L0x... labels and <anon symbol:0x...>) with
+ * their renumbered equivalents. Everything else is hashed verbatim. */
+
+static void hash_instruction_text(const char* s)
+{
+	const char* line = s;
+	while (*s)
+	{
+		const char* start = s;
+		int prefix = 0;
+
+		if ((s[0] == '%') && (s[1] == 'r'))
+			prefix = 2;
+		else if (strncmp(s, "%phi", 4) == 0)
+			prefix = 4;
+		else if ((s[0] == '0') && (s[1] == 'x') && (s > line) &&
+				((s[-1] == 'L') || (s[-1] == ':')))
+			prefix = 2;
+
+		if (prefix && isxdigit(s[prefix]))
+		{
+			s += prefix;
+			while (isxdigit(*s))
+				s++;
+
+			char buffer[32];
+			sprintf(buffer, "#%d", renumber(start, s - start));
+			hash_string(buffer);
+		}
+		else
+		{
+			hash_bytes(s, 1);
+			s++;
+		}
+	}
+	hash_bytes("", 1);
+}
+
+/* show_instruction() abbreviates some constants; hash them exactly. */
+
+static void hash_setval(struct instruction* insn)
+{
+	struct expression* expr = insn->val;
+	if (!expr)
+		return;
+
+	switch (expr->type)
+	{
+		case EXPR_VALUE:
+			hash_string(aprintf("%lld", expr->value));
+			break;
+
+		case EXPR_FVALUE:
+			hash_string(aprintf("%La", expr->fvalue));
+			break;
+
+		case EXPR_STRING:
+			hash_bytes(expr->string->data, expr->string->length);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* Computes the key for a function. */
+
+static const char* compute_key(struct entrypoint* ep)
+{
+	const char* id = get_compiler_id();
+
+	hash_reset();
+	hash_string(CACHE_FORMAT);
+	hash_string(id);
+	hash_string(cg_name);
+	hash_string(linking ? "link" : "nolink");
+
+	hash_string(show_symbol_mangled(ep->name));
+	hash_string(show_type_for_cache(ep->name->ctype.base_type));
+
+	pseudo_t pseudo;
+	FOR_EACH_PTR(ep->accesses, pseudo)
+	{
+		if (pseudo->type == PSEUDO_SYM)
+		{
+			struct symbol* sym = pseudo->sym;
+
+			if ((sym->ctype.modifiers & MOD_STATIC) ||
+					(sym->ctype.modifiers & MOD_EXTERN))
+				hash_string(show_symbol_mangled(sym));
+			else
+				hash_string(show_ident(sym->ident));
+			hash_string(show_type_for_cache(sym));
+		}
+	}
+	END_FOR_EACH_PTR(pseudo);
+
+	renumbering_count = 0;
+
+	struct basic_block* bb;
+	FOR_EACH_PTR(ep->bbs, bb)
+	{
+		hash_instruction_text(aprintf(".L%p", bb));
+
+		struct instruction* insn;
+		FOR_EACH_PTR(bb->insns, insn)
+		{
+			if (!insn->bb)
+				continue;
+
+			hash_instruction_text(show_instruction(insn));
+			hash_string(show_type_for_cache(insn->type));
+			if (insn->opcode == OP_SETVAL)
+				hash_setval(insn);
+		}
+		END_FOR_EACH_PTR(insn);
+	}
+	END_FOR_EACH_PTR(bb);
+
+	avl_nuke(renumberings, free_renumbering_cb);
+	renumberings = NULL;
+
+	return hash_result();
+}
+
+/* Reads a whole file, or returns NULL. */
+
+static char* read_file(const char* filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	char* data = malloc(st.st_size + 1);
+	size_t pos = 0;
+	while (pos < st.st_size)
+	{
+		ssize_t len = read(fd, data + pos, st.st_size - pos);
+		if (len <= 0)
+			break;
+		pos += len;
+	}
+	close(fd);
+
+	if (pos != st.st_size)
+	{
+		free(data);
+		return NULL;
+	}
+
+	data[pos] = '\0';
+	return data;
+}
+
+/* Looks for a function in the cache. On a hit, its code is written to
+ * ZBUFFER_FUNCTION (exactly as generate_ep() would have) and 1 is returned.
+ * On a miss, the caller must generate the code and then call
+ * store_cached_function(). */
+
+int lookup_cached_function(struct entrypoint* ep)
+{
+	cache_filename = NULL;
+
+	/* Backends with state that outlives a function, and verbose output
+	 * (which contains addresses), can't be cached. */
+
+	if (!function_cache_dir || cg->uncacheable || verbose)
+		return 0;
+
+	cache_filename = aprintf("%s/%s", function_cache_dir, compute_key(ep));
+
+	char* data = read_file(cache_filename);
+	if (!data)
+	{
+		function_cache_misses++;
+		return 0;
+	}
+
+	zsetbuffer(ZBUFFER_FUNCTION);
+	zprintf("%s", data);
+	free(data);
+
+	function_cache_hits++;
+	cache_filename = NULL;
+	return 1;
+}
+
+/* Saves the function just generated into ZBUFFER_FUNCTION, leaving the
+ * buffer as it was. Failures are silently ignored; it's only a cache. The
+ * file is written under a temporary name and renamed into place, so
+ * concurrent compiles never see half a file. */
+
+void store_cached_function(void)
+{
+	if (!cache_filename)
+		return;
+
+	zsetbuffer(ZBUFFER_FUNCTION);
+	const char* code = zstring();
+	zprintf("%s", code);
+
+	mkdir(function_cache_dir, 0777);
+
+	const char* tempname = aprintf("%s.%d.tmp", cache_filename, getpid());
+	int fd = open(tempname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd != -1)
+	{
+		size_t len = strlen(code);
+		size_t pos = 0;
+		while (pos < len)
+		{
+			ssize_t written = write(fd, code + pos, len - pos);
+			if (written <= 0)
+				break;
+			pos += written;
+		}
+
+		if ((close(fd) == 0) && (pos == len))
+			rename(tempname, cache_filename);
+		else
+			unlink(tempname);
+	}
+
+	free((void*) code);
+	cache_filename = NULL;
+}
+
+/* Prints the hit and miss counts, if the cache was in use. */
+
+void report_function_cache(void)
+{
+	if (function_cache_dir)
+		fprintf(stderr, "clue: function cache: %d hits, %d misses\n",
+				function_cache_hits, function_cache_misses);
+}
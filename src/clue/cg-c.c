@@ -22,14 +22,21 @@ enum
 	CALLTYPE_PTR,
 };
 
-static int function_arg_list = 0;
-static struct hardreg* call_return_reg1;
-static struct hardreg* call_return_reg2;
-static struct hardreg* call_function_reg;
-static int call_arg_count;
-static int call_real_arg_count;
-static struct hardreg* call_arg[MAX_CALL_ARGS];
-static int register_count;
+/* Per-context state, found through cgctx->backend. */
+
+struct cgstate
+{
+	int function_arg_list;
+	struct hardreg* call_return_reg1;
+	struct hardreg* call_return_reg2;
+	struct hardreg* call_function_reg;
+	int call_arg_count;
+	int call_real_arg_count;
+	struct hardreg* call_arg[MAX_CALL_ARGS];
+	int register_count;
+};
+
+#define state ((struct cgstate*) cgctx->backend)
 
 enum
 {
@@ -91,7 +98,7 @@ static const struct
 
 static void cg_reset_registers(void)
 {
-	register_count = 0;
+	state->register_count = 0;
 }
 
 /* Initialize a new hardreg. */
@@ -100,8 +107,8 @@ static void cg_init_register(struct hardreg* reg, int regclass)
 {
 	assert(!reg->name);
 	reg->name = aprintf("%s%d", regclassdata[regclass].prefix,
-			register_count);
-	register_count++;
+			state->register_count);
+	state->register_count++;
 }
 
 /* Get the name of a register. */
@@ -157,23 +164,23 @@ static void cg_declare_function(struct symbol* sym, int returning)
 	}
 
 	zprintf("%s(", show_symbol_mangled(sym));
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_declare_function_arg(int regclass)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s", regclassdata[regclass].type);
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_declare_function_vararg()
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("...");
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_declare_function_end(void)
@@ -233,31 +240,31 @@ static void cg_function_prologue(struct symbol* sym, int returning)
 		}
 	}
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_function_prologue_arg(struct hardreg* reg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s %s", regclassdata[reg->regclass].type, show_hardreg(reg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_vararg(void)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("...");
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_reg(struct hardreg* reg)
 {
-	if (function_arg_list != -1)
+	if (state->function_arg_list != -1)
 	{
 		zprintf(") {\n");
-		function_arg_list = -1;
+		state->function_arg_list = -1;
 	}
 	zprintf("%s %s;\n", regclassdata[reg->regclass].type, show_hardreg(reg));
 }
@@ -340,6 +347,35 @@ static void cg_store(struct hardreg* simple, struct hardreg* base,
 	}
 }
 
+/* Stores a run of constants by copying from a static aggregate. Zeroes are
+ * left out, as the storage starts zeroed anyway. */
+
+static void cg_store_constants(struct hardreg* base, int offset,
+		const struct initvalue* values, int count)
+{
+	int last = count - 1;
+	int i;
+
+	while ((last >= 0) && is_zero_initvalue(&values[last]))
+		last--;
+	if (last < 0)
+		return;
+
+	zprintf("{\n");
+	zprintf("static const clue_slot_t data[%d] = {\n", last + 1);
+	for (i = 0; i <= last; i++)
+	{
+		const struct initvalue* v = &values[i];
+		if (!is_zero_initvalue(v))
+			zprintf("[%d] = { .%s = %s },\n", i, v->isfloat ? "f" : "i",
+					show_initvalue(v));
+	}
+	zprintf("};\n");
+	zprintf("memcpy(&%s[%d], data, sizeof(data));\n", show_hardreg(base),
+			offset);
+	zprintf("}\n");
+}
+
 /* Load a constant int. */
 
 static void cg_set_int(long long int value, struct hardreg* dest)
@@ -438,63 +474,63 @@ static void cg_select(struct hardreg* cond,
 static void cg_call(struct hardreg* func,
 		struct hardreg* dest1, struct hardreg* dest2)
 {
-	call_function_reg = func;
-	call_arg_count = 0;
-	call_real_arg_count = -1;
-	call_return_reg1 = dest1;
-	call_return_reg2 = dest2;
+	state->call_function_reg = func;
+	state->call_arg_count = 0;
+	state->call_real_arg_count = -1;
+	state->call_return_reg1 = dest1;
+	state->call_return_reg2 = dest2;
 }
 
 static void cg_call_arg(struct hardreg* arg)
 {
-	call_arg[call_arg_count] = arg;
-	call_arg_count++;
+	state->call_arg[state->call_arg_count] = arg;
+	state->call_arg_count++;
 }
 
 static void cg_call_vararg(struct hardreg* arg)
 {
-	if (call_real_arg_count == -1)
-		call_real_arg_count = call_arg_count;
+	if (state->call_real_arg_count == -1)
+		state->call_real_arg_count = state->call_arg_count;
 
-	call_arg[call_arg_count] = arg;
-	call_arg_count++;
+	state->call_arg[state->call_arg_count] = arg;
+	state->call_arg_count++;
 }
 
 static void cg_call_end(void)
 {
-	if (call_real_arg_count == -1)
-		call_real_arg_count = call_arg_count;
+	if (state->call_real_arg_count == -1)
+		state->call_real_arg_count = state->call_arg_count;
 
-	if (call_return_reg1 && call_return_reg2)
+	if (state->call_return_reg1 && state->call_return_reg2)
 		zprintf("{ clue_ptr_pair_t _r = ");
-	else if (call_return_reg1)
-		zprintf("%s = ", show_hardreg(call_return_reg1));
+	else if (state->call_return_reg1)
+		zprintf("%s = ", show_hardreg(state->call_return_reg1));
 
 	/* Emit a cast turning the clue_fptr_t into a function of the right type.
 	 * */
 
 	zprintf("((");
-	if (call_return_reg1 && call_return_reg2)
+	if (state->call_return_reg1 && state->call_return_reg2)
 		zprintf("clue_ptr_pair_t");
-	else if (call_return_reg1)
-		zprintf("%s", regclassdata[call_return_reg1->regclass].type);
+	else if (state->call_return_reg1)
+		zprintf("%s", regclassdata[state->call_return_reg1->regclass].type);
 	else
 		zprintf("void");
 	zprintf(" (*)(");
 
-	if (call_arg_count == 0)
+	if (state->call_arg_count == 0)
 		zprintf("void");
 	else
 	{
 		int i = 0;
-		for (i = 0; i < call_real_arg_count; i++)
+		for (i = 0; i < state->call_real_arg_count; i++)
 		{
 			if (i > 0)
 				zprintf(", ");
-			zprintf("%s", regclassdata[call_arg[i]->regclass].type);
+			zprintf("%s", regclassdata[state->call_arg[i]->regclass].type);
 		}
 
-		if (call_real_arg_count < call_arg_count)
+		if (state->call_real_arg_count < state->call_arg_count)
 		{
 			if (i > 0)
 				zprintf(", ");
@@ -506,35 +542,87 @@ static void cg_call_end(void)
 
 	/* ...the function pointer... */
 
-	zprintf("%s)", show_hardreg(call_function_reg));
+	zprintf("%s)", show_hardreg(state->call_function_reg));
 
 	/* ...and the arguments. */
 
 	zprintf("(");
 	{
 		int i;
-		for (i = 0; i < call_arg_count; i++)
+		for (i = 0; i < state->call_arg_count; i++)
 		{
 			if (i > 0)
 				zprintf(", ");
-			zprintf("%s", show_hardreg(call_arg[i]));
+			zprintf("%s", show_hardreg(state->call_arg[i]));
 		}
 	}
 	zprintf(")");
 
 	/* Now the call epilogue. */
 
-	if (call_return_reg1 && call_return_reg2)
+	if (state->call_return_reg1 && state->call_return_reg2)
 	{
 		zprintf("; ");
-		zprintf("%s = _r.i;\n", show_hardreg(call_return_reg1));
-		zprintf("%s = _r.o;\n", show_hardreg(call_return_reg2));
+		zprintf("%s = _r.i;\n", show_hardreg(state->call_return_reg1));
+		zprintf("%s = _r.o;\n", show_hardreg(state->call_return_reg2));
 		zprintf("}");
 	}
 
 	zprintf(";\n");
 }
 
+/* Emit pieces of a printf() with a constant format. */
+
+static void cg_printf_text(const char* text, int len)
+{
+	int i;
+
+	zprintf("clue_printf_text(\"");
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = text[i];
+		if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\') &&
+				(c != '?'))
+			zprintf("%c", c);
+		else
+			zprintf("\\%03o", c);
+	}
+	zprintf("\", %d);\n", len);
+}
+
+static void cg_printf_conversion(const char* spec, int conversion,
+		struct hardregref* arg)
+{
+	switch (conversion)
+	{
+		case 's':
+			zprintf("clue_printf_string(\"%s\", %s, %s);\n",
+					spec, show_hardreg(arg->simple), show_hardreg(arg->base));
+			break;
+
+		case 'c':
+			zprintf("clue_printf_char(\"%s\", %s);\n",
+					spec, show_hardreg(arg->simple));
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'g':
+		case 'G':
+			zprintf("clue_printf_real(\"%s\", %s);\n",
+					spec, show_hardreg(arg->simple));
+			break;
+
+		default:
+			/* Integers are passed as long longs. */
+			zprintf("clue_printf_int(\"%.*sll%c\", %s);\n",
+					(int) strlen(spec) - 1, spec, conversion,
+					show_hardreg(arg->simple));
+			break;
+	}
+}
+
 /* Return a pointer. */
 
 static void cg_ret(struct hardreg* reg1, struct hardreg* reg2)
@@ -573,6 +661,9 @@ const struct codegenerator cg_c =
 	.spname = "sp",
 	.fpname = "fp",
 	.stackname = "stack",
+	.infinity = "INFINITY",
+	.nan = "NAN",
+	.state_size = sizeof(struct cgstate),
 
 	.register_class =
 	{
@@ -620,6 +711,7 @@ const struct codegenerator cg_c =
 	.copy = cg_copy,
 	.load = cg_load,
 	.store = cg_store,
+	.store_constants = cg_store_constants,
 
 	.set_int = cg_set_int,
 	.set_float = cg_set_float,
@@ -655,6 +747,9 @@ const struct codegenerator cg_c =
 	.call_vararg = cg_call_vararg,
 	.call_end = cg_call_end,
 
+	.printf_text = cg_printf_text,
+	.printf_conversion = cg_printf_conversion,
+
 	.ret = cg_ret,
 
 	.memcpyimpl = cg_memcpy
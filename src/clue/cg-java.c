@@ -11,6 +11,7 @@
  */
 
 #include "globals.h"
+#include <stdint.h>
 
 enum
 {
@@ -21,13 +22,41 @@ enum
 	CALLTYPE_PTR,
 };
 
-static int function_is_initialiser = 0;
-static int function_arg_list = 0;
-static struct hardreg* call_return_reg1;
-static struct hardreg* call_return_reg2;
-static struct hardreg* call_function_reg;
-static int call_arg_count;
-static int register_count;
+/* Wrappers are shared by the whole program. */
+
+static struct symbol_list* wrapped_functions = NULL;
+static const char* wrapper_prefix = NULL;
+
+/* Functions whose code grows beyond this many bytes of Java are split into
+ * several methods ('chunks') at basic block boundaries. HotSpot won't compile
+ * methods of more than 8000 bytecodes, and javac rejects anything over 64kB.
+ */
+
+#define MAX_CHUNK_SIZE 12000
+
+/* Per-context state, found through cgctx->backend. */
+
+struct cgstate
+{
+	int function_is_initialiser;
+	int function_arg_list;
+	struct hardreg* call_return_reg1;
+	struct hardreg* call_return_reg2;
+	const char* call_function_name;
+	int call_is_direct;
+	int call_arg_count;
+	int register_count;
+
+	const char* function_name;
+	int function_returning;
+	struct hardreg* function_args[NUM_REGS];
+	int chunk_count;
+	size_t chunk_start;
+	int* chunk_map;
+	int chunk_map_size;
+};
+
+#define state ((struct cgstate*) cgctx->backend)
 
 enum
 {
@@ -44,6 +73,8 @@ static const struct
 	const char* type;
 	const char* memtype;
 	const char* accessor;
+	const char* getter;
+	const char* setter;
 	const char* example;
 } regclassdata[] =
 {
@@ -71,6 +102,8 @@ static const struct
 		.type = "ClueMemory",
 		.memtype = "ClueMemory",
 		.accessor = "objectdata",
+		.getter = "objectOf",
+		.setter = "setObject",
 		.example = "null",
 	},
 
@@ -80,6 +113,8 @@ static const struct
 		.type = "ClueRunnable",
 		.memtype = "ClueRunnable",
 		.accessor = "functiondata",
+		.getter = "functionOf",
+		.setter = "setFunction",
 		.example = "null",
 	},
 
@@ -96,11 +131,39 @@ static const struct
 	},
 };
 
+/* Returns an expression reading a value of the given register class from
+ * memory. The pointer arrays in ClueMemory are created lazily, so pointers
+ * must go through the accessors; numbers are read directly. */
+
+static const char* show_memory_read(const char* base, const char* index,
+		int regclass)
+{
+	if (regclassdata[regclass].getter)
+		return aprintf("%s.%s(%s)", base,
+				regclassdata[regclass].getter, index);
+	return aprintf("%s.%s[%s]", base,
+			regclassdata[regclass].accessor, index);
+}
+
+/* Emits a statement writing a value of the given register class to memory. */
+
+static void emit_memory_write(const char* base, const char* index,
+		int regclass, const char* value)
+{
+	if (regclassdata[regclass].setter)
+		zprintf("%s.%s(%s, %s);\n", base,
+				regclassdata[regclass].setter, index, value);
+	else
+		zprintf("%s.%s[%s] = (%s) %s;\n", base,
+				regclassdata[regclass].accessor, index,
+				regclassdata[regclass].memtype, value);
+}
+
 /* Reset the register tracking. */
 
 static void cg_reset_registers(void)
 {
-	register_count = 0;
+	state->register_count = 0;
 }
 
 /* Initialize a new hardreg. */
@@ -109,8 +172,8 @@ static void cg_init_register(struct hardreg* reg, int regclass)
 {
 	assert(!reg->name);
 	reg->name = aprintf("%s%d", regclassdata[regclass].prefix,
-			register_count);
-	register_count++;
+			state->register_count);
+	state->register_count++;
 }
 
 /* Get the name of a register. */
@@ -127,10 +190,113 @@ static void cg_prologue(void)
 {
 }
 
+/* Returns the Java type used to return a value of the given register class.
+ */
+
+static const char* get_return_type(int regclass)
+{
+	switch (regclass)
+	{
+		case REGCLASS_VOID:
+			return "void";
+
+		case REGCLASS_REGPAIR:
+			return regclassdata[REGCLASS_INT].type;
+
+		default:
+			return regclassdata[regclass].type;
+	}
+}
+
+/* Returns the name of the ClueRunnable wrapper for a function. These are
+ * emitted per file, so the name has to be unique. */
+
+static const char* show_wrapper_name(struct symbol* sym)
+{
+	/* This has to stay the same for all the files in this output. */
+
+	if (!wrapper_prefix)
+		wrapper_prefix = arena_printf(&program_arena, "fp%u", unique);
+	return aprintf("%s%s", wrapper_prefix, show_symbol_mangled(sym));
+}
+
+/* Adds an argument to a wrapper's call to the real function. */
+
+static void emit_wrapper_arg(int regclass, int* argcount)
+{
+	if (*argcount > 0)
+		zprintf(", ");
+	zprintf("(%s) %s",
+			regclassdata[regclass].type,
+			show_memory_read("args", aprintf("%d", *argcount), regclass));
+	(*argcount)++;
+}
+
+/* Emits a ClueRunnable which adapts the args ABI used for indirect calls to
+ * a function's real static method. */
+
+static void emit_wrapper(struct symbol* sym)
+{
+	struct symbol* fn = sym->ctype.base_type;
+	int returning = find_regclass_for_returntype(
+			get_base_type_of_symbol(fn->ctype.base_type));
+
+	zprintf("public static final ClueRunnable %s = new ClueRunnable() {\n",
+			show_wrapper_name(sym));
+	zprintf("public void run() {\n");
+
+	if (returning != REGCLASS_VOID)
+		zprintf("%s result = ", get_return_type(returning));
+	zprintf("%s(", show_symbol_mangled(sym));
+
+	int argcount = 0;
+	emit_wrapper_arg(REGCLASS_INT, &argcount);
+	emit_wrapper_arg(REGCLASS_OPTR, &argcount);
+
+	struct symbol* arg;
+	FOR_EACH_PTR(fn->arguments, arg)
+	{
+		int regclass = find_regclass_for_returntype(
+				get_base_type_of_symbol(arg));
+		if (regclass == REGCLASS_REGPAIR)
+		{
+			emit_wrapper_arg(REGCLASS_INT, &argcount);
+			emit_wrapper_arg(REGCLASS_OPTR, &argcount);
+		}
+		else
+			emit_wrapper_arg(regclass, &argcount);
+	}
+	END_FOR_EACH_PTR(arg);
+
+	zprintf(");\n");
+	switch (returning)
+	{
+		case REGCLASS_VOID:
+			break;
+
+		case REGCLASS_REGPAIR:
+			emit_memory_write("args", "0", REGCLASS_INT, "result");
+			emit_memory_write("args", "1", REGCLASS_OPTR, "retbase");
+			break;
+
+		default:
+			emit_memory_write("args", "0", returning, "result");
+			break;
+	}
+	zprintf("}};\n\n");
+}
+
 /* Emit the file epilogue. */
 
 static void cg_epilogue(void)
 {
+	struct symbol* sym;
+	FOR_EACH_PTR(wrapped_functions, sym)
+	{
+		if (is_symbol_linked(sym))
+			emit_wrapper(sym);
+	}
+	END_FOR_EACH_PTR(sym);
 }
 
 /* Emit a comment (contains no actual code). */
@@ -170,7 +336,14 @@ static void cg_declare_slot(struct symbol* sym, unsigned size)
 
 static void cg_create_storage(struct symbol* sym, unsigned size)
 {
-	zprintf("%s = new ClueMemory(%u);\n", show_symbol_mangled(sym), size);
+	/* This is emitted at class scope, before the initializer. */
+
+	if (sym->string)
+		zprintf("static { %s = newLiteral(%u); }\n",
+				show_symbol_mangled(sym), size);
+	else
+		zprintf("static { %s = new ClueMemory(%u); }\n",
+				show_symbol_mangled(sym), size);
 }
 
 static void cg_import(struct symbol* sym)
@@ -181,75 +354,232 @@ static void cg_export(struct symbol* sym)
 {
 }
 
+/* Emits the start of a chunk's state machine. */
+
+static void emit_chunk_header(int chunk)
+{
+	zprintf("%s chunk%d() {\n", get_return_type(state->function_returning), chunk);
+	zprintf("for (;;) {\n");
+	zprintf("switch (state) {\n");
+
+	/* Jumps to blocks in other chunks go back via the dispatcher. */
+
+	switch (state->function_returning)
+	{
+		case REGCLASS_VOID:
+			zprintf("default: chained = true; return;\n");
+			break;
+
+		case REGCLASS_REGPAIR:
+			zprintf("default: chained = true; return %s;\n",
+					regclassdata[REGCLASS_INT].example);
+			break;
+
+		default:
+			zprintf("default: chained = true; return %s;\n",
+					regclassdata[state->function_returning].example);
+			break;
+	}
+}
+
+/* Emits the method which runs a split function's chunks. */
+
+static void emit_chunk_dispatcher(void)
+{
+	int returning = state->function_returning;
+	int chunk;
+
+	zprintf("%s run() {\n", get_return_type(returning));
+	zprintf("for (;;) {\n");
+	if (returning != REGCLASS_VOID)
+		zprintf("%s r;\n", get_return_type(returning));
+	zprintf("chained = false;\n");
+	zprintf("switch (state) {\n");
+
+	for (chunk = 0; chunk <= state->chunk_count; chunk++)
+	{
+		int i;
+
+		if (chunk == 0)
+			zprintf("default:\n");
+		for (i = 0; i < state->chunk_map_size; i++)
+			if (state->chunk_map[i] == chunk)
+				zprintf("case %d:\n", i);
+
+		if (returning != REGCLASS_VOID)
+			zprintf("r = ");
+		zprintf("chunk%d(); break;\n", chunk);
+	}
+
+	zprintf("}\n");
+	if (returning != REGCLASS_VOID)
+		zprintf("if (!chained) return r;\n");
+	else
+		zprintf("if (!chained) return;\n");
+	zprintf("}}\n\n");
+}
+
+/* The runtime starts the program through runMain(), which passes main()
+ * only as many of argc and argv as it declares. */
+
+static void emit_run_main(struct symbol* sym)
+{
+	int numargs = ptr_list_size(
+			(struct ptr_list*) sym->ctype.base_type->arguments);
+
+	zprintf("public static void runMain(ClueMemory stack, int argc, "
+			"ClueMemory argv) {\n");
+	zprintf("_main(0, stack");
+	if (numargs > 0)
+		zprintf(", argc");
+	if (numargs > 1)
+		zprintf(", 0, argv");
+	zprintf(");\n");
+	zprintf("}\n\n");
+}
+
 static void cg_function_prologue(struct symbol* sym, int returning)
 {
 	if (!sym)
 	{
 		zprintf("static {\n");
 
-		function_is_initialiser = 1;
+		state->function_is_initialiser = 1;
 	}
 	else
 	{
-		const char* symname = show_symbol_mangled(sym);
-		zprintf("public static ClueRunnable %s = new ClueRunnable() {\n",
-				symname);
-		zprintf("public void run() {\n");
+		state->function_name = show_symbol_mangled(sym);
+		if (strcmp(state->function_name, "_main") == 0)
+			emit_run_main(sym);
 
-		function_is_initialiser = 0;
+		zprintf("public static %s %s(", get_return_type(returning),
+				state->function_name);
+
+		state->function_is_initialiser = 0;
 	}
 
-	function_arg_list = 0;
+	state->function_returning = returning;
+	state->function_arg_list = 0;
 }
 
 static void cg_function_prologue_arg(struct hardreg* reg)
 {
-	zprintf("%s %s = (%s) args.%s[%d];\n",
-		regclassdata[reg->regclass].type,
-		show_hardreg(reg),
-		regclassdata[reg->regclass].type,
-		regclassdata[reg->regclass].accessor,
-		function_arg_list);
+	if (state->function_arg_list > 0)
+		zprintf(", ");
+	zprintf("%s %s", regclassdata[reg->regclass].type, show_hardreg(reg));
 
-	function_arg_list++;
+	state->function_args[state->function_arg_list] = reg;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_vararg(void)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("*** varargs not supported yet***\n");
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_reg(struct hardreg* reg)
 {
-	zprintf("%s %s = %s;\n",
-			regclassdata[reg->regclass].type,
-			show_hardreg(reg),
-			regclassdata[reg->regclass].example);
+	if (!state->function_is_initialiser && (state->function_arg_list != -1))
+	{
+		zprintf(") {\n");
+
+		if (state->chunk_count > 0)
+		{
+			/* Split functions keep their registers in a frame object
+			 * so that all the chunks can see them; the method itself
+			 * just sets one up and runs it. */
+
+			int i;
+
+			zprintf("frame%s f = new frame%s();\n",
+					state->function_name, state->function_name);
+			for (i = 0; i < state->function_arg_list; i++)
+				zprintf("f.%s = %s;\n", show_hardreg(state->function_args[i]),
+						show_hardreg(state->function_args[i]));
+			if (state->function_returning != REGCLASS_VOID)
+				zprintf("return ");
+			zprintf("f.run();\n");
+			zprintf("}\n\n");
+
+			zprintf("static final class frame%s {\n", state->function_name);
+			for (i = 0; i < state->function_arg_list; i++)
+				zprintf("%s %s;\n",
+						regclassdata[state->function_args[i]->regclass].type,
+						show_hardreg(state->function_args[i]));
+		}
+
+		state->function_arg_list = -1;
+	}
+
+	if (state->chunk_count > 0)
+		zprintf("%s %s;\n",
+				regclassdata[reg->regclass].type,
+				show_hardreg(reg));
+	else
+		zprintf("%s %s = %s;\n",
+				regclassdata[reg->regclass].type,
+				show_hardreg(reg),
+				regclassdata[reg->regclass].example);
 }
 
 static void cg_function_prologue_end(void)
 {
-	zprintf("int state = 0;\n");
-	zprintf("stateloop: for (;;) {\n");
-	zprintf("switch (state) {\n");
+	if (state->chunk_count > 0)
+	{
+		zprintf("int state = 0;\n");
+		zprintf("boolean chained;\n\n");
+		emit_chunk_dispatcher();
+		emit_chunk_header(0);
+	}
+	else
+	{
+		zprintf("int state = 0;\n");
+		zprintf("stateloop: for (;;) {\n");
+		zprintf("switch (state) {\n");
+	}
 	zprintf("case 0:\n");
 }
 
 static void cg_function_epilogue(void)
 {
-	if (function_is_initialiser)
+	if (state->function_is_initialiser)
 		zprintf("}}}\n");
+	else if (state->chunk_count > 0)
+		zprintf("}}}}\n\n");
 	else
-		zprintf("}}}};\n\n");
+		zprintf("}}}\n\n");
+
+	state->chunk_count = 0;
+	state->chunk_start = 0;
+	state->chunk_map_size = 0;
 }
 
-/* Starts a basic block. */
+/* Starts a basic block. If the current chunk of the function has got too big,
+ * this is where a new one starts. (This happens before the function prologue
+ * is emitted, which is how the prologue knows whether the function is split.)
+ */
 
 static void cg_bb_start(struct binfo* binfo)
 {
+	if ((zsize() - state->chunk_start) > MAX_CHUNK_SIZE)
+	{
+		zprintf("}}}\n\n");
+		state->chunk_count++;
+		emit_chunk_header(state->chunk_count);
+		state->chunk_start = zsize();
+	}
+
+	while (binfo->id >= state->chunk_map_size)
+	{
+		state->chunk_map = realloc(state->chunk_map,
+				(state->chunk_map_size + 1) * sizeof(*state->chunk_map));
+		state->chunk_map[state->chunk_map_size++] = -1;
+	}
+	state->chunk_map[binfo->id] = state->chunk_count;
+
 	if (binfo->id != 0)
 		zprintf("case %d:\n", binfo->id);
 }
@@ -292,13 +622,12 @@ static void cg_copy(struct hardreg* src, struct hardreg* dest)
 static void cg_load(struct hardreg* simple, struct hardreg* base,
 		int offset, struct hardreg* dest)
 {
-	zprintf("%s = (%s) %s.%s[(int)%s + %d];\n",
+	zprintf("%s = (%s) %s;\n",
 			show_hardreg(dest),
 			regclassdata[dest->regclass].type,
-			show_hardreg(base),
-			regclassdata[dest->regclass].accessor,
-			show_hardreg(simple),
-			offset);
+			show_memory_read(show_hardreg(base),
+				aprintf("(int)%s + %d", show_hardreg(simple), offset),
+				dest->regclass));
 }
 
 /* Stores a value from a memory location. */
@@ -306,27 +635,118 @@ static void cg_load(struct hardreg* simple, struct hardreg* base,
 static void cg_store(struct hardreg* simple, struct hardreg* base,
 		int offset, struct hardreg* src)
 {
+	const char* index;
 	if (simple)
+		index = aprintf("(int)%s + %d", show_hardreg(simple), offset);
+	else
+		index = aprintf("%d", offset);
+
+	emit_memory_write(show_hardreg(base), index, src->regclass,
+			show_hardreg(src));
+}
+
+/* Constants are written to the class file as string literals, which are
+ * limited to 64kB of (modified) UTF-8. */
+
+#define MAX_PACKED_CHARS 20000
+
+/* Runs of at least this many zeroes aren't written at all, as ClueMemory
+ * starts out zeroed. */
+
+#define MIN_ZERO_RUN 8
+
+/* Emits one character of a packed string. Octal escapes are used rather
+ * than unicode ones because the latter are expanded before the string is
+ * parsed. */
+
+static void emit_packed_char(unsigned c)
+{
+	if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\'))
+		zprintf("%c", c);
+	else if (c < 0x100)
+		zprintf("\\%03o", c);
+	else
+		zprintf("\\u%04x", c);
+}
+
+/* Emits a run of constants with no long runs of zeroes in it. */
+
+static void emit_packed_constants(struct hardreg* base, int offset,
+		const struct initvalue* values, int count)
+{
+	int chars = 1;
+	int i;
+
+	for (i = 0; i < count; i++)
 	{
-		zprintf("%s.%s[(int)%s + %d] = (%s) %s;\n",
-				show_hardreg(base),
-				regclassdata[src->regclass].accessor,
-				show_hardreg(simple),
-				offset,
-				regclassdata[src->regclass].memtype,
-				show_hardreg(src));
+		const struct initvalue* v = &values[i];
+		if (v->isfloat || (v->ivalue < 0) || (v->ivalue > 0xffff))
+			chars = 0;
 	}
-	else
+
+	int perstring = chars ? MAX_PACKED_CHARS : (MAX_PACKED_CHARS / 4);
+	while (count > 0)
 	{
-		zprintf("%s.%s[%d] = (%s) %s;\n",
-				show_hardreg(base),
-				regclassdata[src->regclass].accessor,
-				offset,
-				regclassdata[src->regclass].memtype,
-				show_hardreg(src));
+		int n = (count < perstring) ? count : perstring;
+
+		zprintf("%s(%s, %d, \"", chars ? "unpackChars" : "unpackDoubles",
+				show_hardreg(base), offset);
+		for (i = 0; i < n; i++)
+		{
+			const struct initvalue* v = &values[i];
+
+			if (chars)
+				emit_packed_char(v->ivalue);
+			else
+			{
+				double d = v->isfloat ? v->fvalue : v->ivalue;
+				uint64_t bits;
+				memcpy(&bits, &d, sizeof(bits));
+
+				emit_packed_char((bits >> 48) & 0xffff);
+				emit_packed_char((bits >> 32) & 0xffff);
+				emit_packed_char((bits >> 16) & 0xffff);
+				emit_packed_char(bits & 0xffff);
+			}
+		}
+		zprintf("\");\n");
+
+		values += n;
+		offset += n;
+		count -= n;
 	}
 }
 
+/* Stores a run of constants as packed strings, skipping runs of zeroes. */
+
+static void cg_store_constants(struct hardreg* base, int offset,
+		const struct initvalue* values, int count)
+{
+	int start = 0;
+	int i = 0;
+
+	while (i < count)
+	{
+		int zeroes = 0;
+		while (((i + zeroes) < count) && is_zero_initvalue(&values[i + zeroes]))
+			zeroes++;
+
+		if ((zeroes >= MIN_ZERO_RUN) || ((i + zeroes) == count))
+		{
+			if (i > start)
+				emit_packed_constants(base, offset + start, values + start,
+						i - start);
+			start = i + zeroes;
+		}
+
+		i += zeroes ? zeroes : 1;
+	}
+
+	if (count > start)
+		emit_packed_constants(base, offset + start, values + start,
+				count - start);
+}
+
 /* Load a constant int. */
 
 static void cg_set_int(long long int value, struct hardreg* dest)
@@ -343,7 +763,7 @@ static void cg_set_float(long double value, struct hardreg* dest)
 
 /* Load a constant symbol. */
 
-static void cg_set_symbol(struct symbol* sym, struct hardreg* dest)
+static void cg_set_osymbol(struct symbol* sym, struct hardreg* dest)
 {
 	if (!sym)
 	{
@@ -356,6 +776,33 @@ static void cg_set_symbol(struct symbol* sym, struct hardreg* dest)
 	}
 }
 
+/* Load a constant function. Functions are static methods, so taking the
+ * address of one gets a ClueRunnable wrapper for it instead (except for
+ * variadic functions, which use the args ABI directly). */
+
+static void cg_set_fsymbol(struct symbol* sym, struct hardreg* dest)
+{
+	if (!sym)
+		zprintf("%s = null;\n", show_hardreg(dest));
+	else if (sym->ctype.base_type->variadic)
+		zprintf("%s = %s;\n", show_hardreg(dest),
+				show_symbol_mangled(sym));
+	else
+	{
+		struct symbol* s;
+		FOR_EACH_PTR(wrapped_functions, s)
+		{
+			if (strcmp(show_symbol_mangled(s), show_symbol_mangled(sym)) == 0)
+				goto found;
+		}
+		END_FOR_EACH_PTR(s);
+		add_symbol(&wrapped_functions, sym);
+
+	found:
+		zprintf("%s = %s;\n", show_hardreg(dest), show_wrapper_name(sym));
+	}
+}
+
 /* Convert to integer. */
 
 static void cg_toint(struct hardreg* src, struct hardreg* dest)
@@ -465,63 +912,141 @@ static void cg_select_arith(struct hardreg* cond,
 			"0");
 }
 
+/* Calls through a function pointer (or to a variadic function) use the args
+ * ABI: arguments and results are passed in the global args ClueMemory. */
+
 static void cg_call(struct hardreg* func,
 		struct hardreg* dest1, struct hardreg* dest2)
 {
-	call_function_reg = func;
-	call_arg_count = 0;
-	call_return_reg1 = dest1;
-	call_return_reg2 = dest2;
+	state->call_function_name = show_hardreg(func);
+	state->call_is_direct = 0;
+	state->call_arg_count = 0;
+	state->call_return_reg1 = dest1;
+	state->call_return_reg2 = dest2;
+}
+
+/* Calls to known functions invoke the static method directly, except for
+ * variadic ones, which still use the args ABI. */
+
+static void cg_call_direct(struct symbol* sym,
+		struct hardreg* dest1, struct hardreg* dest2)
+{
+	state->call_is_direct = !sym->ctype.base_type->variadic;
+	state->call_function_name = show_symbol_mangled(sym);
+	state->call_arg_count = 0;
+	state->call_return_reg1 = dest1;
+	state->call_return_reg2 = dest2;
+
+	if (!state->call_is_direct)
+		return;
+
+	if (dest1)
+		zprintf("%s = ", show_hardreg(dest1));
+	zprintf("%s(", state->call_function_name);
 }
 
 static void cg_call_arg(struct hardreg* arg)
 {
-	zprintf("args.%s[%u] = (%s) %s;\n",
-			regclassdata[arg->regclass].accessor,
-			call_arg_count,
-			regclassdata[arg->regclass].memtype,
-			show_hardreg(arg));
+	if (state->call_is_direct)
+	{
+		if (state->call_arg_count > 0)
+			zprintf(", ");
+		zprintf("%s", show_hardreg(arg));
+	}
+	else
+		emit_memory_write("args", aprintf("%u", state->call_arg_count),
+				arg->regclass, show_hardreg(arg));
 
-	call_arg_count++;
+	state->call_arg_count++;
 }
 
 static void cg_call_end(void)
 {
+	if (state->call_is_direct)
+	{
+		zprintf(");\n");
+		if (state->call_return_reg2)
+			zprintf("%s = retbase;\n", show_hardreg(state->call_return_reg2));
+		return;
+	}
+
 	/* The function call... */
 
-	zprintf("%s.run();\n", show_hardreg(call_function_reg));
+	zprintf("%s.run();\n", state->call_function_name);
 
 	/* Now the call epilogue. */
 
-	if (call_return_reg1)
-		zprintf("%s = (%s) args.%s[0];\n",
-				show_hardreg(call_return_reg1),
-				regclassdata[call_return_reg1->regclass].type,
-				regclassdata[call_return_reg1->regclass].accessor);
-	if (call_return_reg2)
-		zprintf("%s = (%s) args.%s[1];\n",
-				show_hardreg(call_return_reg2),
-				regclassdata[call_return_reg2->regclass].type,
-				regclassdata[call_return_reg2->regclass].accessor);
+	if (state->call_return_reg1)
+		zprintf("%s = (%s) %s;\n",
+				show_hardreg(state->call_return_reg1),
+				regclassdata[state->call_return_reg1->regclass].type,
+				show_memory_read("args", "0",
+					state->call_return_reg1->regclass));
+	if (state->call_return_reg2)
+		zprintf("%s = (%s) %s;\n",
+				show_hardreg(state->call_return_reg2),
+				regclassdata[state->call_return_reg2->regclass].type,
+				show_memory_read("args", "1",
+					state->call_return_reg2->regclass));
+}
+
+/* Emit pieces of a printf() with a constant format. String.format() has
+ * no %i or %u. */
+
+static void cg_printf_text(const char* text, int len)
+{
+	int i;
+
+	zprintf("printfText(\"");
+	for (i = 0; i < len; i++)
+		emit_packed_char((unsigned char) text[i]);
+	zprintf("\");\n");
+}
+
+static void cg_printf_conversion(const char* spec, int conversion,
+		struct hardregref* arg)
+{
+	int len = strlen(spec) - 1;
+
+	switch (conversion)
+	{
+		case 's':
+			zprintf("printfString(\"%s\", %s, %s);\n",
+					spec, show_hardreg(arg->simple), show_hardreg(arg->base));
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'g':
+		case 'G':
+			zprintf("printfReal(\"%s\", %s);\n",
+					spec, show_hardreg(arg->simple));
+			break;
+
+		case 'i':
+		case 'u':
+			conversion = 'd';
+			/* fall through */
+		default:
+			zprintf("printfInt(\"%.*s%c\", %s);\n",
+					len, spec, conversion, show_hardreg(arg->simple));
+			break;
+	}
 }
 
-/* Return a pointer. */
+/* Return. Pointers return the offset as the result and leave the base in
+ * retbase. */
 
 static void cg_ret(struct hardreg* reg1, struct hardreg* reg2)
 {
-	if (reg1)
-		zprintf("args.%s[0] = (%s) %s;\n",
-				regclassdata[reg1->regclass].accessor,
-				regclassdata[reg1->regclass].memtype,
-				show_hardreg(reg1));
-	if (reg2)
-		zprintf("args.%s[1] = (%s) %s;\n",
-				regclassdata[reg2->regclass].accessor,
-				regclassdata[reg2->regclass].memtype,
-				show_hardreg(reg2));
-
-	if (function_is_initialiser)
+	if (state->function_is_initialiser)
 		zprintf("break stateloop;\n");
+	else if (reg2)
+		zprintf("retbase = %s; return %s;\n",
+				show_hardreg(reg2), show_hardreg(reg1));
+	else if (reg1)
+		zprintf("return %s;\n", show_hardreg(reg1));
 	else
 		zprintf("return;\n");
 }
@@ -533,19 +1058,14 @@ static void cg_memcpy(struct hardregref* src, struct hardregref* dest, int size)
 	assert(src->type == TYPE_PTR);
 	assert(dest->type == TYPE_PTR);
 
-	zprintf("args.doubledata[0] = sp;\n");
-	zprintf("args.objectdata[1] = stack;\n");
-	zprintf("args.doubledata[2] = (double) %s;\n",
-			show_hardreg(dest->simple));
-	zprintf("args.objectdata[3] = %s;\n",
-			show_hardreg(dest->base));
-	zprintf("args.doubledata[4] = (double) %s;\n",
-			show_hardreg(src->simple));
-	zprintf("args.objectdata[5] = %s;\n",
-			show_hardreg(src->base));
-	zprintf("args.doubledata[5] = (double) %d;\n",
+	zprintf("_memcpy(%s, %s, %s, %s, %s, %s, %d);\n",
+			show_hardreg(&cgctx->stackoffset_reg),
+			show_hardreg(&cgctx->stackbase_reg),
+			show_hardreg(dest->simple),
+			show_hardreg(dest->base),
+			show_hardreg(src->simple),
+			show_hardreg(src->base),
 			size);
-	zprintf("_memcpy.run();\n");
 }
 
 
@@ -555,6 +1075,8 @@ const struct codegenerator cg_java =
 	.spname = "sp",
 	.fpname = "fp",
 	.stackname = "stack",
+	.state_size = sizeof(struct cgstate),
+	.uncacheable = 1,
 
 	.register_class =
 	{
@@ -598,11 +1120,12 @@ const struct codegenerator cg_java =
 	.copy = cg_copy,
 	.load = cg_load,
 	.store = cg_store,
+	.store_constants = cg_store_constants,
 
 	.set_int = cg_set_int,
 	.set_float = cg_set_float,
-	.set_osymbol = cg_set_symbol,
-	.set_fsymbol = cg_set_symbol,
+	.set_osymbol = cg_set_osymbol,
+	.set_fsymbol = cg_set_fsymbol,
 
 	.toint = cg_toint,
 	.negate = cg_negate,
@@ -632,6 +1155,10 @@ const struct codegenerator cg_java =
 	.call_arg = cg_call_arg,
 	.call_vararg = cg_call_arg,
 	.call_end = cg_call_end,
+	.call_direct = cg_call_direct,
+
+	.printf_text = cg_printf_text,
+	.printf_conversion = cg_printf_conversion,
 
 	.ret = cg_ret,
 
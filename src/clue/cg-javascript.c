@@ -12,17 +12,24 @@
 
 #include "globals.h"
 
-static int function_arg_list = 0;
-static int function_is_initializer = 0;
-static struct hardreg* call_return_ptr1;
-static struct hardreg* call_return_ptr2;
-static int register_count;
+/* Per-context state, found through cgctx->backend. */
+
+struct cgstate
+{
+	int function_arg_list;
+	int function_is_initializer;
+	struct hardreg* call_return_ptr1;
+	struct hardreg* call_return_ptr2;
+	int register_count;
+};
+
+#define state ((struct cgstate*) cgctx->backend)
 
 /* Reset the register tracking. */
 
 static void cg_reset_registers(void)
 {
-	register_count = 0;
+	state->register_count = 0;
 }
 
 /* Initialize a new hardreg. */
@@ -30,8 +37,8 @@ static void cg_reset_registers(void)
 static void cg_init_register(struct hardreg* reg, int regclass)
 {
 	assert(!reg->name);
-	reg->name = aprintf("H%d", register_count);
-	register_count++;
+	reg->name = aprintf("H%d", state->register_count);
+	state->register_count++;
 }
 
 /* Get the name of a register. */
@@ -46,6 +53,8 @@ static const char* cg_get_register_name(struct hardreg* reg)
 
 static void cg_prologue(void)
 {
+	if (packed_chars)
+		zprintf("clue_packed_chars = true;\n");
 }
 
 /* Emit the file epilogue. */
@@ -92,7 +101,23 @@ static void cg_declare_function_end(void)
 
 static void cg_create_storage(struct symbol* sym, unsigned size)
 {
-	zprintf("%s = [];\n", show_symbol_mangled(sym));
+	const char* storage = "[]";
+	switch (get_packed_array_type(sym))
+	{
+		case PACKED_SIGNED:
+			storage = aprintf("new Int8Array(%u)", size);
+			break;
+
+		case PACKED_UNSIGNED:
+			storage = aprintf("new Uint8Array(%u)", size);
+			break;
+	}
+
+	if (sym->string)
+		zprintf("%s = clue_newliteral(%s);\n", show_symbol_mangled(sym),
+				storage);
+	else
+		zprintf("%s = %s;\n", show_symbol_mangled(sym), storage);
 }
 
 static void cg_import(struct symbol* sym)
@@ -108,23 +133,23 @@ static void cg_function_prologue(struct symbol* sym, int returning)
 	if (!sym)
 	{
 		zprintf("function initializer(");
-		function_is_initializer = 1;
+		state->function_is_initializer = 1;
 	}
 	else
 	{
 		zprintf("function %s(", show_symbol_mangled(sym));
-		function_is_initializer = 0;
+		state->function_is_initializer = 0;
 	}
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_function_prologue_arg(struct hardreg* reg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s", show_hardreg(reg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_vararg(void)
@@ -133,10 +158,10 @@ static void cg_function_prologue_vararg(void)
 
 static void cg_function_prologue_reg(struct hardreg* reg)
 {
-	if (function_arg_list != -1)
+	if (state->function_arg_list != -1)
 	{
 		zprintf(") {\n");
-		function_arg_list = -1;
+		state->function_arg_list = -1;
 	}
 	zprintf("var %s;\n", show_hardreg(reg));
 }
@@ -152,7 +177,7 @@ static void cg_function_prologue_end(void)
 static void cg_function_epilogue(void)
 {
 	zprintf("} } }\n\n");
-	if (function_is_initializer)
+	if (state->function_is_initializer)
 		zprintf("clue_add_initializer(initializer);\n");
 }
 
@@ -222,6 +247,23 @@ static void cg_store(struct hardreg* simple, struct hardreg* base,
 	}
 }
 
+/* Stores a run of constants using an array literal. */
+
+static void cg_store_constants(struct hardreg* base, int offset,
+		const struct initvalue* values, int count)
+{
+	int i;
+
+	zprintf("clue_setdata(%s, %d, [", show_hardreg(base), offset);
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
+			zprintf((i % 16) ? ", " : ",\n");
+		zprintf("%s", show_initvalue(&values[i]));
+	}
+	zprintf("]);\n");
+}
+
 /* Load a constant int. */
 
 static void cg_set_int(long long int value, struct hardreg* dest)
@@ -318,52 +360,91 @@ static void cg_select(struct hardreg* cond,
 static void cg_call(struct hardreg* func,
 		struct hardreg* dest1, struct hardreg* dest2)
 {
-	call_return_ptr1 = NULL;
+	state->call_return_ptr1 = NULL;
 
 	if (dest1)
 		if (dest2)
 		{
 			zprintf("%s = %s(", show_hardreg(dest1), show_hardreg(func));
-			call_return_ptr1 = dest1;
-			call_return_ptr2 = dest2;
+			state->call_return_ptr1 = dest1;
+			state->call_return_ptr2 = dest2;
 		}
 		else
 			zprintf("%s = %s(", show_hardreg(dest1), show_hardreg(func));
 	else
 		zprintf("%s(", show_hardreg(func));
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_call_arg(struct hardreg* arg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s", show_hardreg(arg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_call_end(void)
 {
 	zprintf(");\n");
-	if (call_return_ptr1)
+	if (state->call_return_ptr1)
+		zprintf("%s = clue_rp;\n", show_hardreg(state->call_return_ptr2));
+}
+
+/* Emit pieces of a printf() with a constant format. The common
+ * conversions have their own helpers; everything else goes through
+ * sprintf(). */
+
+static void cg_printf_text(const char* text, int len)
+{
+	int i;
+
+	zprintf("clue_printf_text(\"");
+	for (i = 0; i < len; i++)
 	{
-		zprintf("%s = %s[1]\n", show_hardreg(call_return_ptr2),
-				show_hardreg(call_return_ptr1));
-		zprintf("%s = %s[0]\n", show_hardreg(call_return_ptr1),
-				show_hardreg(call_return_ptr1));
+		unsigned char c = text[i];
+		if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\'))
+			zprintf("%c", c);
+		else
+			zprintf("\\x%02x", c);
 	}
+	zprintf("\");\n");
 }
 
-/* Return. */
+static void cg_printf_conversion(const char* spec, int conversion,
+		struct hardregref* arg)
+{
+	int plain = (strlen(spec) == 2);
+
+	if (conversion == 's')
+	{
+		if (plain)
+			zprintf("clue_printf_string(%s, %s);\n",
+					show_hardreg(arg->simple), show_hardreg(arg->base));
+		else
+			zprintf("clue_printf_format(\"%s\", clue_ptrtostring(%s, %s));\n",
+					spec, show_hardreg(arg->simple), show_hardreg(arg->base));
+	}
+	else if (plain && ((conversion == 'd') || (conversion == 'i')))
+		zprintf("clue_printf_int(%s);\n", show_hardreg(arg->simple));
+	else if (plain && (conversion == 'c'))
+		zprintf("clue_printf_char(%s);\n", show_hardreg(arg->simple));
+	else
+		zprintf("clue_printf_format(\"%s\", %s);\n",
+				spec, show_hardreg(arg->simple));
+}
+
+/* Return. Pointers are returned as the offset, with the base passed back
+ * in the clue_rp global; this avoids allocating an array for every call. */
 
 static void cg_ret(struct hardreg* reg1, struct hardreg* reg2)
 {
 	if (reg1)
 		if (reg2)
-			zprintf("return [%s, %s];\n",
-						show_hardreg(reg1),
-						show_hardreg(reg2));
+			zprintf("clue_rp = %s; return %s;\n",
+						show_hardreg(reg2),
+						show_hardreg(reg1));
 		else
 			zprintf("return %s;\n", show_hardreg(reg1));
 	else
@@ -392,6 +473,9 @@ const struct codegenerator cg_javascript =
 	.spname = "sp",
 	.fpname = "fp",
 	.stackname = "stack",
+	.infinity = "Infinity",
+	.nan = "NaN",
+	.state_size = sizeof(struct cgstate),
 
 	.register_class =
 	{
@@ -431,6 +515,7 @@ const struct codegenerator cg_javascript =
 	.copy = cg_copy,
 	.load = cg_load,
 	.store = cg_store,
+	.store_constants = cg_store_constants,
 
 	.set_int = cg_set_int,
 	.set_float = cg_set_float,
@@ -466,6 +551,9 @@ const struct codegenerator cg_javascript =
 	.call_vararg = cg_call_arg,
 	.call_end = cg_call_end,
 
+	.printf_text = cg_printf_text,
+	.printf_conversion = cg_printf_conversion,
+
 	.ret = cg_ret,
 
 	.memcpyimpl = cg_memcpy
@@ -12,17 +12,96 @@
 
 #include "globals.h"
 
-static int function_parens = 0;
-static int function_arg_list = 0;
-static int function_is_initializer = 0;
-static int register_count;
-static int parencount = 0;
+/* Per-context state, found through cgctx->backend. */
+
+struct cgstate
+{
+	int function_parens;
+	int function_arg_list;
+	int function_is_initializer;
+	int register_count;
+	int parencount;
+	struct hardreg* function_args[NUM_REGS];
+	struct hardreg* function_regs[NUM_REGS];
+	int function_reg_count;
+};
+
+#define state ((struct cgstate*) cgctx->backend)
+
+/* Registers are typed, so that SBCL can compile arithmetic and memory
+ * accesses inline instead of going through generic dispatch. Integers are
+ * not fixnums, because C arithmetic (such as a hash loop) can overflow one;
+ * like the untyped code before it, they become bignums instead. */
+
+enum
+{
+	REGCLASS_INT,
+	REGCLASS_FLOAT,
+	REGCLASS_OPTR,
+	REGCLASS_FPTR
+};
+
+static const struct
+{
+	const char* prefix;
+	const char* type;
+	const char* example;
+} regclassdata[] =
+{
+	[REGCLASS_INT] =
+	{
+		.prefix = "H",
+		.type = "integer",
+		.example = "0",
+	},
+
+	[REGCLASS_FLOAT] =
+	{
+		.prefix = "F",
+		.type = "double-float",
+		.example = "0d0",
+	},
+
+	[REGCLASS_OPTR] =
+	{
+		.prefix = "O",
+		.type = "(or null simple-vector)",
+		.example = "nil",
+	},
+
+	[REGCLASS_FPTR] =
+	{
+		.prefix = "P",
+		.type = "(or null function)",
+		.example = "nil",
+	},
+};
+
+/* Returns true if a register holds a number. */
+
+static int is_numeric(struct hardreg* reg)
+{
+	return (reg->regclass == REGCLASS_INT) || (reg->regclass == REGCLASS_FLOAT);
+}
+
+/* Wraps an expression of one numeric class so that it can be assigned to a
+ * register of another. */
+
+static const char* coerce_to(struct hardreg* dest, const char* expr,
+		int exprclass)
+{
+	if ((dest->regclass == REGCLASS_FLOAT) && (exprclass == REGCLASS_INT))
+		return aprintf("(float %s 1d0)", expr);
+	if ((dest->regclass == REGCLASS_INT) && (exprclass == REGCLASS_FLOAT))
+		return aprintf("(values (truncate %s))", expr);
+	return expr;
+}
 
 /* Reset the register tracking. */
 
 static void cg_reset_registers(void)
 {
-	register_count = 0;
+	state->register_count = 0;
 }
 
 /* Initialize a new hardreg. */
@@ -30,8 +109,9 @@ static void cg_reset_registers(void)
 static void cg_init_register(struct hardreg* reg, int regclass)
 {
 	assert(!reg->name);
-	reg->name = aprintf("H%d", register_count);
-	register_count++;
+	reg->name = aprintf("%s%d", regclassdata[regclass].prefix,
+			state->register_count);
+	state->register_count++;
 }
 
 /* Get the name of a register. */
@@ -94,7 +174,8 @@ static void cg_declare_function_end(void)
 
 static void cg_create_storage(struct symbol* sym, unsigned size)
 {
-	zprintf("(setf %s (make-array 0 :fill-pointer 0 :adjustable t))\n", show_symbol_mangled(sym));
+	zprintf("(setf %s (make-array %u :initial-element 0))\n",
+			show_symbol_mangled(sym), size);
 }
 
 static void cg_import(struct symbol* sym)
@@ -112,61 +193,83 @@ static void cg_function_prologue(struct symbol* sym, int returning)
 	if (!sym)
 	{
 		zprintf("(clue-add-initializer (lambda (");
-		function_is_initializer = 1;
+		state->function_is_initializer = 1;
 	}
 	else
 	{
 		zprintf("(setf %s (lambda (", show_symbol_mangled(sym));
-		function_is_initializer = 0;
+		state->function_is_initializer = 0;
 	}
-	parencount = 2; /* we don't count the arglist's bracket */
-	function_arg_list = 0;
+	state->parencount = 2; /* we don't count the arglist's bracket */
+	state->function_arg_list = 0;
+	state->function_reg_count = 0;
 }
 
 static void cg_function_prologue_arg(struct hardreg* reg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(" ");
 
 	zprintf("%s", show_hardreg(reg));
-	function_arg_list++;
+	state->function_args[state->function_arg_list] = reg;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_vararg(void)
 {
 }
 
+/* Emits type declarations for a set of registers. */
+
+static void emit_declarations(struct hardreg** regs, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		zprintf("\n (type %s %s)",
+				regclassdata[regs[i]->regclass].type,
+				show_hardreg(regs[i]));
+}
+
 static void cg_function_prologue_reg(struct hardreg* reg)
 {
-	if (function_arg_list >= 0)
+	if (state->function_arg_list >= 0)
 	{
-		/* First reg. Terminate arg list and open the prog.
+		/* First reg. Terminate arg list, declare the argument types and
+		 * open the prog.
 		 * prog gives us a tagbody we can use for go tags, and a block
 		 * we can use with 'return', and some space to declare locals.
 		 * It is the program feature!
 		 */
+		zprintf(")\n(declare (optimize speed)");
+		emit_declarations(state->function_args, state->function_arg_list);
 		zprintf(")\n(prog (");
-		function_arg_list = -1;
-		parencount++;
+		state->function_arg_list = -1;
+		state->parencount++;
 	}
 
-	zprintf("%s ", show_hardreg(reg));
+	/* Typed registers must be initialised to something of the right type. */
+
+	zprintf("(%s %s) ", show_hardreg(reg),
+			regclassdata[reg->regclass].example);
+	state->function_regs[state->function_reg_count++] = reg;
 }
 
 static void cg_function_prologue_end(void)
 {
-	/* Close the prog's list of variables */
+	/* Close the prog's list of variables and declare their types. */
+	zprintf(")\n(declare");
+	emit_declarations(state->function_regs, state->function_reg_count);
 	zprintf(")\n");
 }
 
 static void cg_function_epilogue(void)
 {
-	if (function_is_initializer)
+	if (state->function_is_initializer)
 		zprintf(";;; cg_function_epilogue for initializer \n\n");
 
-	while (parencount)
+	while (state->parencount)
 	{
-		parencount--;
+		state->parencount--;
 		zprintf(")");
 	}
 	zprintf("\n\n");
@@ -187,9 +290,19 @@ static void cg_bb_end_jump(struct binfo* target)
 	zprintf("(go L_%d)\n", target->id);
 }
 
-/* Ends a basic block in a conditional jump based on any value. */
+/* Ends a basic block in a conditional jump based on an arithmetic value.
+ * (Remember that 0 is true in Lisp.) */
 
-static void cg_bb_end_if(struct hardreg* cond,
+static void cg_bb_end_if_arith(struct hardreg* cond,
+		struct binfo* truetarget, struct binfo* falsetarget)
+{
+	zprintf("(if (/= 0 %s) (go L_%d) (go L_%d))\n",
+			show_hardreg(cond), truetarget->id, falsetarget->id);
+}
+
+/* Ends a basic block in a conditional jump based on a pointer value. */
+
+static void cg_bb_end_if_ptr(struct hardreg* cond,
 		struct binfo* truetarget, struct binfo* falsetarget)
 {
 	zprintf("(if %s (go L_%d) (go L_%d))\n",
@@ -201,19 +314,37 @@ static void cg_bb_end_if(struct hardreg* cond,
 static void cg_copy(struct hardreg* src, struct hardreg* dest)
 {
 	if (src != dest)
-		zprintf("(setf %s %s)\n", show_hardreg(dest), show_hardreg(src));
+		zprintf("(setf %s %s)\n", show_hardreg(dest),
+				coerce_to(dest, show_hardreg(src), src->regclass));
 }
 
-/* Loads a value from a memory location. */
+/* Loads a value from a memory location. Memory is untyped, so the value
+ * needs to be told what it is. New memory is filled with 0, which reads back
+ * as whatever represents zero in the destination's class (nil for pointers,
+ * 0d0 for floats) until something of the right type is stored over it. */
 
 static void cg_load(struct hardreg* simple, struct hardreg* base,
 		int offset, struct hardreg* dest)
 {
-	zprintf("(setf %s (aref %s (+ %s %d)))\n",
+	if (dest->regclass == REGCLASS_INT)
+	{
+		zprintf("(setf %s (the %s (svref %s (+ %s %d))))\n",
+				show_hardreg(dest),
+				regclassdata[dest->regclass].type,
+				show_hardreg(base),
+				show_hardreg(simple),
+				offset);
+		return;
+	}
+
+	zprintf("(setf %s (let ((v (svref %s (+ %s %d)))) "
+			"(the %s (if (eql v 0) %s v))))\n",
 			show_hardreg(dest),
 			show_hardreg(base),
 			show_hardreg(simple),
-			offset);
+			offset,
+			regclassdata[dest->regclass].type,
+			regclassdata[dest->regclass].example);
 }
 
 /* Stores a value from a memory location. */
@@ -221,26 +352,41 @@ static void cg_load(struct hardreg* simple, struct hardreg* base,
 static void cg_store(struct hardreg* simple, struct hardreg* base,
 		int offset, struct hardreg* src)
 {
-	/* Use a helper function because aref doesn't autoextend the array */
 	if (simple)
-		zprintf("(clue-set-aref %s (+ %s %d) %s)\n", show_hardreg(base),
+		zprintf("(setf (svref %s (+ %s %d)) %s)\n", show_hardreg(base),
 			show_hardreg(simple), offset, show_hardreg(src));
 	else
-		zprintf("(clue-set-aref %s %d %s)\n", show_hardreg(base), offset, show_hardreg(src));
+		zprintf("(setf (svref %s %d) %s)\n", show_hardreg(base), offset,
+			show_hardreg(src));
 }
 
 /* Load a constant int. */
 
 static void cg_set_int(long long int value, struct hardreg* dest)
 {
-	zprintf("(setf %s %lld)\n", show_hardreg(dest), value);
+	if (dest->regclass == REGCLASS_FLOAT)
+		zprintf("(setf %s %lldd0)\n", show_hardreg(dest), value);
+	else
+		zprintf("(setf %s %lld)\n", show_hardreg(dest), value);
 }
 
-/* Load a constant float. */
+/* Load a constant float. Lisp reads unadorned floats as single precision,
+ * so use a d exponent marker. */
 
 static void cg_set_float(long double value, struct hardreg* dest)
 {
-	zprintf("(setf %s %llf)\n", show_hardreg(dest), value);
+	if (dest->regclass == REGCLASS_INT)
+	{
+		zprintf("(setf %s %lld)\n", show_hardreg(dest),
+				(long long int) value);
+		return;
+	}
+
+	char* s = (char*) aprintf("%.17Le", value);
+	char* e = strchr(s, 'e');
+	if (e)
+		*e = 'd';
+	zprintf("(setf %s %s)\n", show_hardreg(dest), s);
 }
 
 /* Load a constant symbol. */
@@ -255,38 +401,78 @@ static void cg_set_symbol(struct symbol* sym, struct hardreg* dest)
 
 static void cg_toint(struct hardreg* src, struct hardreg* dest)
 {
-	zprintf("(setf %s (truncate %s))\n", show_hardreg(dest), show_hardreg(src));
+	zprintf("(setf %s (values (truncate %s)))\n", show_hardreg(dest),
+			show_hardreg(src));
 }
 
 /* Arithmetic negation. */
 
 static void cg_negate(struct hardreg* src, struct hardreg* dest)
 {
-	zprintf("(setf %s (- 0 %s))\n", show_hardreg(dest), show_hardreg(src));
+	zprintf("(setf %s %s)\n", show_hardreg(dest),
+			coerce_to(dest, aprintf("(- %s)", show_hardreg(src)),
+				src->regclass));
+}
+
+/* Emits an arithmetic operation. The result is a float if either input
+ * is. */
+
+static void emit_arith(const char* op, struct hardreg* src1,
+		struct hardreg* src2, struct hardreg* dest)
+{
+	int exprclass = REGCLASS_INT;
+	if ((src1->regclass == REGCLASS_FLOAT) ||
+	    (src2->regclass == REGCLASS_FLOAT))
+		exprclass = REGCLASS_FLOAT;
+
+	zprintf("(setf %s %s)\n", show_hardreg(dest),
+			coerce_to(dest,
+				aprintf("(%s %s %s)", op, show_hardreg(src1),
+					show_hardreg(src2)),
+				exprclass));
 }
 
 #define SIMPLE_PREFIX_2OP(NAME, OP) \
 	static void cg_##NAME(struct hardreg* src1, struct hardreg* src2, \
 			struct hardreg* dest) \
 	{ \
-		zprintf("(setf %s (" OP " %s %s))\n", show_hardreg(dest), \
-				show_hardreg(src1), show_hardreg(src2)); \
+		emit_arith(OP, src1, src2, dest); \
 	}
 
 SIMPLE_PREFIX_2OP(add, "+")
 SIMPLE_PREFIX_2OP(subtract, "-")
 SIMPLE_PREFIX_2OP(multiply, "*")
-SIMPLE_PREFIX_2OP(divide, "/")
-SIMPLE_PREFIX_2OP(mod, "mod")
 SIMPLE_PREFIX_2OP(logand, "logand")
 SIMPLE_PREFIX_2OP(logor, "logior")
 SIMPLE_PREFIX_2OP(logxor, "logxor")
 SIMPLE_PREFIX_2OP(shl, "ash")
 
+/* C division and remainder truncate towards zero; / on integers in Lisp
+ * produces a ratio. */
+
+static void cg_divide(struct hardreg* src1, struct hardreg* src2,
+		struct hardreg* dest)
+{
+	if ((src1->regclass == REGCLASS_INT) && (src2->regclass == REGCLASS_INT))
+		zprintf("(setf %s %s)\n", show_hardreg(dest),
+				coerce_to(dest,
+					aprintf("(values (truncate %s %s))",
+						show_hardreg(src1), show_hardreg(src2)),
+					REGCLASS_INT));
+	else
+		emit_arith("/", src1, src2, dest);
+}
+
+static void cg_mod(struct hardreg* src1, struct hardreg* src2,
+		struct hardreg* dest)
+{
+	emit_arith("rem", src1, src2, dest);
+}
+
 static void cg_shr(struct hardreg* src1, struct hardreg* src2, struct hardreg* dest)
 {
 	/* CL doesn't have a separate shift right, you use ash with a negative shift count */
-	zprintf("(setf %s (ash (- 0 %s) %s))\n", show_hardreg(dest),
+	zprintf("(setf %s (ash %s (- %s)))\n", show_hardreg(dest),
 		show_hardreg(src1), show_hardreg(src2));
 }
 
@@ -298,23 +484,50 @@ static void cg_shr(struct hardreg* src1, struct hardreg* src2, struct hardreg* d
 				show_hardreg(src1), show_hardreg(src2)); \
 	}
 
-SIMPLE_SET_2OP(booland, "and")
-SIMPLE_SET_2OP(boolor, "or")
 SIMPLE_SET_2OP(set_gt, ">")
 SIMPLE_SET_2OP(set_ge, ">=")
 SIMPLE_SET_2OP(set_lt, "<")
 SIMPLE_SET_2OP(set_le, "<=")
-SIMPLE_SET_2OP(set_eq, "==")
-SIMPLE_SET_2OP(set_ne, "/=")
 
-/* Select operations using any condition. */
+/* Equality works on pointers as well as numbers. */
+
+static void cg_set_eq(struct hardreg* src1, struct hardreg* src2,
+		struct hardreg* dest)
+{
+	zprintf("(setf %s (if (%s %s %s) 1 0))\n", show_hardreg(dest),
+			is_numeric(src1) ? "=" : "eq",
+			show_hardreg(src1), show_hardreg(src2));
+}
+
+static void cg_set_ne(struct hardreg* src1, struct hardreg* src2,
+		struct hardreg* dest)
+{
+	zprintf("(setf %s (if (%s %s %s) 0 1))\n", show_hardreg(dest),
+			is_numeric(src1) ? "=" : "eq",
+			show_hardreg(src1), show_hardreg(src2));
+}
+
+#define BOOLEAN_2OP(NAME, OP) \
+	static void cg_##NAME(struct hardreg* src1, struct hardreg* src2, \
+			struct hardreg* dest) \
+	{ \
+		zprintf("(setf %s (if (" OP " (/= 0 %s) (/= 0 %s)) 1 0))\n", \
+				show_hardreg(dest), \
+				show_hardreg(src1), show_hardreg(src2)); \
+	}
+
+BOOLEAN_2OP(booland, "and")
+BOOLEAN_2OP(boolor, "or")
+
+/* Select operations. */
 
 static void cg_select(struct hardreg* cond,
 		struct hardreg* dest1, struct hardreg* dest2,
 		struct hardreg* true1, struct hardreg* true2,
-		struct hardreg* false1, struct hardreg* false2)
+		struct hardreg* false1, struct hardreg* false2,
+		const char* test)
 {
-	zprintf("(if %s\n", show_hardreg(cond));
+	zprintf("(if %s\n", aprintf(test, show_hardreg(cond)));
 	if (dest2)
 		zprintf("(progn (setf %s %s) (setf %s %s))\n(progn (setf %s %s) (setf %s %s)))\n",
 				show_hardreg(dest1), show_hardreg(true1),
@@ -327,18 +540,39 @@ static void cg_select(struct hardreg* cond,
 				show_hardreg(dest1), show_hardreg(false1));
 }
 
+/* Select operations using a pointer. */
+
+static void cg_select_ptr(struct hardreg* cond,
+		struct hardreg* dest1, struct hardreg* dest2,
+		struct hardreg* true1, struct hardreg* true2,
+		struct hardreg* false1, struct hardreg* false2)
+{
+	cg_select(cond, dest1, dest2, true1, true2, false1, false2,
+			"%s");
+}
+
+/* Select operations using an arithmetic value. */
+
+static void cg_select_arith(struct hardreg* cond,
+		struct hardreg* dest1, struct hardreg* dest2,
+		struct hardreg* true1, struct hardreg* true2,
+		struct hardreg* false1, struct hardreg* false2)
+{
+	cg_select(cond, dest1, dest2, true1, true2, false1, false2,
+			"(/= 0 %s)");
+}
+
 static void cg_call(struct hardreg* func,
 		struct hardreg* dest1, struct hardreg* dest2)
 {
-	function_parens = 1;
+	state->function_parens = 1;
 	if (dest1)
 	{
-		function_parens++;
+		state->function_parens++;
 		if (dest2)
 		{
-			function_parens++;
-			/* This is a bit ugly but it avoids using a temporary in the Lisp */
-			zprintf("(setf (values %s %s) (apply #'values ", show_hardreg(dest1), show_hardreg(dest2));
+			/* Pointers are returned as multiple values. */
+			zprintf("(multiple-value-setq (%s %s) ", show_hardreg(dest1), show_hardreg(dest2));
 		}
 		else
 		{
@@ -355,9 +589,9 @@ static void cg_call_arg(struct hardreg* arg)
 
 static void cg_call_end(void)
 {
-	while (function_parens)
+	while (state->function_parens)
 	{
-		function_parens--;
+		state->function_parens--;
 		zprintf(")");
 	}
 	zprintf("\n");
@@ -368,7 +602,7 @@ static void cg_ret(struct hardreg *reg1, struct hardreg *reg2)
 {
 	if (reg1)
 		if (reg2)
-			zprintf("(return (list %s %s))\n", show_hardreg(reg1), show_hardreg(reg2));
+			zprintf("(return (values %s %s))\n", show_hardreg(reg1), show_hardreg(reg2));
 		else
 			zprintf("(return %s)\n", show_hardreg(reg1));
 	else
@@ -379,11 +613,12 @@ static void cg_ret(struct hardreg *reg1, struct hardreg *reg2)
 
 static void cg_memcpy(struct hardregref* src, struct hardregref* dest, int size)
 {
-	// FIXME
 	assert(src->type == TYPE_PTR);
 	assert(dest->type == TYPE_PTR);
 
-	zprintf("(_memcpy sp stack %s %s %s %s %d)\n",
+	zprintf("(funcall _memcpy %s %s %s %s %s %s %d)\n",
+			show_hardreg(&cgctx->stackoffset_reg),
+			show_hardreg(&cgctx->stackbase_reg),
 			show_hardreg(dest->simple),
 			show_hardreg(dest->base),
 			show_hardreg(src->simple),
@@ -398,10 +633,14 @@ const struct codegenerator cg_lisp =
 	.spname = "sp",
 	.fpname = "fp",
 	.stackname = "stack",
+	.state_size = sizeof(struct cgstate),
 
 	.register_class =
 	{
-		[0] = REGTYPE_ALL,
+		[REGCLASS_INT] = REGTYPE_INT | REGTYPE_BOOL,
+		[REGCLASS_FLOAT] = REGTYPE_FLOAT,
+		[REGCLASS_OPTR] = REGTYPE_OPTR,
+		[REGCLASS_FPTR] = REGTYPE_FPTR
 	},
 	.reset_registers = cg_reset_registers,
 	.init_register = cg_init_register,
@@ -431,8 +670,8 @@ const struct codegenerator cg_lisp =
 
 	.bb_start = cg_bb_start,
 	.bb_end_jump = cg_bb_end_jump,
-	.bb_end_if_arith = cg_bb_end_if,
-	.bb_end_if_ptr = cg_bb_end_if,
+	.bb_end_if_arith = cg_bb_end_if_arith,
+	.bb_end_if_ptr = cg_bb_end_if_ptr,
 
 	.copy = cg_copy,
 	.load = cg_load,
@@ -464,8 +703,8 @@ const struct codegenerator cg_lisp =
 	.set_eq = cg_set_eq,
 	.set_ne = cg_set_ne,
 
-	.select_ptr = cg_select,
-	.select_arith = cg_select,
+	.select_ptr = cg_select_ptr,
+	.select_arith = cg_select_arith,
 
 	.call = cg_call,
 	.call_arg = cg_call_arg,
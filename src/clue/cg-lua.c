@@ -12,15 +12,22 @@
 
 #include "globals.h"
 
-static int function_arg_list = 0;
-static int function_is_initializer = 0;
-static int register_count;
+/* Per-context state, found through cgctx->backend. */
+
+struct cgstate
+{
+	int function_arg_list;
+	int function_is_initializer;
+	int register_count;
+};
+
+#define state ((struct cgstate*) cgctx->backend)
 
 /* Reset the register tracking. */
 
 static void cg_reset_registers(void)
 {
-	register_count = 0;
+	state->register_count = 0;
 }
 
 /* Initialize a new hardreg. */
@@ -28,8 +35,8 @@ static void cg_reset_registers(void)
 static void cg_init_register(struct hardreg* reg, int regclass)
 {
 	assert(!reg->name);
-	reg->name = aprintf("H%d", register_count);
-	register_count++;
+	reg->name = aprintf("H%d", state->register_count);
+	state->register_count++;
 }
 
 /* Get the name of a register. */
@@ -55,6 +62,9 @@ static void cg_prologue(void)
 	zprintf("local shl = clue.crt.shl\n");
 	zprintf("local shr = clue.crt.shr\n");
 	zprintf("local _memcpy = _memcpy\n");
+	zprintf("local printf_text = printf_text\n");
+	zprintf("local printf_format = printf_format\n");
+	zprintf("local printf_string = printf_string\n");
 }
 
 /* Emit the file epilogue. */
@@ -101,7 +111,10 @@ static void cg_declare_function_end(void)
 
 static void cg_create_storage(struct symbol* sym, unsigned size)
 {
-	zprintf("%s = {}\n", show_symbol_mangled(sym));
+	if (sym->string)
+		zprintf("%s = clue.crt.newliteral()\n", show_symbol_mangled(sym));
+	else
+		zprintf("%s = {}\n", show_symbol_mangled(sym));
 }
 
 static void cg_import(struct symbol* sym)
@@ -121,38 +134,38 @@ static void cg_function_prologue(struct symbol* sym, int returning)
 	if (!sym)
 	{
 		zprintf("local function initializer(");
-		function_is_initializer = 1;
+		state->function_is_initializer = 1;
 	}
 	else
 	{
 		zprintf("%s = function(", show_symbol_mangled(sym));
-		function_is_initializer = 0;
+		state->function_is_initializer = 0;
 	}
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_function_prologue_arg(struct hardreg* reg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s", show_hardreg(reg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_vararg(void)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("...");
 }
 
 static void cg_function_prologue_reg(struct hardreg* reg)
 {
-	if (function_arg_list != -1)
+	if (state->function_arg_list != -1)
 	{
 		zprintf(")\n");
-		function_arg_list = -1;
+		state->function_arg_list = -1;
 	}
 	zprintf("local %s\n", show_hardreg(reg));
 }
@@ -174,7 +187,7 @@ static void cg_function_epilogue(void)
 	zprintf("end\n");
 #endif
 	zprintf("end\n\n");
-	if (function_is_initializer)
+	if (state->function_is_initializer)
 		zprintf("clue.crt.add_initializer(initializer)\n");
 }
 
@@ -271,6 +284,23 @@ static void cg_store(struct hardreg* simple, struct hardreg* base,
 	}
 }
 
+/* Stores a run of constants using a table constructor. */
+
+static void cg_store_constants(struct hardreg* base, int offset,
+		const struct initvalue* values, int count)
+{
+	int i;
+
+	zprintf("clue.crt.setdata(%s, %d, {", show_hardreg(base), offset);
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
+			zprintf((i % 16) ? ", " : ",\n");
+		zprintf("%s", show_initvalue(&values[i]));
+	}
+	zprintf("})\n");
+}
+
 /* Load a constant int. */
 
 static void cg_set_int(long long int value, struct hardreg* dest)
@@ -406,15 +436,15 @@ static void cg_call(struct hardreg* func,
 	else
 		zprintf("%s(", show_hardreg(func));
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_call_arg(struct hardreg* arg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s", show_hardreg(arg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_call_end(void)
@@ -422,6 +452,35 @@ static void cg_call_end(void)
 	zprintf(")\n");
 }
 
+/* Emit pieces of a printf() with a constant format. */
+
+static void cg_printf_text(const char* text, int len)
+{
+	int i;
+
+	zprintf("printf_text(\"");
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = text[i];
+		if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\'))
+			zprintf("%c", c);
+		else
+			zprintf("\\%03d", c);
+	}
+	zprintf("\")\n");
+}
+
+static void cg_printf_conversion(const char* spec, int conversion,
+		struct hardregref* arg)
+{
+	if (conversion == 's')
+		zprintf("printf_string(\"%s\", %s, %s)\n",
+				spec, show_hardreg(arg->simple), show_hardreg(arg->base));
+	else
+		zprintf("printf_format(\"%s\", %s)\n",
+				spec, show_hardreg(arg->simple));
+}
+
 /* Return. */
 
 static void cg_ret(struct hardreg* reg1, struct hardreg* reg2)
@@ -472,6 +531,9 @@ const struct codegenerator
 	.spname = "sp",
 	.fpname = "fp",
 	.stackname = "stack",
+	.infinity = "math.huge",
+	.nan = "(0/0)",
+	.state_size = sizeof(struct cgstate),
 
 	.register_class =
 	{
@@ -511,6 +573,7 @@ const struct codegenerator
 	.copy = cg_copy,
 	.load = cg_load,
 	.store = cg_store,
+	.store_constants = cg_store_constants,
 
 	.set_int = cg_set_int,
 	.set_float = cg_set_float,
@@ -546,6 +609,9 @@ const struct codegenerator
 	.call_vararg = cg_call_arg,
 	.call_end = cg_call_end,
 
+	.printf_text = cg_printf_text,
+	.printf_conversion = cg_printf_conversion,
+
 	.ret = cg_ret,
 
 	.memcpyimpl = cg_memcpy
@@ -12,15 +12,44 @@
 
 #include "globals.h"
 
-static int function_arg_list = 0;
-static int function_is_initializer = 0;
-static int register_count;
+/* This file is compiled twice. With PERL5FAST defined it produces the
+ * perl5fast generator, which emits functions as named subs called directly,
+ * keeps file-local data in lexicals, runs under 'use strict' and compiles
+ * functions which never touch floating point under 'use integer'. Otherwise it produces the plain perl5
+ * generator, which emits everything as anonymous subs stored in package
+ * variables.
+ */
+
+#if defined PERL5FAST
+enum
+{
+	REGCLASS_INT = 0,
+	REGCLASS_FLOAT = 1
+};
+#endif
+
+/* Per-context state, found through cgctx->backend. */
+
+struct cgstate
+{
+#if defined PERL5FAST
+	int function_uses_floats;
+#endif
+	int function_arg_list;
+	int function_is_initializer;
+	int register_count;
+};
+
+#define state ((struct cgstate*) cgctx->backend)
 
 /* Reset the register tracking. */
 
 static void cg_reset_registers(void)
 {
-	register_count = 0;
+	state->register_count = 0;
+#if defined PERL5FAST
+	state->function_uses_floats = 0;
+#endif
 }
 
 /* Initialize a new hardreg. */
@@ -28,8 +57,13 @@ static void cg_reset_registers(void)
 static void cg_init_register(struct hardreg* reg, int regclass)
 {
 	assert(!reg->name);
-	reg->name = aprintf("$H%d", register_count);
-	register_count++;
+	reg->name = aprintf("$H%d", state->register_count);
+	state->register_count++;
+
+#if defined PERL5FAST
+	if (regclass == REGCLASS_FLOAT)
+		state->function_uses_floats = 1;
+#endif
 }
 
 /* Get the name of a register. */
@@ -44,6 +78,9 @@ static const char* cg_get_register_name(struct hardreg* reg)
 
 static void cg_prologue(void)
 {
+#if defined PERL5FAST
+	zprintf("use strict;\n");
+#endif
 }
 
 /* Emit the file epilogue. */
@@ -69,12 +106,19 @@ static void cg_comment(const char* format, ...)
 
 static void cg_declare_slot(struct symbol* sym, unsigned size)
 {
-//zprintf("my $%s;\n", show_symbol_mangled(sym));
+#if defined PERL5FAST
+	/* Static data is only visible in this file, so it can live in a file
+	 * lexical rather than in the symbol table. */
+
+	if (sym->ctype.modifiers & MOD_STATIC)
+		zprintf("my $%s;\n", show_symbol_mangled(sym));
+	else
+		zprintf("our $%s;\n", show_symbol_mangled(sym));
+#endif
 }
 
 static void cg_declare_function(struct symbol* sym, int returning)
 {
-	cg_declare_slot(sym, 0);
 }
 
 static void cg_declare_function_arg(int regclass)
@@ -91,7 +135,10 @@ static void cg_declare_function_end(void)
 
 static void cg_create_storage(struct symbol* sym, unsigned size)
 {
-	zprintf("$%s = [];\n", show_symbol_mangled(sym));
+	if (sym->string)
+		zprintf("$%s = clue_newliteral();\n", show_symbol_mangled(sym));
+	else
+		zprintf("$%s = [];\n", show_symbol_mangled(sym));
 }
 
 static void cg_import(struct symbol* sym)
@@ -107,26 +154,32 @@ static void cg_function_prologue(struct symbol* sym, int returning)
 	if (!sym)
 	{
 		zprintf("clue_add_initializer(sub {\n");
-		function_is_initializer = 1;
+		state->function_is_initializer = 1;
 	}
 	else
 	{
+#if defined PERL5FAST
+		zprintf("sub %s {\n", show_symbol_mangled(sym));
+		if (returning == REGCLASS_FLOAT)
+			state->function_uses_floats = 1;
+#else
 		zprintf("$%s = sub {\n", show_symbol_mangled(sym));
-		function_is_initializer = 0;
+#endif
+		state->function_is_initializer = 0;
 	}
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
 }
 
 static void cg_function_prologue_arg(struct hardreg* reg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	else
 		zprintf("my (");
 
 	zprintf("%s", show_hardreg(reg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_function_prologue_vararg(void)
@@ -135,10 +188,10 @@ static void cg_function_prologue_vararg(void)
 
 static void cg_function_prologue_reg(struct hardreg* reg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 	{
 		zprintf(") = @_;\n");
-		function_arg_list = -1;
+		state->function_arg_list = -1;
 	}
 
 	zprintf("my %s;\n", show_hardreg(reg));
@@ -146,14 +199,25 @@ static void cg_function_prologue_reg(struct hardreg* reg)
 
 static void cg_function_prologue_end(void)
 {
+#if defined PERL5FAST
+	/* Perl does arithmetic in doubles unless told otherwise; this is only
+	 * safe if nothing in the function is a float. */
+
+	if (!state->function_is_initializer && !state->function_uses_floats)
+		zprintf("use integer;\n");
+#endif
 }
 
 static void cg_function_epilogue(void)
 {
-	if (function_is_initializer)
+	if (state->function_is_initializer)
 		zprintf("});\n\n");
 	else
+#if defined PERL5FAST
+		zprintf("}\n\n");
+#else
 		zprintf("};\n\n");
+#endif
 }
 
 /* Starts a basic block. */
@@ -222,6 +286,24 @@ static void cg_store(struct hardreg* simple, struct hardreg* base,
 	}
 }
 
+/* Stores a run of constants using a slice assignment. */
+
+static void cg_store_constants(struct hardreg* base, int offset,
+		const struct initvalue* values, int count)
+{
+	int i;
+
+	zprintf("@{%s}[%d .. %d] = (", show_hardreg(base), offset,
+			offset + count - 1);
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
+			zprintf((i % 16) ? ", " : ",\n");
+		zprintf("%s", show_initvalue(&values[i]));
+	}
+	zprintf(");\n");
+}
+
 /* Load a constant int. */
 
 static void cg_set_int(long long int value, struct hardreg* dest)
@@ -244,6 +326,18 @@ static void cg_set_symbol(struct symbol* sym, struct hardreg* dest)
 			sym ? show_symbol_mangled(sym) : "undef");
 }
 
+#if defined PERL5FAST
+/* Load a constant function symbol. */
+
+static void cg_set_fsymbol(struct symbol* sym, struct hardreg* dest)
+{
+	if (sym)
+		zprintf("%s = \\&%s;\n", show_hardreg(dest), show_symbol_mangled(sym));
+	else
+		zprintf("%s = undef;\n", show_hardreg(dest));
+}
+#endif
+
 /* Convert to integer. */
 
 static void cg_toint(struct hardreg* src, struct hardreg* dest)
@@ -327,15 +421,32 @@ static void cg_call(struct hardreg* func,
 	else
 		zprintf("%s->(", show_hardreg(func));
 
-	function_arg_list = 0;
+	state->function_arg_list = 0;
+}
+
+#if defined PERL5FAST
+static void cg_call_direct(struct symbol* sym,
+		struct hardreg* dest1, struct hardreg* dest2)
+{
+	if (dest1)
+		if (dest2)
+			zprintf("(%s, %s) = %s(", show_hardreg(dest1), show_hardreg(dest2),
+					show_symbol_mangled(sym));
+		else
+			zprintf("%s = %s(", show_hardreg(dest1), show_symbol_mangled(sym));
+	else
+		zprintf("%s(", show_symbol_mangled(sym));
+
+	state->function_arg_list = 0;
 }
+#endif
 
 static void cg_call_arg(struct hardreg* arg)
 {
-	if (function_arg_list > 0)
+	if (state->function_arg_list > 0)
 		zprintf(", ");
 	zprintf("%s", show_hardreg(arg));
-	function_arg_list++;
+	state->function_arg_list++;
 }
 
 static void cg_call_end(void)
@@ -343,6 +454,35 @@ static void cg_call_end(void)
 	zprintf(");\n");
 }
 
+/* Emit pieces of a printf() with a constant format. */
+
+static void cg_printf_text(const char* text, int len)
+{
+	int i;
+
+	zprintf("clue_printf_text(\"");
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = text[i];
+		if ((c >= 0x20) && (c < 0x7f) && !strchr("\"\\$@", c))
+			zprintf("%c", c);
+		else
+			zprintf("\\x{%02x}", c);
+	}
+	zprintf("\");\n");
+}
+
+static void cg_printf_conversion(const char* spec, int conversion,
+		struct hardregref* arg)
+{
+	if (conversion == 's')
+		zprintf("clue_printf_string(\"%s\", %s, %s);\n",
+				spec, show_hardreg(arg->simple), show_hardreg(arg->base));
+	else
+		zprintf("clue_printf_format(\"%s\", %s);\n",
+				spec, show_hardreg(arg->simple));
+}
+
 /* Return. */
 
 static void cg_ret(struct hardreg* reg1, struct hardreg* reg2)
@@ -365,7 +505,13 @@ static void cg_memcpy(struct hardregref* src, struct hardregref* dest, int size)
 	assert(src->type == TYPE_PTR);
 	assert(dest->type == TYPE_PTR);
 
-	zprintf("memcpyimpl(sp, stack, %s, %s, %s, %s, %d);\n",
+#if defined PERL5FAST
+	zprintf("_memcpy(%s, %s, %s, %s, %s, %s, %d);\n",
+#else
+	zprintf("$_memcpy->(%s, %s, %s, %s, %s, %s, %d);\n",
+#endif
+			show_hardreg(&cgctx->stackoffset_reg),
+			show_hardreg(&cgctx->stackbase_reg),
 			show_hardreg(dest->simple),
 			show_hardreg(dest->base),
 			show_hardreg(src->simple),
@@ -374,16 +520,30 @@ static void cg_memcpy(struct hardregref* src, struct hardregref* dest, int size)
 }
 
 
-const struct codegenerator cg_perl5 =
+const struct codegenerator
+#if defined PERL5FAST
+	cg_perl5fast
+#else
+	cg_perl5
+#endif
+	=
 {
 	.pointer_zero_offset = 0,
 	.spname = "$sp",
 	.fpname = "$fp",
 	.stackname = "$stack",
+	.infinity = "9**9**9",
+	.nan = "sin(9**9**9)",
+	.state_size = sizeof(struct cgstate),
 
 	.register_class =
 	{
+#if defined PERL5FAST
+		[REGCLASS_INT] = REGTYPE_ALL & ~REGTYPE_FLOAT,
+		[REGCLASS_FLOAT] = REGTYPE_FLOAT,
+#else
 		[0] = REGTYPE_ALL,
+#endif
 	},
 	.reset_registers = cg_reset_registers,
 	.init_register = cg_init_register,
@@ -419,11 +579,16 @@ const struct codegenerator cg_perl5 =
 	.copy = cg_copy,
 	.load = cg_load,
 	.store = cg_store,
+	.store_constants = cg_store_constants,
 
 	.set_int = cg_set_int,
 	.set_float = cg_set_float,
 	.set_osymbol = cg_set_symbol,
+#if defined PERL5FAST
+	.set_fsymbol = cg_set_fsymbol,
+#else
 	.set_fsymbol = cg_set_symbol,
+#endif
 
 	.toint = cg_toint,
 	.negate = cg_negate,
@@ -453,6 +618,12 @@ const struct codegenerator cg_perl5 =
 	.call_arg = cg_call_arg,
 	.call_vararg = cg_call_arg,
 	.call_end = cg_call_end,
+#if defined PERL5FAST
+	.call_direct = cg_call_direct,
+#endif
+
+	.printf_text = cg_printf_text,
+	.printf_conversion = cg_printf_conversion,
 
 	.ret = cg_ret,
 
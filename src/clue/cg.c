@@ -33,7 +33,6 @@ struct operand
 	};
 };
 
-static int stacksize;
 
 /* Copy a hardreg into another hardreg. */
 
@@ -156,8 +155,8 @@ static int check_symbol_stackage(pseudo_t pseudo)
 		cg->comment("allocating %d bytes on stack for %s\n", size,
 				show_symbol_mangled(sym));
 		pinfo->stacked = 1;
-		pinfo->stackoffset = stacksize;
-		stacksize += size;
+		pinfo->stackoffset = cgctx->stacksize;
+		cgctx->stacksize += size;
 	}
 
 	return pinfo->stacked;
@@ -202,9 +201,9 @@ static void emit_load(struct hardregref* dest, pseudo_t pseudo)
 
 			if (check_symbol_stackage(pseudo))
 			{
-				cg->copy(&stackbase_reg, dest->base);
+				cg->copy(&cgctx->stackbase_reg, dest->base);
 				cg->set_int(pinfo->stackoffset, dest->simple);
-				cg->add(&frameoffset_reg, dest->simple, dest->simple);
+				cg->add(&cgctx->frameoffset_reg, dest->simple, dest->simple);
 			}
 			else
 			{
@@ -524,8 +523,8 @@ static void generate_uniop(struct instruction *insn, struct bb_state *state)
 
 					struct hardregref src;
 					src.type = TYPE_PTR;
-					src.simple = &frameoffset_reg;
-					src.base = &stackbase_reg;
+					src.simple = &cgctx->frameoffset_reg;
+					src.base = &cgctx->stackbase_reg;
 
 					struct hardregref dest;
 					clone_ptr_hardregref(&src, &dest, insn->target);
@@ -574,31 +573,43 @@ static void generate_ret(struct instruction *insn, struct bb_state *state)
 
 static void generate_call(struct instruction *insn, struct bb_state *state)
 {
-	struct hardregref function;
-	find_hardregref(&function, insn->func);
+	if (generate_printf(insn))
+		return;
 
 	/* Emit the instruction. */
 
 	struct hardregref target;
+	struct hardreg* dest1 = NULL;
+	struct hardreg* dest2 = NULL;
 	target.type = TYPE_NONE;
 	if (insn->target && (insn->target != VOID))
 	{
 		create_hardregref(&target, insn->target);
+		dest1 = target.simple;
 		if (target.type == TYPE_PTR)
-			cg->call(function.simple,
-					target.simple, target.base);
-		else
-			cg->call(function.simple,
-					target.simple, NULL);
+			dest2 = target.base;
+	}
+
+	struct symbol* declared;
+	if (insn->func->type == PSEUDO_SYM)
+	{
+		/* rewrite.c only leaves these for backends with call_direct(). */
+
+		declared = insn->func->sym->ctype.base_type;
+		cg->call_direct(insn->func->sym, dest1, dest2);
 	}
 	else
-		cg->call(function.simple,
-				NULL, NULL);
+	{
+		struct hardregref function;
+		find_hardregref(&function, insn->func);
 
-	cg->call_arg(&stackoffset_reg);
-	cg->call_arg(&stackbase_reg);
+		declared = insn->func->def->symbol->sym->ctype.base_type;
+		cg->call(function.simple, dest1, dest2);
+	}
+
+	cg->call_arg(&cgctx->stackoffset_reg);
+	cg->call_arg(&cgctx->stackbase_reg);
 
-	struct symbol* declared = insn->func->def->symbol->sym->ctype.base_type;
 	int numargs = ptr_list_size((struct ptr_list*) declared->arguments);
 
 	pseudo_t arg;
@@ -925,7 +936,7 @@ static void mark_used_registers(struct basic_block *bb, struct bb_state *state)
 			struct storage *s = entry->storage;
 			if (s->type == REG_REG)
 			{
-				struct hardreg *reg = hardregs + s->regno;
+				struct hardreg *reg = cgctx->hardregs + s->regno;
 				reg->used = 1;
 			}
 		}
@@ -969,6 +980,8 @@ static void wire_up_arguments(struct entrypoint* ep, struct basic_block* bb)
 	struct instruction* entry = ep->entry;
 	struct symbol* declared = ep->name->ctype.base_type;
 
+	set_up_argument_types(ep);
+
 	pseudo_t arg;
 	struct symbol* declaredarg;
 	PREPARE_PTR_LIST(declared->arguments, declaredarg);
@@ -1013,20 +1026,20 @@ static void generate_function_body(struct entrypoint* ep)
 			find_regclass_for_returntype(returntype));
 
 	int i;
-	cg->function_prologue_arg(&frameoffset_reg);
-	cg->function_prologue_arg(&stackbase_reg);
+	cg->function_prologue_arg(&cgctx->frameoffset_reg);
+	cg->function_prologue_arg(&cgctx->stackbase_reg);
 	for (i = 0; i<count; i++)
-		cg->function_prologue_arg(&hardregs[i]);
+		cg->function_prologue_arg(&cgctx->hardregs[i]);
 	if (fn->variadic)
 		cg->function_prologue_vararg();
 
 	/* Declare all used registers. Registers that were used for argument
 	 * passing are automatically local. */
 
-	cg->function_prologue_reg(&stackoffset_reg);
+	cg->function_prologue_reg(&cgctx->stackoffset_reg);
 	for (i = count; i < NUM_REGS; i++)
 	{
-		struct hardreg* reg = &hardregs[i];
+		struct hardreg* reg = &cgctx->hardregs[i];
 		if (reg->touched)
 			cg->function_prologue_reg(reg);
 	}
@@ -1035,8 +1048,9 @@ static void generate_function_body(struct entrypoint* ep)
 
 	/* Adjust stack. */
 
-	cg->set_int(stacksize, &stackoffset_reg);
-	cg->add(&frameoffset_reg, &stackoffset_reg, &stackoffset_reg);
+	cg->set_int(cgctx->stacksize, &cgctx->stackoffset_reg);
+	cg->add(&cgctx->frameoffset_reg, &cgctx->stackoffset_reg,
+			&cgctx->stackoffset_reg);
 
 	/* Emit the actual function code. */
 
@@ -1070,20 +1084,27 @@ void generate_ep(struct entrypoint *ep)
 
 	wire_up_arguments(ep, ep->entry->bb);
 
-    /* Recursively rewrite the code to decompose instructions into more
-     * primitive forms. */
+	/* Decide what order the bbs are going to be processed in. */
+
+	number_basic_blocks(ep);
 
-	unsigned long generation = ++bb_generation;
-	rewrite_bb_recursively(ep->entry->bb, generation);
+	/* Rewrite the code to decompose instructions into more primitive
+	 * forms. */
+
+	phase_start(PHASE_REWRITE);
+	rewrite_bbs();
+	phase_end(PHASE_REWRITE);
 
 	/* We're using no stack space. */
 
-	stacksize = 0;
+	cgctx->stacksize = 0;
 
 	/* Insert deathnotes before the instruction where a register is used
 	 * last. */
 
+	phase_start(PHASE_DEATH);
 	track_pseudo_death(ep);
+	phase_end(PHASE_DEATH);
 
 	/* Convert out of SSA form. */
 
@@ -1091,16 +1112,19 @@ void generate_ep(struct entrypoint *ep)
 
 	/* Set up initial inter-bb storage links. */
 
+	phase_start(PHASE_STORAGE);
 	set_up_storage(ep);
+	phase_end(PHASE_STORAGE);
 
 	/* Wire together all the bbs. */
 
-	int sequence = 0;
-	generation = ++bb_generation;
-	wire_up_bb_recursively(ep->entry->bb, generation, &sequence);
+	phase_start(PHASE_WIREUP);
+	wire_up_bbs();
+	phase_end(PHASE_WIREUP);
 
 	/* Generate the code itself into the zbuffer. */
 
+	phase_start(PHASE_CODEGEN);
 	struct binfo** binfolist;
 	int binfocount;
 	get_binfo_list(&binfolist, &binfocount);
@@ -1110,6 +1134,7 @@ void generate_ep(struct entrypoint *ep)
 		dump_bb(binfolist[i]->bb);
 		generate_binfo(binfolist[i]);
 	}
+	phase_end(PHASE_CODEGEN);
 
 	/* Now generate the function body with the zbuffer contents embedded
 	 * within. */
@@ -1118,4 +1143,10 @@ void generate_ep(struct entrypoint *ep)
 
 	/* Clear the storage hashes for the next function.. */
 	free_storage();
+
+	/* ...and everything else we know about this one. */
+	record_function_stats(ep);
+	reset_binfo();
+	free_pinfo();
+	reset_argument_types();
 }
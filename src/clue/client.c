@@ -0,0 +1,118 @@
+/* client.c
+ * Compile server client
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+/* This is deliberately tiny: it hands its arguments, working directory,
+ * stdout and stderr to a clue --server (see server.c) and exits with
+ * whatever status the compiler returns.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static void fatal(const char* message)
+{
+	fprintf(stderr, "clue-client: %s\n", message);
+	exit(1);
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2)
+		fatal("Usage: clue-client socket [clue options] file.c ..");
+
+	/* Build the request. */
+
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd)))
+		fatal("unable to get current directory");
+
+	size_t len = strlen(cwd) + 2;
+	int i;
+	for (i = 2; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+
+	char* request = malloc(len);
+	char* p = request;
+	strcpy(p, cwd);
+	p += strlen(p) + 1;
+	for (i = 2; i < argc; i++)
+	{
+		strcpy(p, argv[i]);
+		p += strlen(p) + 1;
+	}
+	*p = '\0';
+
+	/* Connect. */
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		fatal("unable to create socket");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(addr.sun_path))
+		fatal("socket path is too long");
+	strcpy(addr.sun_path, argv[1]);
+
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+		fatal("unable to connect to compile server");
+
+	/* Send stdout and stderr along with the first part of the request. */
+
+	union
+	{
+		struct cmsghdr align;
+		char data[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	int fds[2] = { 1, 2 };
+
+	struct iovec iov;
+	iov.iov_base = request;
+	iov.iov_len = len;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t sent = sendmsg(fd, &msg, 0);
+	if (sent <= 0)
+		fatal("unable to send request");
+	while (sent < len)
+	{
+		ssize_t j = write(fd, request + sent, len - sent);
+		if (j <= 0)
+			fatal("unable to send request");
+		sent += j;
+	}
+
+	/* Wait for the exit status. If the compiler died, there won't be one. */
+
+	char status;
+	if (read(fd, &status, 1) != 1)
+		return 1;
+	return status;
+}
@@ -11,13 +11,117 @@
  */
 
 #include "globals.h"
+#include <math.h>
 
 static void declare_symbol(struct symbol* sym);
 static void pass1_define_symbol(struct symbol* sym);
 
 static struct hardreg* target_ptr;
+
+/* If set, each function is written to stdout as soon as it's been
+ * generated, preceded by any declarations it needs, rather than being held
+ * until the whole program has been compiled. */
+
+int stream_functions = 0;
 static struct symbol_list* symbols_to_initialize = NULL;
 
+/* symbols_to_initialize is built up a file at a time. These are the index
+ * of the current file's first entry, and the number of entries whose
+ * initializers have already been looked at. */
+
+static int file_first_symbol = 0;
+static int file_end_symbol = 0;
+
+/* Initializer code for files compiled by -j workers, spliced into our own
+ * in file order. */
+
+static struct file_output* file_outputs = NULL;
+static int file_output_count = 0;
+
+/* Numeric constants waiting to be written with cg->store_constants(). */
+
+static struct initvalue* pending_values = NULL;
+static int pending_size = 0;
+static int pending_count = 0;
+static int pending_pos;
+
+/* Returns true if a constant needn't be written to zeroed storage. */
+
+int is_zero_initvalue(const struct initvalue* value)
+{
+	if (value->isfloat)
+		return (value->fvalue == 0) && !signbit(value->fvalue);
+	return (value->ivalue == 0);
+}
+
+/* Returns the source representation of a constant in the current target
+ * language. */
+
+const char* show_initvalue(const struct initvalue* value)
+{
+	if (value->isfloat)
+	{
+		long double f = value->fvalue;
+
+		if (isnan(f))
+			return cg->nan;
+		if (isinf(f))
+			return (f > 0) ? cg->infinity : aprintf("(-%s)", cg->infinity);
+		return aprintf("%.17Lg", f);
+	}
+	return aprintf("%lld", value->ivalue);
+}
+
+/* Write out any queued constants. */
+
+static void flush_constants(void)
+{
+	if (pending_count > 0)
+		cg->store_constants(target_ptr, pending_pos, pending_values,
+				pending_count);
+	pending_count = 0;
+}
+
+/* Store a numeric constant into the thing being initialized. If the backend
+ * can do bulk stores, consecutive constants are queued up and written in one
+ * go. */
+
+static void emit_constant(int pos, const struct initvalue* value)
+{
+	if (!cg->store_constants)
+	{
+		struct hardreg* reg;
+
+		if (value->isfloat)
+		{
+			reg = allocate_hardreg(REGTYPE_FLOAT);
+			cg->set_float(value->fvalue, reg);
+		}
+		else
+		{
+			reg = allocate_hardreg(REGTYPE_INT);
+			cg->set_int(value->ivalue, reg);
+		}
+
+		cg->store(NULL, target_ptr, pos, reg);
+		unref_hardreg(reg);
+		return;
+	}
+
+	if ((pending_count > 0) && (pos != (pending_pos + pending_count)))
+		flush_constants();
+	if (pending_count == 0)
+		pending_pos = pos;
+
+	if (pending_count == pending_size)
+	{
+		pending_size = pending_size ? (pending_size * 2) : 256;
+		pending_values = realloc(pending_values,
+				pending_size * sizeof(*pending_values));
+	}
+	pending_values[pending_count++] = *value;
+}
+
 /* Emits elements from within an array initializer. */
 
 static int emit_array_initializer(int pos, struct expression* expr)
@@ -26,19 +130,17 @@ static int emit_array_initializer(int pos, struct expression* expr)
 	{
 		case EXPR_STRING:
 		{
-			struct hardreg* reg = allocate_hardreg(REGTYPE_INT);
+			struct initvalue value = { .isfloat = 0 };
 
 			struct string* s = expr->string;
 			int i = 0;
 			for (i = 0; i < s->length; i++)
 			{
-				int c = s->data[i];
-				cg->set_int(c, reg);
-				cg->store(NULL, target_ptr, pos, reg);
+				value.ivalue = s->data[i];
+				emit_constant(pos, &value);
 				pos++;
 			}
 
-			unref_hardreg(reg);
 			break;
 		}
 
@@ -56,25 +158,19 @@ static int emit_array_initializer(int pos, struct expression* expr)
 
 		case EXPR_VALUE:
 		{
-			struct hardreg* reg = allocate_hardreg(REGTYPE_INT);
+			struct initvalue value = { .isfloat = 0, .ivalue = expr->value };
 
-			cg->set_int(expr->value, reg);
-			cg->store(NULL, target_ptr, pos, reg);
+			emit_constant(pos, &value);
 			pos++;
-
-			unref_hardreg(reg);
 			break;
 		}
 
 		case EXPR_FVALUE:
 		{
-			struct hardreg* reg = allocate_hardreg(REGTYPE_FLOAT);
+			struct initvalue value = { .isfloat = 1, .fvalue = expr->fvalue };
 
-			cg->set_float(expr->fvalue, reg);
-			cg->store(NULL, target_ptr, pos, reg);
+			emit_constant(pos, &value);
 			pos++;
-
-			unref_hardreg(reg);
 			break;
 		}
 
@@ -103,6 +199,7 @@ static int emit_array_initializer(int pos, struct expression* expr)
 				cg->set_osymbol(expr->symbol, reg);
 			}
 
+			flush_constants();
 			cg->store(NULL, target_ptr, pos, reg);
 			pos++;
 
@@ -149,6 +246,7 @@ static void emit_array(struct symbol* sym)
 		cg->set_osymbol(sym, target_ptr);
 
 		emit_array_initializer(cg->pointer_zero_offset, sym->initializer);
+		flush_constants();
 	}
 }
 
@@ -212,6 +310,8 @@ static void compile_references_for_function(struct entrypoint* ep)
 					(sym->ctype.modifiers & MOD_EXTERN))
 			{
 				declare_symbol(sym);
+				if (linking)
+					add_link_reference(ep->name, sym);
 			}
 		}
 	}
@@ -228,7 +328,10 @@ static void declare_symbol(struct symbol* sym)
 		return;
 	sinfo->declared = 1;
 
-	zsetbuffer(ZBUFFER_HEADER);
+	/* In link mode, declarations are held back until we know whether
+	 * they're needed. */
+
+	zsetbuffer(linking ? ZBUFFER_LINK : ZBUFFER_HEADER);
 	cg->comment("symbol %s (%p), here=%d, static=%d\n",
 			show_symbol_mangled(sym), sym, sinfo->here, !!(sym->ctype.modifiers
 					& MOD_STATIC));
@@ -267,6 +370,14 @@ static void declare_symbol(struct symbol* sym)
 	else
 		cg->declare_slot(sym, bits_to_bytes(sym->bit_size));
 
+	if (linking)
+	{
+		struct linkinfo* info = lookup_linkinfo_of_symbol(sym);
+		const char* s = zstring();
+		if (!info->declaration)
+			info->declaration = s;
+	}
+
 	/* ...and queue the pass 2 declaration. */
 
 	add_symbol(&symbols_to_initialize, sym);
@@ -287,52 +398,159 @@ static void pass1_define_symbol(struct symbol* sym)
 	{
 		case SYM_FN:
 		{
+			phase_start(PHASE_LINEARIZE);
 			struct entrypoint *ep = linearize_symbol(sym);
+			phase_end(PHASE_LINEARIZE);
 			if (ep)
 			{
 				compile_references_for_function(ep);
 //				dump_fn(ep);
-				generate_ep(ep);
+
+				/* Everything allocated while looking up or generating the
+				 * function is thrown away once its code is in the zbuffer. */
+
+				current_arena = &function_arena;
+				if (!lookup_cached_function(ep))
+				{
+					generate_ep(ep);
+					store_cached_function();
+				}
+				current_arena = &program_arena;
+				arena_reset(&function_arena);
+
 				zsetbuffer(ZBUFFER_FUNCTION);
-				zflush(ZBUFFER_CODE);
+				if (linking)
+				{
+					struct linkinfo* info = lookup_linkinfo_of_symbol(sym);
+					info->definition = sym;
+					info->code = zstring();
+				}
+				else if (stream_functions)
+				{
+					zsetbuffer(ZBUFFER_HEADER);
+					zflush(ZBUFFER_STDOUT);
+					zsetbuffer(ZBUFFER_FUNCTION);
+					zflush(ZBUFFER_STDOUT);
+				}
+				else
+					zflush(ZBUFFER_CODE);
 			}
 			break;
 		}
 	}
 }
 
-/* Compile a single symbol during pass 2. */
+/* Declare every symbol referred to by an initializer expression, so that
+ * nothing new turns up once the initializer is being emitted. If from is
+ * set, the references are also recorded for the linker. */
+
+static void declare_initializer_references(struct symbol* from,
+		struct expression* expr)
+{
+	if (!expr)
+		return;
+
+	switch (expr->type)
+	{
+		case EXPR_SYMBOL:
+			declare_symbol(expr->symbol);
+			if (from)
+				add_link_reference(from, expr->symbol);
+			break;
+
+		case EXPR_INITIALIZER:
+		{
+			struct expression* e;
+
+			FOR_EACH_PTR(expr->expr_list, e)
+			{
+				declare_initializer_references(from, e);
+			}
+			END_FOR_EACH_PTR(e);
+			break;
+		}
+
+		case EXPR_POS:
+			declare_initializer_references(from, expr->init_expr);
+			break;
+
+		case EXPR_PREOP:
+			if ((expr->op == '*') && (expr->unop->type == EXPR_SYMBOL))
+				declare_initializer_references(from,
+						expr->unop->symbol->initializer);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* In link mode, only the reachable definition of each name is emitted. */
+
+static int is_linked_definition(struct symbol* sym)
+{
+	if (!linking)
+		return 1;
+
+	struct linkinfo* info = lookup_linkinfo_of_symbol(sym);
+	return info->reachable && (info->definition == sym);
+}
+
+/* Create storage for a symbol defined here, and export it if necessary. This
+ * happens when the file is loaded, so every symbol exists before any
+ * initializer runs. */
 
-static void pass2_define_or_declare_symbol(struct symbol* sym)
+static void pass2_create_symbol(struct symbol* sym)
 {
 	struct symbol* type = sym->ctype.base_type;
 	struct sinfo* sinfo = lookup_sinfo_of_symbol(sym);
-	const char* name = sinfo->name;
 
-	if (sinfo->defined)
+	if (!sinfo->here || !is_linked_definition(sym))
 		return;
-	sinfo->defined = 1;
 
-	if (!sinfo->here)
-	{
-		/* If extern, import the symbol. */
+	if (type->type != SYM_FN)
+		cg->create_storage(sym, bits_to_bytes(sym->bit_size));
+
+	/* A linked program only needs main() to be visible to the runtime. */
 
+	if (!(sym->ctype.modifiers & MOD_STATIC) &&
+			(!linking || (strcmp(sinfo->name, "_main") == 0)))
+		cg->export(sym);
+}
+
+/* If extern, import the symbol. In link mode, that's anything used but
+ * defined by none of the input files. */
+
+static void pass2_import_symbol(struct symbol* sym)
+{
+	struct sinfo* sinfo = lookup_sinfo_of_symbol(sym);
+
+	if (linking)
+	{
+		struct linkinfo* info = lookup_linkinfo_of_symbol(sym);
+		if (!info->reachable || info->definition || info->imported)
+			return;
+		info->imported = 1;
 		cg->import(sym);
 	}
-	else
-	{
-		/* Otherwise, define storage for the symbol. */
-
-		if (type->type != SYM_FN)
-			cg->create_storage(sym, bits_to_bytes(sym->bit_size));
+	else if (!sinfo->here)
+		cg->import(sym);
+}
 
-		/* Export the symbol if necessary. */
+/* Initialize a single symbol during pass 2. */
 
-		if (!(sym->ctype.modifiers & MOD_STATIC))
-			cg->export(sym);
+static void pass2_define_symbol(struct symbol* sym)
+{
+	struct symbol* type = sym->ctype.base_type;
+	struct sinfo* sinfo = lookup_sinfo_of_symbol(sym);
+	const char* name = sinfo->name;
 
-		/* And initialize. */
+	if (sinfo->defined)
+		return;
+	sinfo->defined = 1;
 
+	if (sinfo->here && is_linked_definition(sym))
+	{
 		switch (type->type)
 		{
 			case SYM_ARRAY:
@@ -398,9 +616,82 @@ int compile_symbol_list(struct symbol_list *list)
 	return 0;
 }
 
-/* Emit a function that will initialize all of this file's global data. */
+/* In link mode, work out which symbol defines each piece of data and what
+ * the initializers refer to, and then emit everything reachable from
+ * main(). This has to happen before the header and code are written. */
 
-void emit_initializer(void)
+void link_program(void)
+{
+	struct symbol* sym;
+
+	FOR_EACH_PTR(symbols_to_initialize, sym)
+	{
+		struct symbol* type = sym->ctype.base_type;
+		struct sinfo* sinfo = lookup_sinfo_of_symbol(sym);
+
+		if (!sinfo->here || (type->type == SYM_FN))
+			continue;
+
+		struct linkinfo* info = lookup_linkinfo_of_symbol(sym);
+		if (!info->definition ||
+				(!info->definition->initializer && sym->initializer))
+			info->definition = sym;
+
+		declare_initializer_references(sym, sym->initializer);
+	}
+	END_FOR_EACH_PTR(sym);
+
+	emit_linked_program();
+}
+
+/* Called after each input file has been compiled. Declares anything only
+ * its initializers refer to (this appends to symbols_to_initialize, which
+ * we're walking, so those get visited too). Doing this per file keeps each
+ * file's symbols together, so that files can be compiled separately and
+ * their output concatenated. Link mode does this itself, in link_program().
+ */
+
+void finish_file(void)
+{
+	if (linking)
+		return;
+
+	struct symbol* sym;
+	int i = 0;
+	FOR_EACH_PTR(symbols_to_initialize, sym)
+	{
+		if (i++ < file_end_symbol)
+			continue;
+
+		struct sinfo* sinfo = lookup_sinfo_of_symbol(sym);
+		if (sinfo->here)
+			declare_initializer_references(NULL, sym->initializer);
+	}
+	END_FOR_EACH_PTR(sym);
+
+	file_first_symbol = file_end_symbol;
+	file_end_symbol = i;
+}
+
+/* Calls a pass 2 function on every symbol from the given index onwards. */
+
+static void emit_pass2(int from, void (*pass2)(struct symbol* sym))
+{
+	struct symbol* sym;
+	int i = 0;
+	FOR_EACH_PTR(symbols_to_initialize, sym)
+	{
+		if (i++ < from)
+			continue;
+		pass2(sym);
+	}
+	END_FOR_EACH_PTR(sym);
+}
+
+/* Starts the initializer function, and sets up the registers that the
+ * pass 2 definitions use. */
+
+static void emit_initializer_prologue(void)
 {
 	reset_hardregs();
 	untouch_hardregs();
@@ -426,23 +717,94 @@ void emit_initializer(void)
 
 	for (i = 0; i < NUM_REGS; i++)
 	{
-		struct hardreg* reg = &hardregs[i];
+		struct hardreg* reg = &cgctx->hardregs[i];
 		if (reg->touched)
 			cg->function_prologue_reg(reg);
 	}
 
 	cg->function_prologue_end();
+}
+
+/* In a -j worker, takes everything the most recent file produced out of the
+ * zbuffers. The initializer is split into the pieces emit_initializer()
+ * needs. */
+
+void capture_file_output(struct file_output* out)
+{
+	zsetbuffer(ZBUFFER_HEADER);
+	out->header = zstring();
+	zsetbuffer(ZBUFFER_CODE);
+	out->code = zstring();
 
 	zsetbuffer(ZBUFFER_INITIALIZER);
-	zflush(ZBUFFER_STDOUT);
+	emit_pass2(file_first_symbol, pass2_create_symbol);
+	out->create = zstring();
+
+	emit_initializer_prologue();
+	free((void*) zstring());
+
+	emit_pass2(file_first_symbol, pass2_import_symbol);
+	out->import = zstring();
+	emit_pass2(file_first_symbol, pass2_define_symbol);
+	out->define = zstring();
+}
 
+/* Adds the output of a file compiled by a -j worker. */
+
+void add_file_output(const struct file_output* out)
+{
+	zsetbuffer(ZBUFFER_HEADER);
+	zprintf("%s", out->header);
+	zsetbuffer(ZBUFFER_CODE);
+	zprintf("%s", out->code);
+
+	file_outputs = realloc(file_outputs,
+			(file_output_count + 1) * sizeof(struct file_output));
+	file_outputs[file_output_count++] = *out;
+}
+
+/* Emit a function that will initialize all of this file's global data.
+ * Storage is created and exported at load time; the initializer itself only
+ * imports symbols from other files and then fills in values, so that all
+ * references resolve in a single run. */
+
+void emit_initializer(void)
+{
 	struct symbol* sym;
+	int i;
+
+	/* Declare anything only the initializers refer to. Normally
+	 * finish_file() has already done this. */
+
 	FOR_EACH_PTR(symbols_to_initialize, sym)
 	{
-		pass2_define_or_declare_symbol(sym);
+		struct sinfo* sinfo = lookup_sinfo_of_symbol(sym);
+
+		if (sinfo->here)
+			declare_initializer_references(NULL, sym->initializer);
 	}
 	END_FOR_EACH_PTR(sym);
 
+	zsetbuffer(ZBUFFER_HEADER);
+	zflush(ZBUFFER_STDOUT);
+
+	emit_pass2(0, pass2_create_symbol);
+	for (i = 0; i < file_output_count; i++)
+		zprintf("%s", file_outputs[i].create);
+
+	emit_initializer_prologue();
+
+	zsetbuffer(ZBUFFER_INITIALIZER);
+	zflush(ZBUFFER_STDOUT);
+
+	emit_pass2(0, pass2_import_symbol);
+	for (i = 0; i < file_output_count; i++)
+		zprintf("%s", file_outputs[i].import);
+
+	emit_pass2(0, pass2_define_symbol);
+	for (i = 0; i < file_output_count; i++)
+		zprintf("%s", file_outputs[i].define);
+
 	cg->ret(NULL, NULL);
 	cg->function_epilogue();
 }
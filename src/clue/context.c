@@ -0,0 +1,30 @@
+/* context.c
+ * Code generation contexts
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+
+static struct cgcontext main_context =
+{
+	.currentbuffer = &main_context.zbuffers[ZBUFFER_CODE],
+};
+
+struct cgcontext* cgctx = &main_context;
+
+/* Sets up the current context for the selected backend. */
+
+void init_cgcontext(void)
+{
+	init_register_allocator();
+
+	if (!cgctx->backend)
+		cgctx->backend = calloc(1, cg->state_size ? cg->state_size : 1);
+}
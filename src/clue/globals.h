@@ -53,9 +53,55 @@ enum
 	ZBUFFER_FUNCTIONCODE,
 	ZBUFFER_HEADER,
 	ZBUFFER_INITIALIZER,
+	ZBUFFER_LINK,
 	ZBUFFER__MAX
 };
 
+struct zprintnode
+{
+	struct zprintnode* next;
+	char* value;
+};
+
+struct zbuffer
+{
+	struct zprintnode* zfirst;
+	struct zprintnode* zlast;
+	size_t size;
+};
+
+struct arenachunk;
+struct arena
+{
+	const char* name;
+	struct arenachunk* first;
+	struct arenachunk* current;
+	size_t used;
+	size_t highwater;
+	size_t allocated;
+};
+
+enum
+{
+	PHASE_PARSE = 0,
+	PHASE_LINEARIZE,
+	PHASE_REWRITE,
+	PHASE_DEATH,
+	PHASE_STORAGE,
+	PHASE_WIREUP,
+	PHASE_CODEGEN,
+	PHASE_INITIALIZER,
+	PHASE_FLUSH,
+	PHASE__MAX
+};
+
+enum
+{
+	STATS_NONE = 0,
+	STATS_TEXT,
+	STATS_JSON
+};
+
 enum
 {
 	TYPE_NONE = 0,
@@ -69,6 +115,14 @@ enum
 	TYPE_STRUCT,
 };
 
+/* Element types of packed char arrays. */
+
+enum
+{
+	PACKED_SIGNED = 1,
+	PACKED_UNSIGNED
+};
+
 /* Register types. */
 
 enum
@@ -153,6 +207,35 @@ struct sinfo
 	unsigned anonymous : 1;            /* is this symbol anonymous? */
 };
 
+/* linkinfos store what's known about a mangled name in link mode. */
+
+struct linkinfo;
+DECLARE_PTR_LIST(linkinfo_list, struct linkinfo);
+
+struct linkinfo
+{
+	const char* name;                  /* mangled name */
+	struct symbol* definition;         /* symbol which defines it, if any */
+	const char* declaration;           /* header text */
+	const char* code;                  /* function text */
+	struct linkinfo_list* references;  /* names this one refers to */
+	unsigned reachable : 1;            /* is this used by the program? */
+	unsigned imported : 1;             /* has this been imported? */
+};
+
+/* What a -j worker produces for one input file. The initializer is in
+ * pieces, as each piece is spliced into a different part of the output.
+ */
+
+struct file_output
+{
+	const char* header;
+	const char* code;
+	const char* create;                /* storage creation and exports */
+	const char* import;
+	const char* define;                /* initializer values */
+};
+
 /* binfos store back-end specific data about basic blocks.
  */
 
@@ -162,21 +245,77 @@ struct binfo
 	int id;                            /* sequence number for this bb */
 };
 
-extern struct hardreg stackbase_reg;
-extern struct hardreg stackoffset_reg;
-extern struct hardreg frameoffset_reg;
-extern struct hardreg hardregs[NUM_REGS];
+/* The register allocator's, the zbuffers' and the backend's working state
+ * lives in a cgcontext rather than in separate globals. There is only one,
+ * cgctx, which lasts for the whole program. (The compiler's other state,
+ * such as the symbol store, is still global, so functions can't be
+ * generated concurrently.)
+ */
+
+struct cgcontext
+{
+	struct hardreg hardregs[NUM_REGS];
+	struct hardreg stackbase_reg;
+	struct hardreg stackoffset_reg;
+	struct hardreg frameoffset_reg;
+	struct pinfo_list* dying_pinfos;
+	int stacksize;                     /* of the current function's frame */
+
+	struct avlnode* pinfostore;
+	struct avlnode* binfostore;
+	struct binfo** binfolist;
+	int binfocount;
+	struct entrypoint* argtypes_ep;    /* function argtypes describes */
+	int* argtypes;                     /* base types of its arguments */
+	int argcount;
+
+	struct zbuffer zbuffers[ZBUFFER__MAX];
+	struct zbuffer* currentbuffer;     /* NULL for stdout */
+
+	void* backend;                     /* cg->state_size bytes */
+};
+
+extern struct cgcontext* cgctx;
+
+/* A numeric constant in a static initializer. */
+
+struct initvalue
+{
+	unsigned isfloat : 1;
+	long long int ivalue;
+	long double fvalue;
+};
 
 /* Represents a code generator backend. */
 
 struct codegenerator
 {
+	/* Offset of the first cell of an object. Pointers are compared by
+	 * offset alone, and a test against a literal 0 (fp == NULL, !fp)
+	 * compares the offset with 0. So run-time routines which return
+	 * pointers to objects of their own (FILE*s, clue_mmap()) use an offset
+	 * greater than this one, and return NULL as offset 0.
+	 */
 	int pointer_zero_offset;
 	const char* spname;
 	const char* fpname;
 	const char* stackname;
 	int register_class[NUM_REG_CLASSES];
 
+	/* How to write positive infinity and NaN, for constants which aren't
+	 * finite. Only needed by backends which use show_initvalue(). */
+	const char* infinity;
+	const char* nan;
+
+	/* Size of the backend's own state, which is kept in each cgcontext. */
+	size_t state_size;
+
+	/* Set if generated code depends on state outside the function
+	 * being compiled, so it can't be reused from the function cache or
+	 * produced by a separate -j worker.
+	 */
+	int uncacheable;
+
 	void (*reset_registers)(void);
 	void (*init_register)(struct hardreg* reg, int regclass);
 	const char* (*get_register_name)(struct hardreg* reg);
@@ -191,6 +330,11 @@ struct codegenerator
 	void (*declare_function_end)(void);
 
 	void (*declare_slot)(struct symbol* sym, unsigned size);
+
+	/* Creates a symbol's memory. If sym->string is set, the symbol is a
+	 * string constant: once its initializer has run it never changes, so
+	 * the run-time may remember its conversions to native strings.
+	 */
 	void (*create_storage)(struct symbol* sym, unsigned size);
 	void (*import)(struct symbol* sym);
 	void (*export)(struct symbol* sym);
@@ -219,6 +363,13 @@ struct codegenerator
 	void (*store)(struct hardreg* simple, struct hardreg* base, int offset,
 			struct hardreg* src);
 
+	/* Optional. If present, runs of numeric constants in static
+	 * initializers are written to base[offset..offset+count-1] with a single
+	 * call instead of one set_int()/set_float() and store() per element.
+	 */
+	void (*store_constants)(struct hardreg* base, int offset,
+			const struct initvalue* values, int count);
+
 	void (*set_int)(long long int value, struct hardreg* dest);
 	void (*set_float)(long double value, struct hardreg* dest);
 	void (*set_osymbol)(struct symbol* sym, struct hardreg* dest);
@@ -263,28 +414,82 @@ struct codegenerator
 	void (*call_vararg)(struct hardreg* arg);
 	void (*call_end)(void);
 
+	/* Optional. If present, calls to statically known functions are emitted
+	 * with call_direct() instead of call() (followed by the usual call_arg()s
+	 * and call_end()), and the function's address is never loaded into a
+	 * register.
+	 */
+	void (*call_direct)(struct symbol* sym,
+			struct hardreg* dest1, struct hardreg* dest2);
+
+	/* Optional. If present, calls to printf() with a constant format are
+	 * broken up at compile time (see printf.c): printf_text() emits len
+	 * characters of literal text, and printf_conversion() emits a single
+	 * conversion of arg, where spec is the complete conversion with any
+	 * length modifiers removed (e.g. "%-8.3f"). The code they emit calls
+	 * printf helpers in the run-time, which write to stdout through the
+	 * same buffer as the run-time's own printf(), so that output from the
+	 * two stays in order.
+	 */
+	void (*printf_text)(const char* text, int len);
+	void (*printf_conversion)(const char* spec, int conversion,
+			struct hardregref* arg);
+
 	void (*ret)(struct hardreg* simple, struct hardreg* base);
 
 	void (*memcpyimpl)(struct hardregref* src, struct hardregref* dest, int size);
 };
 
 extern const struct codegenerator* cg;
+extern const char* cg_name;
 extern const struct codegenerator cg_lua51;
 extern const struct codegenerator cg_lua52;
 extern const struct codegenerator cg_lua52ffi;
 extern const struct codegenerator cg_javascript;
 extern const struct codegenerator cg_perl5;
+extern const struct codegenerator cg_perl5fast;
 extern const struct codegenerator cg_c;
 extern const struct codegenerator cg_lisp;
 extern const struct codegenerator cg_java;
 
+extern void init_code_generator(int* argc, const char* argv[]);
+extern void init_compiler(void);
+extern int compile_program(struct symbol_list* symbols,
+		struct string_list* filelist);
+extern int run_server(const char* path);
+
+extern int jobs;
+extern void compile_files_in_parallel(struct string_list* filelist);
+
+extern int report_memory;
+extern struct arena program_arena;
+extern struct arena function_arena;
+extern struct arena* current_arena;
+extern void* arena_alloc(struct arena* arena, size_t size);
+extern void arena_reset(struct arena* arena);
+extern const char* arena_vprintf(struct arena* arena, const char* fmt,
+		va_list ap);
+extern const char* arena_printf(struct arena* arena, const char* fmt, ...);
+extern void report_arenas(void);
+
+extern int stats_format;
+extern FILE* stats_file;
+extern void phase_start(int phase);
+extern void phase_end(int phase);
+extern void record_function_stats(struct entrypoint* ep);
+extern void report_stats(void);
+extern void report_combined_stats(FILE** files, int count);
+
 extern const char* aprintf(const char* fmt, ...);
 extern void zprintf(const char* fmt, ...);
 extern void zvprintf(const char* fmt, va_list ap);
 extern void zflush(int output);
 extern void zsetbuffer(int buffer);
+extern size_t zsize(void);
+extern const char* zstring(void);
 
 extern void init_register_allocator(void);
+extern void init_cgcontext(void);
 extern const char* show_hardreg(struct hardreg* reg);
 extern const char* show_hardregref(struct hardregref* hrf);
 extern void reset_hardregs(void);
@@ -311,32 +516,60 @@ extern struct hardreg* find_source_hardreg_for_pseudo(struct bb_state* state,
 		pseudo_t pseudo);
 extern struct storage_hash* find_storagehash_for_pseudo(
 		struct bb_state* state, pseudo_t pseudo, struct hardreg* reg);
-extern void wire_up_bb_recursively(struct basic_block* bb,
-    unsigned long generation, int* sequence);
+extern void wire_up_bbs(void);
 
 extern void generate_ep(struct entrypoint* ep);
 
 extern int compile_symbol_list(struct symbol_list *list);
 extern void emit_initializer(void);
+extern void finish_file(void);
+extern int stream_functions;
+extern void capture_file_output(struct file_output* out);
+extern void add_file_output(const struct file_output* out);
+extern void link_program(void);
+extern int is_zero_initvalue(const struct initvalue* value);
+extern const char* show_initvalue(const struct initvalue* value);
 
 extern const char* show_simple_pseudo(struct bb_state* state, pseudo_t pseudo);
 extern const char* show_value(struct expression* expr);
 
 extern void reset_pinfo(void);
+extern void free_pinfo(void);
+extern int get_pinfo_count(void);
 extern struct pinfo* lookup_pinfo_of_pseudo(pseudo_t pseudo);
 
 extern int lookup_base_type_of_pseudo(pseudo_t pseudo);
 extern int get_base_type_of_pseudo(pseudo_t pseudo);
 extern int get_base_type_of_symbol(struct symbol* symbol);
+extern void set_up_argument_types(struct entrypoint* ep);
+extern void reset_argument_types(void);
+extern int packed_chars;
+extern int get_packed_array_type(struct symbol* sym);
 
 extern struct sinfo* lookup_sinfo_of_symbol(struct symbol* sym);
 extern const char* show_symbol_mangled(struct symbol* sym);
+extern void start_file(const char* filename);
+
+extern int linking;
+extern struct linkinfo* lookup_linkinfo_of_symbol(struct symbol* sym);
+extern void add_link_reference(struct symbol* from, struct symbol* to);
+extern void emit_linked_program(void);
+extern int is_symbol_linked(struct symbol* sym);
+
+extern const char* function_cache_dir;
+extern int function_cache_hits;
+extern int function_cache_misses;
+extern int lookup_cached_function(struct entrypoint* ep);
+extern void store_cached_function(void);
+extern void report_function_cache(void);
+
+extern void rewrite_bbs(void);
 
-extern void rewrite_bb_recursively(struct basic_block* bb,
-    unsigned long generation);
+extern int generate_printf(struct instruction* insn);
 
 extern struct binfo* lookup_binfo_of_basic_block(struct basic_block* binfo);
 extern void reset_binfo(void);
+extern void number_basic_blocks(struct entrypoint* ep);
 extern void get_binfo_list(struct binfo*** list, int* count);
 
 extern void dump_bb(struct basic_block* bb);
@@ -0,0 +1,203 @@
+/* jobs.c
+ * Parallel compilation of multiple files
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+#include <errno.h>
+#include <sys/wait.h>
+
+/* With -j, each input file is compiled by a forked worker. Workers start
+ * with the state left after the builtin symbols have been compiled, which
+ * is all files ever share; each one writes its file's output to a
+ * temporary file, and these are read back and spliced together in
+ * command-line order once every worker has finished. The result is exactly
+ * what a serial compile would have produced.
+ */
+
+int jobs = 1;
+
+struct job
+{
+	const char* filename;
+	FILE* fp;
+	pid_t pid;
+	int status;
+};
+
+static void write_string(FILE* fp, const char* s)
+{
+	size_t len = strlen(s);
+	fwrite(&len, sizeof(len), 1, fp);
+	fwrite(s, 1, len, fp);
+}
+
+static const char* read_string(FILE* fp)
+{
+	size_t len;
+	if (fread(&len, sizeof(len), 1, fp) != 1)
+		return NULL;
+
+	char* s = malloc(len + 1);
+	if (fread(s, 1, len, fp) != len)
+	{
+		free(s);
+		return NULL;
+	}
+	s[len] = '\0';
+	return s;
+}
+
+/* Compiles one file. This runs in the worker. */
+
+static int run_worker(const char* filename, FILE* fp)
+{
+	/* The zbuffers still hold what the parent generated before forking
+	 * (the file prologue and the builtins); the parent emits that itself,
+	 * so only what this file adds must be handed back. */
+
+	int i;
+	for (i = 0; i < ZBUFFER__MAX; i++)
+	{
+		zsetbuffer(i);
+		free((void*) zstring());
+	}
+
+	struct symbol_list* symbols = sparse((char*) filename);
+	compile_symbol_list(symbols);
+	finish_file();
+
+	struct file_output out;
+	capture_file_output(&out);
+
+	fwrite(&function_cache_hits, sizeof(int), 1, fp);
+	fwrite(&function_cache_misses, sizeof(int), 1, fp);
+	write_string(fp, out.header);
+	write_string(fp, out.code);
+	write_string(fp, out.create);
+	write_string(fp, out.import);
+	write_string(fp, out.define);
+
+	if (fflush(fp) != 0)
+		return 2;
+	return die_if_error ? 1 : 0;
+}
+
+/* Reads back a worker's output. */
+
+static int read_worker_output(struct job* job)
+{
+	int hits, misses;
+	struct file_output out;
+
+	rewind(job->fp);
+	if ((fread(&hits, sizeof(int), 1, job->fp) != 1) ||
+			(fread(&misses, sizeof(int), 1, job->fp) != 1) ||
+			!(out.header = read_string(job->fp)) ||
+			!(out.code = read_string(job->fp)) ||
+			!(out.create = read_string(job->fp)) ||
+			!(out.import = read_string(job->fp)) ||
+			!(out.define = read_string(job->fp)))
+		return 0;
+
+	function_cache_hits += hits;
+	function_cache_misses += misses;
+	add_file_output(&out);
+	return 1;
+}
+
+/* Waits for any worker to finish. */
+
+static void reap_worker(struct job* joblist, int count)
+{
+	int status;
+	pid_t pid;
+
+	do
+		pid = waitpid(-1, &status, 0);
+	while ((pid == -1) && (errno == EINTR));
+
+	if (pid == -1)
+		die("unable to wait for worker: %s", strerror(errno));
+
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		if (joblist[i].pid == pid)
+		{
+			joblist[i].pid = 0;
+			joblist[i].status = status;
+			return;
+		}
+	}
+}
+
+void compile_files_in_parallel(struct string_list* filelist)
+{
+	int count = ptr_list_size((struct ptr_list*) filelist);
+	struct job* joblist = calloc(count, sizeof(struct job));
+	int running = 0;
+	int i = 0;
+
+	char* filename;
+	FOR_EACH_PTR_NOTAG(filelist, filename)
+	{
+		struct job* job = &joblist[i++];
+		job->filename = filename;
+
+		/* Each worker needs the 'unique' it would have seen in a serial
+		 * compile. */
+
+		start_file(filename);
+
+		while (running >= jobs)
+		{
+			reap_worker(joblist, count);
+			running--;
+		}
+
+		job->fp = tmpfile();
+		if (!job->fp)
+			die("unable to create temporary file: %s", strerror(errno));
+
+		fflush(stdout);
+		fflush(stderr);
+		job->pid = fork();
+		if (job->pid == -1)
+			die("unable to fork worker: %s", strerror(errno));
+		if (job->pid == 0)
+			_exit(run_worker(filename, job->fp));
+		running++;
+	}
+	END_FOR_EACH_PTR_NOTAG(filename);
+
+	while (running > 0)
+	{
+		reap_worker(joblist, count);
+		running--;
+	}
+
+	/* A worker which failed to finish has already reported why. */
+
+	for (i = 0; i < count; i++)
+	{
+		struct job* job = &joblist[i];
+
+		if (!WIFEXITED(job->status) || (WEXITSTATUS(job->status) > 1) ||
+				!read_worker_output(job))
+			die("failed to compile %s", job->filename);
+		if (WEXITSTATUS(job->status) == 1)
+			die_if_error = 1;
+
+		fclose(job->fp);
+	}
+
+	free(joblist);
+}
@@ -0,0 +1,654 @@
+/* libclue.c
+ * In-process compiler interface
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+#include "libclue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+/* Neither sparse nor the code generators can be reset once they've seen a
+ * file, and both report fatal errors by exiting, so compilations can't run
+ * in the caller's process. Instead, clue_init() forks a single helper
+ * process, which initializes the compiler and then waits for requests on
+ * a socket. The caller's process is never forked again.
+ *
+ * Each request is one message on that socket, carrying four descriptors as
+ * SCM_RIGHTS (the compiler's stdin, stdout and stderr, and a pipe for its
+ * exit status) followed by the caller's working directory, the filename
+ * and the options as NUL-terminated strings, ending in an empty one. For
+ * each request the helper forks the compiler from the initialized state
+ * and remembers which status pipe belongs to it. When it exits, the helper
+ * reaps it and writes a single status byte; if that never arrives, the
+ * compiler couldn't be run.
+ */
+
+#define MAX_OPTIONS 64
+#define MAX_REQUEST 65536
+#define REQUEST_FDS 4
+
+static int initialized = 0;
+static int helper_fd = -1;
+
+/* In the helper: the compilers still running, and a pipe which SIGCHLD
+ * writes to, so that the main loop wakes up to reap them. */
+
+struct compile
+{
+	struct compile* next;
+	pid_t pid;
+	int result_fd;
+};
+
+static struct compile* compiles = NULL;
+static int sigchld_fds[2];
+
+/* Runs the compiler. This runs in the compiler process, with stdin, stdout
+ * and stderr already set up. */
+
+static int run_compiler(struct symbol_list* symbols,
+		const char* const* options, const char* filename)
+{
+	const char* argv[MAX_OPTIONS + 2];
+	int argc = 0;
+
+	argv[argc++] = "clue";
+	while (*options)
+	{
+		if (argc > MAX_OPTIONS)
+			die("too many options");
+		argv[argc++] = *options++;
+	}
+	argv[argc] = NULL;
+
+	init_code_generator(&argc, argv);
+	if (argc > 1)
+		die("option %s is not supported by libclue", argv[1]);
+
+	struct string_list* filelist = NULL;
+	add_ptr_list_notag(&filelist, (char*) filename);
+
+	return compile_program(symbols, filelist);
+}
+
+/* Reads a request in the helper; returns its length, 0 if the caller has
+ * gone away, or -1 if it's malformed. */
+
+static int read_request(int fd, char* buffer, int* fds)
+{
+	union
+	{
+		struct cmsghdr align;
+		char data[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+	} control;
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = MAX_REQUEST;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	int len;
+	do
+		len = recvmsg(fd, &msg, 0);
+	while ((len == -1) && (errno == EINTR));
+	if (len <= 0)
+		return 0;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) ||
+			(cmsg->cmsg_type != SCM_RIGHTS) ||
+			(cmsg->cmsg_len != CMSG_LEN(REQUEST_FDS * sizeof(int))))
+		return -1;
+	memcpy(fds, CMSG_DATA(cmsg), REQUEST_FDS * sizeof(int));
+
+	if ((len < 2) || buffer[len-1] || buffer[len-2] ||
+			(msg.msg_flags & MSG_TRUNC))
+	{
+		int i;
+		for (i = 0; i < REQUEST_FDS; i++)
+			close(fds[i]);
+		return -1;
+	}
+
+	return len;
+}
+
+/* Starts the compiler for a single request. This runs in the helper. */
+
+static void serve_request(struct symbol_list* symbols, char* buffer,
+		int* fds)
+{
+	static const char* options[MAX_REQUEST/2];
+	int count = 0;
+	char* p = buffer;
+
+	const char* cwd = p;
+	p += strlen(p) + 1;
+	const char* filename = p;
+	p += strlen(p) + 1;
+	while (*p)
+	{
+		options[count++] = p;
+		p += strlen(p) + 1;
+	}
+	options[count] = NULL;
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		signal(SIGCHLD, SIG_DFL);
+		close(helper_fd);
+		close(sigchld_fds[0]);
+		close(sigchld_fds[1]);
+
+		/* Other compiles' status pipes must only be held by the helper, or
+		 * their callers won't see them close. */
+
+		struct compile* c;
+		for (c = compiles; c; c = c->next)
+			close(c->result_fd);
+
+		dup2(fds[0], 0);
+		dup2(fds[1], 1);
+		dup2(fds[2], 2);
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+		close(fds[3]);
+
+		if (chdir(cwd) == -1)
+			die("libclue can't change to %s: %s", cwd, strerror(errno));
+
+		int status = run_compiler(symbols, options, filename);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(status);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	close(fds[2]);
+	if (pid == -1)
+	{
+		close(fds[3]);
+		return;
+	}
+
+	struct compile* c = malloc(sizeof(struct compile));
+	c->pid = pid;
+	c->result_fd = fds[3];
+	c->next = compiles;
+	compiles = c;
+}
+
+/* Only wakes up the main loop; reaping happens there, where the list of
+ * compiles can't change underneath it. */
+
+static void sigchld_handler(int sig)
+{
+	int e = errno;
+	char c = 0;
+	write(sigchld_fds[1], &c, 1);
+	errno = e;
+}
+
+/* Reaps every compiler which has finished and reports its status. */
+
+static void reap_compiles(void)
+{
+	char buffer[64];
+	while (read(sigchld_fds[0], buffer, sizeof(buffer)) > 0)
+		;
+
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		struct compile** p = &compiles;
+		while (*p && ((*p)->pid != pid))
+			p = &(*p)->next;
+
+		struct compile* c = *p;
+		if (!c)
+			continue;
+		*p = c->next;
+
+		/* A compiler which was killed reports nothing. */
+
+		if (WIFEXITED(status))
+		{
+			char s = WEXITSTATUS(status) ? 1 : 0;
+			write(c->result_fd, &s, 1);
+		}
+		close(c->result_fd);
+		free(c);
+	}
+}
+
+/* The helper's main loop; returns when the caller closes its end of the
+ * socket. */
+
+static int run_helper(void)
+{
+	init_compiler();
+
+	/* sparse only sets itself up once it's been given a file. This one is
+	 * never actually compiled. */
+
+	const char* argv[] = { "clue", "-", NULL };
+	struct string_list* filelist = NULL;
+	struct symbol_list* symbols = sparse_initialize(2, (char**) argv, &filelist);
+
+	if (pipe(sigchld_fds) == -1)
+		return 1;
+	fcntl(sigchld_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(sigchld_fds[1], F_SETFL, O_NONBLOCK);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld_handler;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	char c = 0;
+	if (send(helper_fd, &c, 1, MSG_NOSIGNAL) != 1)
+		return 1;
+
+	for (;;)
+	{
+		static char buffer[MAX_REQUEST];
+		int fds[REQUEST_FDS];
+		struct pollfd pfds[2];
+
+		pfds[0].fd = helper_fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = sigchld_fds[0];
+		pfds[1].events = POLLIN;
+
+		if (poll(pfds, 2, -1) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+
+		if (pfds[1].revents)
+			reap_compiles();
+
+		if (pfds[0].revents)
+		{
+			int len = read_request(helper_fd, buffer, fds);
+			if (len == 0)
+				return 0;
+			if (len > 0)
+				serve_request(symbols, buffer, fds);
+		}
+	}
+}
+
+int clue_init(void)
+{
+	int sv[2];
+
+	if (initialized)
+		return 0;
+
+	/* Requests are sent from whichever thread calls clue_compile(), so
+	 * they have to arrive as whole messages. */
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1)
+		return -1;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(sv[0]);
+		helper_fd = sv[1];
+		_exit(run_helper());
+	}
+
+	close(sv[1]);
+	if (pid == -1)
+	{
+		close(sv[0]);
+		return -1;
+	}
+
+	/* Wait for the helper to finish setting up. */
+
+	char c;
+	ssize_t len;
+	do
+		len = recv(sv[0], &c, 1, 0);
+	while ((len == -1) && (errno == EINTR));
+	if (len != 1)
+	{
+		close(sv[0]);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	helper_fd = sv[0];
+	initialized = 1;
+	return 0;
+}
+
+/* Sends a request to the helper; returns 0 on success. */
+
+static int send_request(const char* const* options, const char* filename,
+		int* fds)
+{
+	char* buffer = malloc(MAX_REQUEST);
+	int len = 0;
+	const char* const* o;
+
+	if (!buffer)
+		return -1;
+	if (!getcwd(buffer, MAX_REQUEST))
+	{
+		free(buffer);
+		return -1;
+	}
+	len = strlen(buffer) + 1;
+
+	const char* strings[MAX_OPTIONS + 2];
+	int count = 0;
+	strings[count++] = filename;
+	for (o = options; *o; o++)
+	{
+		if (count > MAX_OPTIONS)
+		{
+			free(buffer);
+			return -1;
+		}
+		strings[count++] = *o;
+	}
+
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		int l = strlen(strings[i]) + 1;
+		if ((l == 1) || ((len + l + 1) > MAX_REQUEST))
+		{
+			free(buffer);
+			return -1;
+		}
+		memcpy(buffer + len, strings[i], l);
+		len += l;
+	}
+	buffer[len++] = '\0';
+
+	union
+	{
+		struct cmsghdr align;
+		char data[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+	} control;
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = len;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(REQUEST_FDS * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, REQUEST_FDS * sizeof(int));
+
+	ssize_t sent;
+	do
+		sent = sendmsg(helper_fd, &msg, MSG_NOSIGNAL);
+	while ((sent == -1) && (errno == EINTR));
+
+	free(buffer);
+	return (sent == len) ? 0 : -1;
+}
+
+/* Passes on everything available on fd; returns 0 at end of file. */
+
+static int drain(int fd, clue_sink_t sink, void* user)
+{
+	char buffer[4096];
+	ssize_t len;
+
+	do
+		len = read(fd, buffer, sizeof(buffer));
+	while ((len == -1) && (errno == EINTR));
+
+	if (len <= 0)
+		return 0;
+	if (sink)
+		sink(user, buffer, len);
+	return 1;
+}
+
+int clue_compile(const char* const* options, const char* filename,
+		const char* source, size_t length,
+		clue_sink_t output, clue_sink_t errors, void* user)
+{
+	int in[2], out[2], err[2], result[2];
+
+	if (!initialized)
+		return -1;
+
+	/* stdin is a socket rather than a pipe, so that writing to a compiler
+	 * which has died can't raise SIGPIPE in the caller. */
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) == -1)
+		return -1;
+	if (pipe(out) == -1)
+	{
+		close(in[0]);
+		close(in[1]);
+		return -1;
+	}
+	if (pipe(err) == -1)
+	{
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		return -1;
+	}
+	if (pipe(result) == -1)
+	{
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		close(err[0]);
+		close(err[1]);
+		return -1;
+	}
+
+	int fds[REQUEST_FDS] = { in[1], out[1], err[1], result[1] };
+	int sent = send_request(options, source ? "-" : filename, fds);
+
+	close(in[1]);
+	close(out[1]);
+	close(err[1]);
+	close(result[1]);
+	if (sent == -1)
+	{
+		close(in[0]);
+		close(out[0]);
+		close(err[0]);
+		close(result[0]);
+		return -1;
+	}
+
+	/* Feed the compiler its source while collecting its output. */
+
+	size_t written = 0;
+	int insock = in[0];
+	if (!source)
+	{
+		close(insock);
+		insock = -1;
+	}
+
+	int outfd = out[0];
+	int errfd = err[0];
+	while ((outfd != -1) || (errfd != -1))
+	{
+		struct pollfd fds[3];
+		int count = 0;
+
+		if (insock != -1)
+		{
+			fds[count].fd = insock;
+			fds[count].events = POLLOUT;
+			count++;
+		}
+		fds[count].fd = outfd;
+		fds[count].events = POLLIN;
+		count++;
+		fds[count].fd = errfd;
+		fds[count].events = POLLIN;
+		count++;
+
+		if (poll(fds, count, -1) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		int i;
+		for (i = 0; i < count; i++)
+		{
+			if (!fds[i].revents)
+				continue;
+
+			if (fds[i].fd == insock)
+			{
+				ssize_t len = send(insock, source + written, length - written,
+						MSG_NOSIGNAL | MSG_DONTWAIT);
+				if (len > 0)
+					written += len;
+				if (((len == -1) && (errno != EAGAIN) && (errno != EINTR)) ||
+						(written == length))
+				{
+					close(insock);
+					insock = -1;
+				}
+			}
+			else if (fds[i].fd == outfd)
+			{
+				if (!drain(outfd, output, user))
+				{
+					close(outfd);
+					outfd = -1;
+				}
+			}
+			else if (fds[i].fd == errfd)
+			{
+				if (!drain(errfd, errors, user))
+				{
+					close(errfd);
+					errfd = -1;
+				}
+			}
+		}
+	}
+
+	if (insock != -1)
+		close(insock);
+	if (outfd != -1)
+		close(outfd);
+	if (errfd != -1)
+		close(errfd);
+
+	/* The status only arrives once the compiler has finished. */
+
+	char c;
+	ssize_t len;
+	do
+		len = read(result[0], &c, 1);
+	while ((len == -1) && (errno == EINTR));
+	close(result[0]);
+
+	if (len != 1)
+		return -1;
+	return c ? 1 : 0;
+}
+
+/* Sink which appends to a clue_buffer. */
+
+static void buffer_sink(struct clue_buffer* buffer, const char* data,
+		size_t length)
+{
+	if (!buffer)
+		return;
+
+	buffer->data = realloc(buffer->data, buffer->length + length + 1);
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	buffer->data[buffer->length] = '\0';
+}
+
+struct buffer_pair
+{
+	struct clue_buffer* output;
+	struct clue_buffer* errors;
+};
+
+static void output_sink(void* user, const char* data, size_t length)
+{
+	struct buffer_pair* pair = user;
+	buffer_sink(pair->output, data, length);
+}
+
+static void errors_sink(void* user, const char* data, size_t length)
+{
+	struct buffer_pair* pair = user;
+	buffer_sink(pair->errors, data, length);
+}
+
+int clue_compile_to_buffer(const char* const* options,
+		const char* filename, const char* source, size_t length,
+		struct clue_buffer* output, struct clue_buffer* errors)
+{
+	struct buffer_pair pair = { output, errors };
+
+	if (output)
+	{
+		output->data = calloc(1, 1);
+		output->length = 0;
+	}
+	if (errors)
+	{
+		errors->data = calloc(1, 1);
+		errors->length = 0;
+	}
+
+	return clue_compile(options, filename, source, length,
+			output_sink, errors_sink, &pair);
+}
@@ -0,0 +1,64 @@
+/* libclue.h
+ * In-process compiler interface
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#ifndef LIBCLUE_H
+#define LIBCLUE_H
+
+#include <stddef.h>
+
+/* Receives a piece of output. */
+
+typedef void (*clue_sink_t)(void* user, const char* data, size_t length);
+
+/* A block of memory owned by the caller; free data with free(). */
+
+struct clue_buffer
+{
+	char* data;                        /* NUL terminated */
+	size_t length;
+};
+
+/* Sets up the compiler. Call this once, before anything else; returns 0 on
+ * success.
+ *
+ * The compiler can't be reset between compiles, so it runs in a helper
+ * process which clue_init() forks. Because it forks, clue_init() must be
+ * called before the program starts any threads. After that the caller's
+ * process is never forked again, and clue_compile() and
+ * clue_compile_to_buffer() may be called from any number of threads at
+ * once. The helper exits when the caller does. */
+
+extern int clue_init(void);
+
+/* Compiles a single translation unit. options is a NULL-terminated list of
+ * clue options, which must include a backend (e.g. "-mlua52"). If source
+ * is NULL, the file called filename (relative to the current directory) is
+ * compiled; otherwise length bytes of source are (and filename is
+ * ignored). The generated code is passed to output and any diagnostics to
+ * errors; either may be NULL. The sinks are called on the calling thread.
+ *
+ * Returns 0 on success, 1 if the program had errors, and -1 if the
+ * compiler couldn't be run. Nothing is left behind between calls.
+ */
+
+extern int clue_compile(const char* const* options, const char* filename,
+		const char* source, size_t length,
+		clue_sink_t output, clue_sink_t errors, void* user);
+
+/* As clue_compile(), but collects the output and diagnostics into buffers,
+ * either of which may be NULL. */
+
+extern int clue_compile_to_buffer(const char* const* options,
+		const char* filename, const char* source, size_t length,
+		struct clue_buffer* output, struct clue_buffer* errors);
+
+#endif
@@ -0,0 +1,117 @@
+/* link.c
+ * Whole-program linking
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+#include "avl.h"
+
+/* In link mode, all the input files are treated as a single program. Each
+ * file's symbols are different sparse symbols, so everything is tracked by
+ * mangled name instead. Declarations and function bodies are held back
+ * until the whole program has been seen; then only the ones reachable from
+ * main() get written out.
+ */
+
+int linking = 0;
+
+static avltree_t linkstore = NULL;
+static struct linkinfo_list* linkinfos = NULL;
+
+static int compare_cb(const void* lhs, const void* rhs)
+{
+	const struct linkinfo* n1 = lhs;
+	const struct linkinfo* n2 = rhs;
+	return strcmp(n1->name, n2->name);
+}
+
+struct linkinfo* lookup_linkinfo_of_symbol(struct symbol* sym)
+{
+	struct linkinfo key;
+	key.name = show_symbol_mangled(sym);
+
+	struct linkinfo* data = avl_search(linkstore, compare_cb, &key, 0);
+	if (!data)
+	{
+		data = arena_alloc(&program_arena, sizeof(struct linkinfo));
+		data->name = key.name;
+		avl_insert(&linkstore, compare_cb, data, NULL);
+		add_ptr_list(&linkinfos, data);
+	}
+
+	return data;
+}
+
+/* Record that one symbol refers to another. */
+
+void add_link_reference(struct symbol* from, struct symbol* to)
+{
+	struct linkinfo* info = lookup_linkinfo_of_symbol(from);
+	add_ptr_list(&info->references, lookup_linkinfo_of_symbol(to));
+}
+
+static void mark_reachable(struct linkinfo* info)
+{
+	if (info->reachable)
+		return;
+	info->reachable = 1;
+
+	struct linkinfo* ref;
+	FOR_EACH_PTR(info->references, ref)
+	{
+		mark_reachable(ref);
+	}
+	END_FOR_EACH_PTR(ref);
+}
+
+/* Work out what's reachable from main() and write out the declarations and
+ * code for it, in the order they were first seen. */
+
+void emit_linked_program(void)
+{
+	struct linkinfo key;
+	key.name = "_main";
+
+	struct linkinfo* root = avl_search(linkstore, compare_cb, &key, 0);
+	if (!root || !root->definition)
+		die("linked program has no main()");
+	mark_reachable(root);
+
+	struct linkinfo* info;
+	FOR_EACH_PTR(linkinfos, info)
+	{
+		if (info->reachable && info->declaration)
+		{
+			zsetbuffer(ZBUFFER_HEADER);
+			zprintf("%s", info->declaration);
+		}
+	}
+	END_FOR_EACH_PTR(info);
+
+	FOR_EACH_PTR(linkinfos, info)
+	{
+		if (info->reachable && info->code)
+		{
+			zsetbuffer(ZBUFFER_CODE);
+			zprintf("%s", info->code);
+		}
+	}
+	END_FOR_EACH_PTR(info);
+}
+
+/* Returns true if the symbol is part of the output. Outside link mode,
+ * everything is. */
+
+int is_symbol_linked(struct symbol* sym)
+{
+	if (!linking)
+		return 1;
+	return lookup_linkinfo_of_symbol(sym)->reachable;
+}
@@ -12,8 +12,11 @@
 
 #include "globals.h"
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 const struct codegenerator* cg;
+const char* cg_name;
 unsigned int unique = 0;
 
 static void init_sizes(void)
@@ -71,50 +74,175 @@ generator_table[] = {
 	{ "-mlua52",   &cg_lua52 },
 	{ "-mjs",      &cg_javascript },
 	{ "-mperl5",   &cg_perl5 },
+	{ "-mperl5fast", &cg_perl5fast },
 	{ "-mc",       &cg_c },
 	{ "-mlisp",    &cg_lisp },
 	{ "-mjava",    &cg_java },
 };
 
-static void init_code_generator(int* argc, const char* argv[])
+/* The backends we've been asked for, and where each one's output goes
+ * (NULL for stdout). */
+
+#define MAX_TARGETS 16
+
+static struct target
+{
+	const char* option;
+	const struct codegenerator* cg;
+	const char* filename;
+}
+targets[MAX_TARGETS];
+
+static int target_count;
+
+/* Removes an option we've handled from the command line, so that sparse
+ * doesn't see it. */
+
+static void remove_arg(int* argc, const char* argv[], int i)
+{
+	while (argv[i])
+	{
+		argv[i] = argv[i+1];
+		i++;
+	}
+
+	(*argc)--;
+}
+
+void init_code_generator(int* argc, const char* argv[])
 {
 	int i = 1;
 
 	cg = NULL;
+	target_count = 0;
 	while (argv[i])
 	{
+		if (strcmp(argv[i], "--link") == 0)
+		{
+			linking = 1;
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if ((strncmp(argv[i], "-j", 2) == 0) && (argv[i][2] || argv[i+1]))
+		{
+			const char* s = argv[i][2] ? argv[i]+2 : argv[i+1];
+			jobs = atoi(s);
+			if (jobs < 1)
+				die("invalid number of jobs '%s'", s);
+			if (!argv[i][2])
+				remove_arg(argc, argv, i);
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if (strcmp(argv[i], "--stream") == 0)
+		{
+			stream_functions = 1;
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if ((strcmp(argv[i], "--stats") == 0) ||
+				(strcmp(argv[i], "-ftime-report") == 0))
+		{
+			stats_format = STATS_TEXT;
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if (strcmp(argv[i], "--stats=json") == 0)
+		{
+			stats_format = STATS_JSON;
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if (strcmp(argv[i], "--packed-chars") == 0)
+		{
+			packed_chars = 1;
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if (strcmp(argv[i], "--memory-report") == 0)
+		{
+			report_memory = 1;
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		if ((strcmp(argv[i], "--cache") == 0) && argv[i+1])
+		{
+			function_cache_dir = argv[i+1];
+			remove_arg(argc, argv, i);
+			remove_arg(argc, argv, i);
+			continue;
+		}
+
+		/* -mbackend writes to stdout; -mbackend=filename writes to a
+		 * file. */
+
 		int j;
 		for (j=0; j<sizeof(generator_table)/sizeof(*generator_table); j++)
 		{
-			if (strcmp(argv[i], generator_table[j].option) == 0)
+			const char* option = generator_table[j].option;
+			int len = strlen(option);
+
+			if ((strncmp(argv[i], option, len) == 0) &&
+				((argv[i][len] == '\0') || (argv[i][len] == '=')))
 			{
-				if (cg)
-					die("you can only specify one backend at a time");
-				cg = generator_table[j].cg;
-
-				j = i;
-				while (argv[j])
-				{
-					argv[j] = argv[j+1];
-					j++;
-				}
-
-				(*argc)--;
+				if (target_count == MAX_TARGETS)
+					die("too many backends");
+
+				struct target* target = &targets[target_count++];
+				target->option = option;
+				target->cg = generator_table[j].cg;
+				target->filename = argv[i][len] ? (argv[i] + len + 1) : NULL;
+
+				remove_arg(argc, argv, i);
+				break;
 			}
 		}
 
-		i++;
+		if (j == sizeof(generator_table)/sizeof(*generator_table))
+			i++;
 	}
 
-	if (!cg)
-		die("Usage: clue [-m[lua51|lua52|js|perl5|c|lisp|java]] file.c ..");
+	if (target_count == 0)
+		die("Usage: clue [--link] [--stream] [--packed-chars] [--cache dir] [-j jobs] -m<backend>[=output] ... file.c ...\n"
+		    "   or: clue --server socket\n"
+		    "<backend> is one of lua51, lua52, js, perl5, perl5fast, c, lisp or java.");
+
+	int stdout_targets = 0;
+	for (i = 0; i < target_count; i++)
+		if (!targets[i].filename)
+			stdout_targets++;
+	if (stdout_targets > 1)
+		die("only one backend can write to stdout");
+
+	cg = targets[0].cg;
+	cg_name = targets[0].option;
 }
 
-int main(int argc, const char* argv[])
+/* Makes a target the current backend, and sends stdout to its output
+ * file. */
+
+static void select_target(struct target* target)
+{
+	cg = target->cg;
+	cg_name = target->option;
+
+	if (target->filename && !freopen(target->filename, "w", stdout))
+		die("unable to open '%s': %s", target->filename, strerror(errno));
+}
+
+/* Sets up everything that doesn't depend on the backend or the input
+ * files. This must happen before sparse_initialize(). */
+
+void init_compiler(void)
 {
-	init_code_generator(&argc, argv);
 	init_sizes();
-	init_register_allocator();
 
 	/* Poke some special lines into the parse buffer to set up the
 	 * include paths.
@@ -122,27 +250,54 @@ int main(int argc, const char* argv[])
 
 	add_pre_buffer("#nostdinc\n");
 	add_pre_buffer("#add_isystem \"src/libc/include\"\n");
+}
 
-	struct string_list* filelist = NULL;
-	struct symbol_list* symbols = sparse_initialize(argc, (char**) argv, &filelist);
+/* Generates code for the current backend. If parsed is set, it holds the
+ * already parsed symbols of each file. */
+
+static int generate_program(struct symbol_list* symbols,
+		struct string_list* filelist, struct symbol_list** parsed)
+{
+	init_cgcontext();
 
 	emit_file_prologue();
 	compile_symbol_list(symbols);
 
-	char *file;
-	FOR_EACH_PTR_NOTAG(filelist, file)
+	finish_file();
+
+	/* The statistics only cover this process, so -j is ignored when
+	 * they're wanted. */
+
+	if ((jobs > 1) && !parsed && !linking && !cg->uncacheable &&
+			!stats_format)
+	{
+		/* Workers hand their output back to us, so can't stream. */
+		stream_functions = 0;
+		compile_files_in_parallel(filelist);
+	}
+	else
 	{
-		char* p = file;
-		do
+		int i = 0;
+		char *file;
+		FOR_EACH_PTR_NOTAG(filelist, file)
 		{
-			unique += *p;
+			start_file(file);
+			if (!parsed)
+			{
+				phase_start(PHASE_PARSE);
+				symbols = sparse(file);
+				phase_end(PHASE_PARSE);
+			}
+			else
+				symbols = parsed[i++];
+			compile_symbol_list(symbols);
+			finish_file();
 		}
-		while (*p++);
-
-		symbols = sparse(file);
-		compile_symbol_list(symbols);
+		END_FOR_EACH_PTR_NOTAG(file);
 	}
-	END_FOR_EACH_PTR_NOTAG(file);
+
+	if (linking)
+		link_program();
 
 	zsetbuffer(ZBUFFER_HEADER);
 	zflush(ZBUFFER_STDOUT);
@@ -152,10 +307,122 @@ int main(int argc, const char* argv[])
 	zflush(ZBUFFER_STDOUT);
 	zprintf("\n");
 
+	phase_start(PHASE_INITIALIZER);
 	emit_initializer();
+	phase_end(PHASE_INITIALIZER);
 	cg->epilogue();
 
+	report_function_cache();
+	report_arenas();
+	report_stats();
+
 	if (die_if_error)
 		return 1;
 	return 0;
 }
+
+/* With several backends, every file is parsed once, and then each backend
+ * gets a forked copy of the parsed program to generate code from. */
+
+static int generate_all_targets(struct symbol_list* symbols,
+		struct string_list* filelist)
+{
+	int count = ptr_list_size((struct ptr_list*) filelist);
+	struct symbol_list** parsed = calloc(count ? count : 1,
+			sizeof(struct symbol_list*));
+	pid_t pids[MAX_TARGETS];
+	FILE* statsfiles[MAX_TARGETS];
+	int i = 0;
+
+	char* file;
+	FOR_EACH_PTR_NOTAG(filelist, file)
+	{
+		phase_start(PHASE_PARSE);
+		parsed[i++] = sparse(file);
+		phase_end(PHASE_PARSE);
+	}
+	END_FOR_EACH_PTR_NOTAG(file);
+
+	for (i = 0; i < target_count; i++)
+	{
+		/* The backends run at the same time, so their statistics are
+		 * collected separately and printed together at the end. */
+
+		statsfiles[i] = NULL;
+		if (stats_format)
+		{
+			statsfiles[i] = tmpfile();
+			if (!statsfiles[i])
+				die("unable to create temporary file: %s", strerror(errno));
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+		pids[i] = fork();
+		if (pids[i] == -1)
+			die("unable to fork: %s", strerror(errno));
+		if (pids[i] == 0)
+		{
+			stats_file = statsfiles[i];
+			select_target(&targets[i]);
+			int status = generate_program(symbols, filelist, parsed);
+			fflush(stdout);
+			_exit(status);
+		}
+	}
+
+	int result = 0;
+	for (i = 0; i < target_count; i++)
+	{
+		int status;
+		while (waitpid(pids[i], &status, 0) == -1)
+		{
+			if (errno != EINTR)
+				die("unable to wait for backend: %s", strerror(errno));
+		}
+
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+			result = 1;
+	}
+
+	if (stats_format)
+	{
+		report_combined_stats(statsfiles, target_count);
+		for (i = 0; i < target_count; i++)
+			fclose(statsfiles[i]);
+	}
+
+	return result;
+}
+
+/* Compiles a set of files, given the symbols returned by
+ * sparse_initialize(), and returns the exit status. */
+
+int compile_program(struct symbol_list* symbols, struct string_list* filelist)
+{
+	if (target_count > 1)
+		return generate_all_targets(symbols, filelist);
+
+	select_target(&targets[0]);
+	return generate_program(symbols, filelist, NULL);
+}
+
+/* libclue (see libclue.c) is built from the same sources, minus this. */
+
+#if !defined LIBCLUE
+int main(int argc, const char* argv[])
+{
+	if ((argc == 3) && (strcmp(argv[1], "--server") == 0))
+		return run_server(argv[2]);
+
+	init_code_generator(&argc, argv);
+	init_compiler();
+
+	struct string_list* filelist = NULL;
+	phase_start(PHASE_PARSE);
+	struct symbol_list* symbols = sparse_initialize(argc, (char**) argv, &filelist);
+	phase_end(PHASE_PARSE);
+
+	return compile_program(symbols, filelist);
+}
+#endif
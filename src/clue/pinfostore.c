@@ -13,8 +13,6 @@
 #include "globals.h"
 #include "avl.h"
 
-static avltree_t pinfostore = NULL;
-
 static int compare_cb(const void* lhs, const void* rhs)
 {
 	const struct pinfo* n1 = lhs;
@@ -36,7 +34,7 @@ static void reset_cb(void* user)
 
 void reset_pinfo(void)
 {
-	avl_traverse(pinfostore, reset_cb);
+	avl_traverse(cgctx->pinfostore, reset_cb);
 }
 
 struct pinfo* lookup_pinfo_of_pseudo(pseudo_t pseudo)
@@ -44,12 +42,11 @@ struct pinfo* lookup_pinfo_of_pseudo(pseudo_t pseudo)
 	struct pinfo key;
 	key.pseudo = pseudo;
 
-	struct pinfo* pinfo = avl_search(pinfostore, compare_cb, &key, 0);
+	struct pinfo* pinfo = avl_search(cgctx->pinfostore, compare_cb, &key, 0);
 	if (pinfo)
 		return pinfo;
 
-	pinfo = malloc(sizeof(struct pinfo));
-	memset(pinfo, 0, sizeof(struct pinfo));
+	pinfo = arena_alloc(current_arena, sizeof(struct pinfo));
 	pinfo->pseudo = pseudo;
 	pinfo->type = lookup_base_type_of_pseudo(pseudo);
 
@@ -71,6 +68,36 @@ struct pinfo* lookup_pinfo_of_pseudo(pseudo_t pseudo)
 			break;
 	}
 
-	avl_insert(&pinfostore, compare_cb, pinfo, NULL);
+	avl_insert(&cgctx->pinfostore, compare_cb, pinfo, NULL);
 	return pinfo;
 }
+
+static int pinfo_count;
+
+static void count_cb(void* user)
+{
+	pinfo_count++;
+}
+
+/* Returns the number of pseudos the current function has pinfos for. */
+
+int get_pinfo_count(void)
+{
+	pinfo_count = 0;
+	avl_traverse(cgctx->pinfostore, count_cb);
+	return pinfo_count;
+}
+
+static void discard_cb(void* user)
+{
+}
+
+/* Forgets all pinfos. They only describe the function being generated, so
+ * this happens at the end of each one; the pinfos themselves belong to the
+ * function arena. */
+
+void free_pinfo(void)
+{
+	avl_nuke(cgctx->pinfostore, discard_cb);
+	cgctx->pinfostore = NULL;
+}
@@ -0,0 +1,246 @@
+/* printf.c
+ * Compile-time printf specialisation
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+
+/* Nearly every call to printf() has a string constant as its format. For
+ * backends which support it, these calls are broken up at compile time into
+ * runs of literal text and single conversions, so the run-time never has to
+ * parse the format. Anything unusual --- widths or precisions taken from the
+ * arguments, %n, %p, arguments which don't match the format, or a format
+ * which isn't a constant --- is left to the run-time's own printf().
+ *
+ * printf()'s result is only known at run time, so calls which use it are
+ * also left alone.
+ */
+
+#define MAX_SPEC 32
+
+struct piece
+{
+	const char* text;        /* literal text, or NULL for a conversion */
+	int len;
+	const char* spec;        /* complete conversion specification */
+	int conversion;          /* final character of spec */
+	pseudo_t arg;
+};
+
+/* Returns the symbol a pseudo refers to, either directly or (after
+ * rewrite.c has been at it) through a copy. */
+
+static struct symbol* get_symbol_of_pseudo(pseudo_t pseudo)
+{
+	if (pseudo->type == PSEUDO_SYM)
+		return pseudo->sym;
+
+	if ((pseudo->type == PSEUDO_REG) && pseudo->def &&
+			(pseudo->def->opcode == OP_COPY) &&
+			(pseudo->def->src->type == PSEUDO_SYM))
+		return pseudo->def->src->sym;
+
+	return NULL;
+}
+
+/* Is this the libc printf(), rather than one the program defines? */
+
+static int is_printf(struct symbol* sym)
+{
+	if (!sym || !sym->ident || (sym->ctype.modifiers & MOD_STATIC))
+		return 0;
+	if (strcmp(show_ident(sym->ident), "printf") != 0)
+		return 0;
+
+	if (lookup_sinfo_of_symbol(sym)->here)
+		return 0;
+	if (linking && lookup_linkinfo_of_symbol(sym)->definition)
+		return 0;
+
+	return 1;
+}
+
+/* Parses a single conversion, starting just after the '%', into piece.
+ * Length modifiers are dropped, as all integers are the same size. Returns
+ * the number of characters consumed, or 0 if it's not one we handle. */
+
+static int parse_conversion(const char* format, int len, struct piece* piece)
+{
+	char spec[MAX_SPEC];
+	int speclen = 0;
+	int i = 0;
+
+	spec[speclen++] = '%';
+
+	while ((i < len) && strchr("-+ #0", format[i]) && (speclen < 8))
+		spec[speclen++] = format[i++];
+	while ((i < len) && isdigit(format[i]) && (speclen < 16))
+		spec[speclen++] = format[i++];
+	if ((i < len) && (format[i] == '.'))
+	{
+		spec[speclen++] = format[i++];
+		while ((i < len) && isdigit(format[i]) && (speclen < 24))
+			spec[speclen++] = format[i++];
+	}
+	while ((i < len) && strchr("hlLqjzt", format[i]))
+		i++;
+
+	if ((i == len) || !strchr("diouxXcseEfgG", format[i]))
+		return 0;
+
+	piece->conversion = format[i];
+	spec[speclen++] = format[i++];
+	spec[speclen] = '\0';
+	piece->text = NULL;
+	piece->spec = aprintf("%s", spec);
+	return i;
+}
+
+/* Returns the type of argument a conversion expects. */
+
+static int get_type_of_conversion(int conversion)
+{
+	switch (conversion)
+	{
+		case 's':
+			return TYPE_PTR;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'g':
+		case 'G':
+			return TYPE_FLOAT;
+
+		default:
+			return TYPE_INT;
+	}
+}
+
+/* If insn is a call to printf() which can be specialised, emits it and
+ * returns 1. Otherwise returns 0, and the caller should emit an ordinary
+ * call. */
+
+int generate_printf(struct instruction* insn)
+{
+	if (!cg->printf_text)
+		return 0;
+
+	if (insn->target && (insn->target != VOID) &&
+			ptr_list_size((struct ptr_list*) insn->target->users))
+		return 0;
+
+	if (!is_printf(get_symbol_of_pseudo(insn->func)))
+		return 0;
+
+	int numargs = ptr_list_size((struct ptr_list*) insn->arguments);
+	pseudo_t* args = arena_alloc(current_arena, numargs * sizeof(pseudo_t));
+	int i = 0;
+
+	pseudo_t arg;
+	FOR_EACH_PTR(insn->arguments, arg)
+	{
+		args[i++] = arg;
+	}
+	END_FOR_EACH_PTR(arg);
+
+	if (numargs == 0)
+		return 0;
+
+	struct symbol* sym = get_symbol_of_pseudo(args[0]);
+	if (!sym || !sym->string || !sym->initializer ||
+			(sym->initializer->type != EXPR_STRING))
+		return 0;
+
+	const char* format = sym->initializer->string->data;
+	int len = strnlen(format, sym->initializer->string->length);
+
+	/* Break the format up. There can't be more pieces than characters. */
+
+	struct piece* pieces = arena_alloc(current_arena,
+			(len + 1) * sizeof(struct piece));
+	char* text = arena_alloc(current_arena, len + 1);
+	int textlen = 0;
+	int numpieces = 0;
+	int nextarg = 1;
+
+	i = 0;
+	while (i < len)
+	{
+		char c = format[i++];
+		if (c != '%')
+		{
+			text[textlen++] = c;
+			continue;
+		}
+
+		if ((i < len) && (format[i] == '%'))
+		{
+			text[textlen++] = '%';
+			i++;
+			continue;
+		}
+
+		if (textlen > 0)
+		{
+			struct piece* piece = &pieces[numpieces++];
+			piece->text = text;
+			piece->len = textlen;
+			text += textlen;
+			textlen = 0;
+		}
+
+		struct piece* piece = &pieces[numpieces++];
+		int consumed = parse_conversion(format + i, len - i, piece);
+		if (!consumed || (nextarg == numargs))
+			return 0;
+		i += consumed;
+
+		piece->arg = args[nextarg++];
+		int type = get_base_type_of_pseudo(piece->arg);
+		if (type != get_type_of_conversion(piece->conversion))
+			return 0;
+	}
+
+	if (textlen > 0)
+	{
+		struct piece* piece = &pieces[numpieces++];
+		piece->text = text;
+		piece->len = textlen;
+	}
+
+	if (nextarg != numargs)
+		return 0;
+
+	/* The format is sound, so emit it. */
+
+	if (insn->target && (insn->target != VOID))
+	{
+		struct hardregref target;
+		create_hardregref(&target, insn->target);
+		cg->set_int(0, target.simple);
+	}
+
+	for (i = 0; i < numpieces; i++)
+	{
+		struct piece* piece = &pieces[i];
+
+		if (piece->text)
+			cg->printf_text(piece->text, piece->len);
+		else
+		{
+			struct hardregref hrf;
+			find_hardregref(&hrf, piece->arg);
+			cg->printf_conversion(piece->spec, piece->conversion, &hrf);
+		}
+	}
+
+	return 1;
+}
@@ -12,14 +12,6 @@
 
 #include "globals.h"
 
-static void wire_up_bb_list(struct basic_block_list *list,
-		unsigned long generation, int* sequence);
-
-struct hardreg stackbase_reg;
-struct hardreg stackoffset_reg;
-struct hardreg frameoffset_reg;
-struct hardreg hardregs[NUM_REGS];
-static struct pinfo_list* dying_pinfos = NULL;
 
 const static int type_to_regtype[] =
 {
@@ -35,22 +27,22 @@ void init_register_allocator(void)
 	int i;
 
 	for (i=0; i<NUM_REGS; i++)
-		hardregs[i].number = i;
+		cgctx->hardregs[i].number = i;
 
-	stackbase_reg.regclass = find_regclass_for_regtype(REGTYPE_OPTR);
-	stackoffset_reg.regclass = find_regclass_for_regtype(REGTYPE_INT);
-	frameoffset_reg.regclass = find_regclass_for_regtype(REGTYPE_INT);
+	cgctx->stackbase_reg.regclass = find_regclass_for_regtype(REGTYPE_OPTR);
+	cgctx->stackoffset_reg.regclass = find_regclass_for_regtype(REGTYPE_INT);
+	cgctx->frameoffset_reg.regclass = find_regclass_for_regtype(REGTYPE_INT);
 }
 
 /* Generate a string name of a hardreg. */
 
 const char* show_hardreg(struct hardreg* reg)
 {
-	if (reg == &stackbase_reg)
+	if (reg == &cgctx->stackbase_reg)
 		return cg->stackname;
-	else if (reg == &stackoffset_reg)
+	else if (reg == &cgctx->stackoffset_reg)
 		return cg->spname;
-	else if (reg == &frameoffset_reg)
+	else if (reg == &cgctx->frameoffset_reg)
 		return cg->fpname;
 	else
 		return cg->get_register_name(reg);
@@ -96,7 +88,7 @@ void reset_hardregs(void)
 	int i;
 	for (i = 0; i < NUM_REGS; i++)
 	{
-		struct hardreg* reg = &hardregs[i];
+		struct hardreg* reg = &cgctx->hardregs[i];
 
 		reg->busy = reg->dying = reg->used = 0;
 	}
@@ -109,7 +101,7 @@ void untouch_hardregs(void)
 	int i;
 	for (i = 0; i < NUM_REGS; i++)
 	{
-		struct hardreg* reg = &hardregs[i];
+		struct hardreg* reg = &cgctx->hardregs[i];
 
 		reg->name = NULL;
 		reg->regclass = NUM_REG_CLASSES;
@@ -160,7 +152,7 @@ struct hardreg* allocate_hardreg(int regtype)
 	int i;
 	for (i = 0; i < NUM_REGS; i++)
 	{
-		struct hardreg* reg = &hardregs[i];
+		struct hardreg* reg = &cgctx->hardregs[i];
 
 		if ((reg->busy == 0) &&
 			((reg->regclass == NUM_REG_CLASSES) ||
@@ -320,7 +312,7 @@ void mark_pseudo_as_dying(pseudo_t pseudo)
 	cg->comment("pseudo %s in hardregref %s is dying\n",
 			show_pseudo(pseudo), show_hardregref(&pinfo->reg));
 
-	add_ptr_list(&dying_pinfos, pinfo);
+	add_ptr_list(&cgctx->dying_pinfos, pinfo);
 }
 
 /* Finally kills any dying pseudos. */
@@ -328,7 +320,7 @@ void mark_pseudo_as_dying(pseudo_t pseudo)
 void kill_dying_pseudos(void)
 {
 	struct pinfo* pinfo;
-	FOR_EACH_PTR(dying_pinfos, pinfo)
+	FOR_EACH_PTR(cgctx->dying_pinfos, pinfo)
 	{
 		assert(pinfo->dying);
 
@@ -338,7 +330,7 @@ void kill_dying_pseudos(void)
 	}
 	END_FOR_EACH_PTR(pinfo);
 
-	free_ptr_list(&dying_pinfos);
+	free_ptr_list(&cgctx->dying_pinfos);
 }
 
 /* In order for basic blocks to talk to each other, we need to wire together
@@ -367,7 +359,7 @@ static void wire_up_storage_hash_list(struct storage_hash_list* list)
 				case REG_REG:
 					assert(0);
 					/* The front end wants this to be in a specific register. */
-					pinfo->wire = &hardregs[storage->regno];
+					pinfo->wire = &cgctx->hardregs[storage->regno];
 					printf("pseudo %s ==> hardreg %s (%p)\n",
 							show_pseudo(entry->pseudo),
 							show_hardreg(pinfo->wire), storage);
@@ -415,34 +407,21 @@ static void wire_up_storage_hash_list(struct storage_hash_list* list)
 
 }
 
-void wire_up_bb_recursively(struct basic_block* bb, unsigned long generation,
-		int* sequence)
-{
-	bb->generation = generation;
-
-	struct binfo* binfo = lookup_binfo_of_basic_block(bb);
-	binfo->id = *sequence;
-	(*sequence)++;
-
-	/* Ensure that the parent bbs of this one get generated first. */
+/* Wires up the storage of every block, parents before children. */
 
-	wire_up_bb_list(bb->parents, generation, sequence);
-	wire_up_storage_hash_list(gather_storage(bb, STOR_IN));
-	wire_up_storage_hash_list(gather_storage(bb, STOR_OUT));
-	wire_up_bb_list(bb->children, generation, sequence);
-}
-
-static void wire_up_bb_list(struct basic_block_list* list,
-		unsigned long generation, int* sequence)
+void wire_up_bbs(void)
 {
-	struct basic_block *bb;
-	FOR_EACH_PTR(list, bb)
+	struct binfo** binfolist;
+	int binfocount;
+	get_binfo_list(&binfolist, &binfocount);
+
+	int i;
+	for (i = 0; i < binfocount; i++)
 	{
-		if (bb->generation == generation)
-			continue;
-		wire_up_bb_recursively(bb, generation, sequence);
+		struct basic_block* bb = binfolist[i]->bb;
+		wire_up_storage_hash_list(gather_storage(bb, STOR_IN));
+		wire_up_storage_hash_list(gather_storage(bb, STOR_OUT));
 	}
-	END_FOR_EACH_PTR(bb);
 }
 
 /* Is this pseudo in a register? */
@@ -18,9 +18,6 @@
  * into more primitive forms so that the constants get loaded into their
  * own pseudos before use. */
 
-static void rewrite_bb_list(struct basic_block_list *list,
-		unsigned long generation);
-
 struct decompose
 {
 	struct instruction* insn;
@@ -178,7 +175,13 @@ static void rewrite_bb(struct basic_block* bb)
 					}
 				}
 
-				DECOMPOSE(insn->func, TYPE_ANY, sym);
+				/* Backends which support direct calls get to see the
+				 * function symbol itself. */
+
+				if (!cg->call_direct ||
+				    (insn->func->type != PSEUDO_SYM) ||
+				    (insn->func->sym->ctype.base_type->type != SYM_FN))
+					DECOMPOSE(insn->func, TYPE_ANY, sym);
 
 				struct symbol* type;
 				pseudo_t arg;
@@ -295,27 +298,15 @@ static void rewrite_bb(struct basic_block* bb)
 	END_FOR_EACH_PTR(insn);
 }
 
-void rewrite_bb_recursively(struct basic_block* bb, unsigned long generation)
-{
-	bb->generation = generation;
-
-	/* Ensure that the parent bbs of this one get generated first. */
-
-	rewrite_bb_list(bb->parents, generation);
-	rewrite_bb(bb);
-	rewrite_bb_list(bb->children, generation);
-}
+/* Rewrites every block, parents before children. */
 
-static void rewrite_bb_list(struct basic_block_list* list,
-		unsigned long generation)
+void rewrite_bbs(void)
 {
-	struct basic_block *bb;
-	FOR_EACH_PTR(list, bb)
-	{
-		if (bb->generation == generation)
-			continue;
-		rewrite_bb_recursively(bb, generation);
-	}
-	END_FOR_EACH_PTR(bb);
-}
+	struct binfo** binfolist;
+	int binfocount;
+	get_binfo_list(&binfolist, &binfocount);
 
+	int i;
+	for (i = 0; i < binfocount; i++)
+		rewrite_bb(binfolist[i]->bb);
+}
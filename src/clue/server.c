@@ -0,0 +1,205 @@
+/* server.c
+ * Compile server
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+/* In server mode, clue does all its backend-independent setup once and then
+ * listens on a Unix socket. Each request gets a forked copy of the
+ * initialized compiler, which compiles directly to the client's stdout and
+ * stderr and then exits.
+ *
+ * This only saves clue's start-up: the exec, and sparse's builtin types
+ * and predefined macros. sparse drops everything a file declares when the
+ * file ends, so headers can't be kept parsed, and each request still
+ * preprocesses and parses every header its file includes.
+ *
+ * A request (see client.c) carries the client's stdout and stderr as
+ * SCM_RIGHTS, followed by the client's working directory and arguments as
+ * a sequence of NUL-terminated strings, ending in an empty one. The server
+ * replies with a single byte, the exit status; if the compiler dies before
+ * that, the client just sees the connection close.
+ */
+
+#define MAX_REQUEST 65536
+
+/* Reads a request from the client; returns the number of bytes read. */
+
+static int read_request(int fd, char* buffer, int* outfd, int* errfd)
+{
+	union
+	{
+		struct cmsghdr align;
+		char data[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = MAX_REQUEST;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	int len = recvmsg(fd, &msg, 0);
+	if (len <= 0)
+		return -1;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) ||
+			(cmsg->cmsg_type != SCM_RIGHTS) ||
+			(cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))))
+		return -1;
+	memcpy(outfd, CMSG_DATA(cmsg), sizeof(int));
+	memcpy(errfd, (int*)CMSG_DATA(cmsg) + 1, sizeof(int));
+
+	/* The rest of the request may arrive in pieces. */
+
+	while ((len < 2) || buffer[len-1] || buffer[len-2])
+	{
+		if (len == MAX_REQUEST)
+			return -1;
+
+		int i = read(fd, buffer + len, MAX_REQUEST - len);
+		if (i <= 0)
+			return -1;
+		len += i;
+	}
+
+	return len;
+}
+
+/* Handles a single request. This runs in a forked child. */
+
+static int serve_request(int fd, struct symbol_list* symbols)
+{
+	static char buffer[MAX_REQUEST];
+	int outfd, errfd;
+
+	int len = read_request(fd, buffer, &outfd, &errfd);
+	if (len < 0)
+		return 1;
+
+	dup2(outfd, 1);
+	dup2(errfd, 2);
+	close(outfd);
+	close(errfd);
+
+	/* Unpack the working directory and arguments. */
+
+	static const char* argv[MAX_REQUEST/2];
+	int argc = 0;
+	char* p = buffer;
+
+	const char* cwd = p;
+	p += strlen(p) + 1;
+	if (chdir(cwd) == -1)
+		die("compile server can't change to %s: %s", cwd, strerror(errno));
+
+	argv[argc++] = "clue";
+	while (*p)
+	{
+		argv[argc++] = p;
+		p += strlen(p) + 1;
+	}
+	argv[argc] = NULL;
+
+	init_code_generator(&argc, argv);
+
+	/* sparse has already seen its own options, so only files are allowed
+	 * here. */
+
+	struct string_list* filelist = NULL;
+	int i;
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+			die("option %s is not supported by the compile server", argv[i]);
+		add_ptr_list_notag(&filelist, (char*) argv[i]);
+	}
+
+	int status = compile_program(symbols, filelist);
+	fflush(stdout);
+	fflush(stderr);
+
+	char c = status;
+	write(fd, &c, 1);
+	return status;
+}
+
+/* Runs the compile server; never returns unless something goes wrong. */
+
+int run_server(const char* path)
+{
+	init_compiler();
+
+	/* sparse only sets itself up once it's been given a file. This one is
+	 * never actually compiled. */
+
+	const char* argv[] = { "clue", "-", NULL };
+	struct string_list* filelist = NULL;
+	struct symbol_list* symbols = sparse_initialize(2, (char**) argv, &filelist);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1)
+		die("unable to create socket: %s", strerror(errno));
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		die("socket path %s is too long", path);
+	strcpy(addr.sun_path, path);
+
+	/* Only replace a stale socket, never anything else. */
+
+	struct stat st;
+	if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if ((bind(listener, (struct sockaddr*) &addr, sizeof(addr)) == -1) ||
+			(listen(listener, 16) == -1))
+		die("unable to listen on %s: %s", path, strerror(errno));
+
+	/* We don't care how the workers exit; the clients do. */
+
+	signal(SIGCHLD, SIG_IGN);
+
+	for (;;)
+	{
+		int fd = accept(listener, NULL, NULL);
+		if (fd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			die("unable to accept connection: %s", strerror(errno));
+		}
+
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(listener);
+
+			/* -j needs to be able to wait for its workers. */
+			signal(SIGCHLD, SIG_DFL);
+			exit(serve_request(fd, symbols));
+		}
+
+		close(fd);
+	}
+}
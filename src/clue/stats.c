@@ -0,0 +1,255 @@
+/* stats.c
+ * Compiler phase timings and counters
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#include "globals.h"
+#include <time.h>
+
+/* With --stats (or -ftime-report), the wall time spent in each phase of
+ * the compiler and the number of bytes allocated from the arenas during it
+ * are added up, along with some counts for each function generated, and
+ * printed on stderr at the end, either as a table or as JSON.
+ *
+ * Phase times are inclusive: if a phase is entered while another is
+ * running (such as a flush during the initializer), both are charged.
+ */
+
+struct phase
+{
+	const char* name;
+	int depth;
+	double started;
+	size_t allocated_at_start;
+	double time;
+	size_t allocated;
+	int count;
+};
+
+struct function_stats
+{
+	const char* name;
+	int instructions;
+	int pseudos;
+	int bbs;
+	int hardregs;
+};
+
+int stats_format = STATS_NONE;
+FILE* stats_file = NULL;
+
+static struct phase phases[PHASE__MAX] =
+{
+	[PHASE_PARSE] =       { "parse" },
+	[PHASE_LINEARIZE] =   { "linearize" },
+	[PHASE_REWRITE] =     { "rewrite" },
+	[PHASE_DEATH] =       { "track_pseudo_death" },
+	[PHASE_STORAGE] =     { "set_up_storage" },
+	[PHASE_WIREUP] =      { "wire_up" },
+	[PHASE_CODEGEN] =     { "codegen" },
+	[PHASE_INITIALIZER] = { "emit_initializer" },
+	[PHASE_FLUSH] =       { "flush" },
+};
+
+static struct function_stats* functions = NULL;
+static int function_count = 0;
+static int function_size = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static size_t allocated(void)
+{
+	return program_arena.allocated + function_arena.allocated;
+}
+
+void phase_start(int phase)
+{
+	struct phase* p = &phases[phase];
+
+	if (!stats_format)
+		return;
+
+	if (p->depth++ == 0)
+	{
+		p->started = now();
+		p->allocated_at_start = allocated();
+	}
+}
+
+void phase_end(int phase)
+{
+	struct phase* p = &phases[phase];
+
+	if (!stats_format)
+		return;
+
+	assert(p->depth > 0);
+	if (--p->depth == 0)
+	{
+		p->time += now() - p->started;
+		p->allocated += allocated() - p->allocated_at_start;
+		p->count++;
+	}
+}
+
+/* Records the counters for a function. This must be called before its
+ * pinfos and binfos are thrown away. */
+
+void record_function_stats(struct entrypoint* ep)
+{
+	if (!stats_format)
+		return;
+
+	if (function_count == function_size)
+	{
+		function_size = function_size ? (function_size * 2) : 64;
+		functions = realloc(functions,
+				function_size * sizeof(struct function_stats));
+	}
+
+	struct function_stats* f = &functions[function_count++];
+	memset(f, 0, sizeof(*f));
+	f->name = arena_printf(&program_arena, "%s",
+			show_symbol_mangled(ep->name));
+	f->pseudos = get_pinfo_count();
+
+	struct basic_block* bb;
+	FOR_EACH_PTR(ep->bbs, bb)
+	{
+		struct instruction* insn;
+
+		f->bbs++;
+		FOR_EACH_PTR(bb->insns, insn)
+		{
+			if (insn->bb)
+				f->instructions++;
+		}
+		END_FOR_EACH_PTR(insn);
+	}
+	END_FOR_EACH_PTR(bb);
+
+	int i;
+	for (i = 0; i < NUM_REGS; i++)
+		if (cgctx->hardregs[i].touched)
+			f->hardregs++;
+}
+
+static void report_text(FILE* fp)
+{
+	int i;
+
+	fprintf(fp, "clue: %-20s %6s %12s %14s\n",
+			"phase", "calls", "time (ms)", "allocated");
+	for (i = 0; i < PHASE__MAX; i++)
+	{
+		struct phase* p = &phases[i];
+		fprintf(fp, "clue: %-20s %6d %12.3f %14lu\n",
+				p->name, p->count, p->time * 1000.0,
+				(unsigned long) p->allocated);
+	}
+
+	if (function_count == 0)
+		return;
+
+	fprintf(fp, "clue:\n");
+	fprintf(fp, "clue: %-32s %8s %8s %6s %8s\n",
+			"function", "insns", "pseudos", "bbs", "hardregs");
+	for (i = 0; i < function_count; i++)
+	{
+		struct function_stats* f = &functions[i];
+		fprintf(fp, "clue: %-32s %8d %8d %6d %8d\n",
+				f->name, f->instructions, f->pseudos, f->bbs, f->hardregs);
+	}
+}
+
+static void report_json(FILE* fp)
+{
+	int i;
+
+	fprintf(fp, "{\n  \"backend\": \"%s\",\n  \"phases\": {\n", cg_name);
+	for (i = 0; i < PHASE__MAX; i++)
+	{
+		struct phase* p = &phases[i];
+		fprintf(fp, "    \"%s\": { \"calls\": %d, \"time_ms\": %.3f, "
+				"\"allocated\": %lu }%s\n",
+				p->name, p->count, p->time * 1000.0,
+				(unsigned long) p->allocated,
+				(i == (PHASE__MAX-1)) ? "" : ",");
+	}
+	fprintf(fp, "  },\n  \"functions\": [\n");
+
+	/* Mangled names are C identifiers, so don't need escaping. */
+
+	for (i = 0; i < function_count; i++)
+	{
+		struct function_stats* f = &functions[i];
+		fprintf(fp, "    { \"name\": \"%s\", \"instructions\": %d, "
+				"\"pseudos\": %d, \"bbs\": %d, \"hardregs\": %d }%s\n",
+				f->name, f->instructions, f->pseudos, f->bbs, f->hardregs,
+				(i == (function_count-1)) ? "" : ",");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+/* Prints everything collected, if --stats was given, to stats_file or, if
+ * that's not set, stderr. JSON is always an array with one report per
+ * backend; when there are several, stats_file is set and
+ * report_combined_stats() supplies the array. */
+
+void report_stats(void)
+{
+	FILE* fp = stats_file ? stats_file : stderr;
+
+	switch (stats_format)
+	{
+		case STATS_TEXT:
+			report_text(fp);
+			break;
+
+		case STATS_JSON:
+			if (!stats_file)
+				fprintf(fp, "[\n");
+			report_json(fp);
+			if (!stats_file)
+				fprintf(fp, "]\n");
+			break;
+	}
+
+	fflush(fp);
+}
+
+/* With several backends, each one reports into a file of its own; this
+ * copies them to stderr in order, gathering JSON reports into the array. */
+
+void report_combined_stats(FILE** files, int count)
+{
+	char buffer[4096];
+	size_t len;
+	int i;
+
+	if (stats_format == STATS_JSON)
+		fprintf(stderr, "[\n");
+	for (i = 0; i < count; i++)
+	{
+		if ((stats_format == STATS_JSON) && (i > 0))
+			fprintf(stderr, ",\n");
+
+		rewind(files[i]);
+		while ((len = fread(buffer, 1, sizeof(buffer), files[i])) > 0)
+			fwrite(buffer, 1, len, stderr);
+	}
+	if (stats_format == STATS_JSON)
+		fprintf(stderr, "]\n");
+}
@@ -19,6 +19,7 @@
  */
 
 static avltree_t symbolstore = NULL;
+static int static_count = 0;
 
 static int compare_cb(const void* lhs, const void* rhs)
 {
@@ -41,7 +42,7 @@ struct sinfo* lookup_sinfo_of_symbol(struct symbol* sym)
 	struct sinfo* data = avl_search(symbolstore, compare_cb, &key, 0);
 	if (!data)
 	{
-		data = calloc(sizeof(struct sinfo), 1);
+		data = arena_alloc(&program_arena, sizeof(struct sinfo));
 		data->sym = sym;
 		avl_insert(&symbolstore, compare_cb, data, NULL);
 
@@ -60,14 +61,13 @@ struct sinfo* lookup_sinfo_of_symbol(struct symbol* sym)
 
 		if (sym->ctype.modifiers & MOD_STATIC)
 		{
-			static int count = 0;
-
 			data->here = 1;
-			data->name = aprintf("static_%d_%d_%s", unique, count, ident);
-			count++;
+			data->name = arena_printf(&program_arena, "static_%d_%d_%s",
+					unique, static_count, ident);
+			static_count++;
 		}
 		else
-			data->name = aprintf("_%s", ident);
+			data->name = arena_printf(&program_arena, "_%s", ident);
 	}
 
 	return data;
@@ -78,3 +78,20 @@ const char* show_symbol_mangled(struct symbol* sym)
 	struct sinfo* node = lookup_sinfo_of_symbol(sym);
 	return node->name;
 }
+
+/* Called at the start of each input file. 'unique' goes up with every file,
+ * so statics can be numbered from zero in each one; that way their names
+ * don't depend on anything in the other files, which -j relies on.
+ */
+
+void start_file(const char* filename)
+{
+	const unsigned char* p = (const unsigned char*) filename;
+	do
+	{
+		unique += *p;
+	}
+	while (*p++);
+
+	static_count = 0;
+}
@@ -18,7 +18,7 @@
  * in the pinfo structure.
  */
 
-int get_base_type_of_symbol(struct symbol* s)
+static int find_base_type_of_symbol(struct symbol* s)
 {
 	assert(s);
 	if (!s)
@@ -47,10 +47,95 @@ int get_base_type_of_symbol(struct symbol* s)
 
 	s = s->ctype.base_type;
 	if (s)
-		return get_base_type_of_symbol(s);
+		return find_base_type_of_symbol(s);
 	assert(0);
 }
 
+/* Symbols' types are looked up a lot, and finding one can mean following a
+ * long chain of base types, so the answers are remembered in a small
+ * direct-mapped cache. sparse never frees symbols, so entries can't go
+ * stale. */
+
+#define SYMBOL_TYPE_CACHE_SIZE 1024
+
+static struct
+{
+	struct symbol* sym;
+	int type;
+}
+symbol_type_cache[SYMBOL_TYPE_CACHE_SIZE];
+
+int get_base_type_of_symbol(struct symbol* s)
+{
+	unsigned int hash = ((size_t) s >> 4) % SYMBOL_TYPE_CACHE_SIZE;
+
+	if (s && (symbol_type_cache[hash].sym == s))
+		return symbol_type_cache[hash].type;
+
+	int type = find_base_type_of_symbol(s);
+	symbol_type_cache[hash].sym = s;
+	symbol_type_cache[hash].type = type;
+	return type;
+}
+
+/* With --packed-chars, arrays of chars (including strings and arrays of
+ * arrays of chars) are stored one byte per cell by backends that can, rather
+ * than in general-purpose memory. Returns PACKED_SIGNED or PACKED_UNSIGNED
+ * for such an array, according to its element type, or 0 otherwise. */
+
+int packed_chars = 0;
+
+int get_packed_array_type(struct symbol* sym)
+{
+	if (!packed_chars)
+		return 0;
+
+	struct symbol* type = get_base_type(sym);
+	while (type && (type->type == SYM_NODE))
+		type = get_base_type(type);
+	if (!type || (type->type != SYM_ARRAY))
+		return 0;
+
+	while (type && ((type->type == SYM_ARRAY) || (type->type == SYM_NODE)))
+		type = get_base_type(type);
+
+	if (type == &uchar_ctype)
+		return PACKED_UNSIGNED;
+	if ((type == &char_ctype) || (type == &schar_ctype))
+		return PACKED_SIGNED;
+	return 0;
+}
+
+/* Works out the types of the current function's arguments in one go, so
+ * that they don't each have to be found by walking the argument list. */
+
+void set_up_argument_types(struct entrypoint* ep)
+{
+	struct symbol* function = get_base_type(ep->name);
+	int count = ptr_list_size((struct ptr_list*) function->arguments);
+
+	cgctx->argtypes_ep = ep;
+	cgctx->argtypes = arena_alloc(current_arena, count * sizeof(int));
+	cgctx->argcount = count;
+
+	int i = 0;
+	struct symbol* type;
+	FOR_EACH_PTR(function->arguments, type)
+	{
+		cgctx->argtypes[i++] = get_base_type_of_symbol(type);
+	}
+	END_FOR_EACH_PTR(type);
+}
+
+/* Forgets the argument types at the end of the function. */
+
+void reset_argument_types(void)
+{
+	cgctx->argtypes_ep = NULL;
+	cgctx->argtypes = NULL;
+	cgctx->argcount = 0;
+}
+
 static int get_base_type_of_instruction(struct instruction* insn)
 {
 	pseudo_t p;
@@ -204,12 +289,17 @@ int lookup_base_type_of_pseudo(pseudo_t pseudo)
 
 			struct entrypoint* ep = pseudo->def->bb->ep;
 
+			if ((ep == cgctx->argtypes_ep) && (pseudo->nr >= 1) &&
+					(pseudo->nr <= cgctx->argcount))
+				return cgctx->argtypes[pseudo->nr - 1];
+
 			/* Now find the function symbol itself (which has the argument
 			 * data attached to it). */
 
 			struct symbol* function = get_base_type(ep->name);
 
-			/* Iterate through the arguments until we find this one. */
+			/* Otherwise, iterate through the arguments until we find this
+			 * one. */
 
 			int count = 0;
 			struct symbol* type;
@@ -13,20 +13,6 @@
 #include "globals.h"
 #include <stdarg.h>
 
-struct zprintnode
-{
-	struct zprintnode* next;
-	char* value;
-};
-
-struct zbuffer
-{
-	struct zprintnode* zfirst;
-	struct zprintnode* zlast;
-};
-
-static struct zbuffer zbuffers[ZBUFFER__MAX];
-static struct zbuffer* currentbuffer = &zbuffers[ZBUFFER_CODE];
 
 const char* show_value(struct expression* expr)
 {
@@ -43,13 +29,15 @@ const char* show_value(struct expression* expr)
 	}
 }
 
+/* Allocates from the current arena, so the result needn't be freed. */
+
 const char* aprintf(const char* fmt, ...)
 {
-	char* p;
+	const char* p;
 
 	va_list ap;
 	va_start(ap, fmt);
-	vasprintf(&p, fmt, ap);
+	p = arena_vprintf(current_arena, fmt, ap);
 	va_end(ap);
 
 	return p;
@@ -65,28 +53,32 @@ void zprintf(const char* format, ...)
 
 void zvprintf(const char* format, va_list ap)
 {
-	if (!currentbuffer)
+	if (!cgctx->currentbuffer)
 		vprintf(format, ap);
 	else
 	{
 		struct zprintnode* node = malloc(sizeof(struct zprintnode));
 		node->next = NULL;
 		vasprintf(&node->value, format, ap);
+		cgctx->currentbuffer->size += strlen(node->value);
 
-		if (currentbuffer->zlast)
-			currentbuffer->zlast->next = node;
-		currentbuffer->zlast = node;
+		if (cgctx->currentbuffer->zlast)
+			cgctx->currentbuffer->zlast->next = node;
+		cgctx->currentbuffer->zlast = node;
 
-		if (!currentbuffer->zfirst)
-			currentbuffer->zfirst = node;
+		if (!cgctx->currentbuffer->zfirst)
+			cgctx->currentbuffer->zfirst = node;
 	}
 }
 
 void zflush(int buffer)
 {
-	struct zbuffer* buf = currentbuffer;
+	struct zbuffer* buf = cgctx->currentbuffer;
 	zsetbuffer(buffer);
 
+	if (buffer == ZBUFFER_STDOUT)
+		phase_start(PHASE_FLUSH);
+
 	while (buf->zfirst)
 	{
 		struct zprintnode* node = buf->zfirst;
@@ -99,18 +91,58 @@ void zflush(int buffer)
 	}
 
 	buf->zfirst = buf->zlast = NULL;
+	buf->size = 0;
+
+	if (buffer == ZBUFFER_STDOUT)
+		phase_end(PHASE_FLUSH);
+}
+
+/* Returns the number of bytes waiting in the current buffer. */
+
+size_t zsize(void)
+{
+	if (!cgctx->currentbuffer)
+		return 0;
+	return cgctx->currentbuffer->size;
+}
+
+/* Removes everything from the current buffer and returns it as a string. */
+
+const char* zstring(void)
+{
+	struct zbuffer* buf = cgctx->currentbuffer;
+	assert(buf);
+
+	char* s = malloc(buf->size + 1);
+	char* p = s;
+	while (buf->zfirst)
+	{
+		struct zprintnode* node = buf->zfirst;
+		buf->zfirst = node->next;
+
+		strcpy(p, node->value);
+		p += strlen(p);
+
+		free(node->value);
+		free(node);
+	}
+	*p = '\0';
+
+	buf->zfirst = buf->zlast = NULL;
+	buf->size = 0;
+	return s;
 }
 
 void zsetbuffer(int buffer)
 {
 	if (buffer == ZBUFFER_STDOUT)
-		currentbuffer = NULL;
+		cgctx->currentbuffer = NULL;
 	else
 	{
 		assert(buffer >= 0);
 		assert(buffer < ZBUFFER__MAX);
 
-		currentbuffer = &zbuffers[buffer];
+		cgctx->currentbuffer = &cgctx->zbuffers[buffer];
 	}
 }
 
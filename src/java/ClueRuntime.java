@@ -11,12 +11,30 @@
  */
 
 import java.lang.System;
+import java.io.File;
+import java.io.FileDescriptor;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.io.RandomAccessFile;
+import java.util.Arrays;
+import java.util.HashMap;
 import java.util.Vector;
 
 class ClueRuntime
 {
+	/* Calls through function pointers, and to variadic functions, pass
+	 * their arguments and results here. Everything else is a direct call. */
+	
 	protected static final ClueMemory args = new ClueMemory(64);
 	
+	/* Functions returning pointers return the offset and leave the base
+	 * here. */
+	
+	protected static ClueMemory retbase;
+	
 	protected static final class RegPair
 	{
 		final int i;
@@ -29,19 +47,23 @@ class ClueRuntime
 		}
 	};
 	
+	/* Most memory only ever holds numbers, so the pointer arrays are only
+	 * created the first time a non-null pointer is stored. Until then they
+	 * are null and reads return null. Numbers may be accessed directly via
+	 * doubledata; pointers must go through the accessors. */
+	
 	public static final class ClueMemory
 	{
 		final int length;
 		final double[] doubledata;
-		final ClueMemory[] objectdata;
-		final ClueRunnable[] functiondata;
+		ClueMemory[] objectdata;
+		ClueRunnable[] functiondata;
+		String[] strings;    /* conversions of string constants */
 		
 		public ClueMemory(int size)
 		{
 			length = size;
 			doubledata = new double[size];
-			objectdata = new ClueMemory[size];
-			functiondata = new ClueRunnable[size];
 		}
 		
 		int intOf(int index)
@@ -51,8 +73,39 @@ class ClueRuntime
 		
 		ClueMemory objectOf(int index)
 		{
+			if (objectdata == null)
+				return null;
 			return objectdata[index];
 		}
+		
+		ClueRunnable functionOf(int index)
+		{
+			if (functiondata == null)
+				return null;
+			return functiondata[index];
+		}
+		
+		void setObject(int index, ClueMemory value)
+		{
+			if (objectdata == null)
+			{
+				if (value == null)
+					return;
+				objectdata = new ClueMemory[length];
+			}
+			objectdata[index] = value;
+		}
+		
+		void setFunction(int index, ClueRunnable value)
+		{
+			if (functiondata == null)
+			{
+				if (value == null)
+					return;
+				functiondata = new ClueRunnable[length];
+			}
+			functiondata[index] = value;
+		}
 	};
 	
 	protected static class ClueRunnable
@@ -73,121 +126,166 @@ class ClueRuntime
 		return pd;
 	}
 	
-	private static final String ptrToString(int formatpo, ClueMemory formatpd)
+	/* Initializer constants are packed into strings, either as one
+	 * character per value (for small integers) or as the four 16-bit
+	 * chunks of each value's bit pattern, most significant first. */
+	
+	protected static final void unpackChars(ClueMemory pd, int po, String s)
 	{
-		int i = (int) formatpo;
-		StringBuffer s = new StringBuffer();
-		
-		for (;;)
+		for (int i=0; i<s.length(); i++)
+			pd.doubledata[po + i] = (double) s.charAt(i);
+	}
+	
+	protected static final void unpackDoubles(ClueMemory pd, int po, String s)
+	{
+		for (int i=0; i<s.length(); i += 4)
 		{
-			int c = formatpd.intOf(i++);
-			if (c == 0)
-				break;
-			
-			s.append((char) c);
+			long bits = ((long) s.charAt(i) << 48) |
+				((long) s.charAt(i+1) << 32) |
+				((long) s.charAt(i+2) << 16) |
+				(long) s.charAt(i+3);
+			pd.doubledata[po + i/4] = Double.longBitsToDouble(bits);
 		}
+	}
+	
+	/* Conversions of a string constant are kept in the memory itself, one
+	 * per offset. */
+	
+	protected static final ClueMemory newLiteral(int size)
+	{
+		ClueMemory pd = new ClueMemory(size);
+		pd.strings = new String[size];
+		return pd;
+	}
+	
+	private static final String ptrToString(int po, ClueMemory pd)
+	{
+		if ((pd.strings != null) && (pd.strings[po] != null))
+			return pd.strings[po];
+		
+		double[] data = pd.doubledata;
+		int end = po;
+		while (data[end] != 0)
+			end++;
+		
+		char[] chars = new char[end - po];
+		for (int i=0; i<chars.length; i++)
+			chars[i] = (char) data[po + i];
+		String s = new String(chars);
 		
-		return s.toString();
+		if (pd.strings != null)
+			pd.strings[po] = s;
+		return s;
 	}
 	
-	protected static final ClueRunnable _malloc = new ClueRunnable()
+	protected static final double _malloc(double sp, ClueMemory stack,
+			double size)
 	{
-		public void run()
-		{
-			int size = args.intOf(2);
-			
-			args.doubledata[0] = 0;
-			args.objectdata[1] = new ClueMemory(size); 
-		}
-	};
+		retbase = new ClueMemory((int) size);
+		return 0;
+	}
 	
-	protected static final ClueRunnable _calloc = new ClueRunnable()
+	protected static final double _calloc(double sp, ClueMemory stack,
+			double x, double y)
 	{
-		public void run()
-		{
-			int x = args.intOf(2);
-			int y = args.intOf(3);
-			
-			args.doubledata[0] = 0;
-			args.objectdata[1] = new ClueMemory(x*y); 
-		}
-	};
+		retbase = new ClueMemory((int) x * (int) y);
+		return 0;
+	}
 	
-	protected static final ClueRunnable _free = new ClueRunnable()
+	protected static final void _free(double sp, ClueMemory stack,
+			double po, ClueMemory pd)
 	{
-		public void run()
-		{
-			/* Yes, intentionally a noop. */
-		}
-	};
+		/* Yes, intentionally a noop. */
+	}
 	
-	protected static final ClueRunnable _memset = new ClueRunnable()
+	protected static final double _memset(double sp, ClueMemory stack,
+			double destpo, ClueMemory pd, double c, double n)
 	{
-		public void run()
-		{
-			int po = args.intOf(2);
-			ClueMemory pd = args.objectOf(3);
-			int c = args.intOf(4);
-			int n = args.intOf(5);
-			
-			while (n > 0)
-			{
-				pd.doubledata[po] = c;
-				pd.objectdata[po] = null;
-				pd.functiondata[po] = null;
-				po++;
-				n--;
-			}
-			
-			args.doubledata[0] = args.intOf(2);
-			args.objectdata[1] = args.objectOf(3);
-		}
-	};
+		int po = (int) destpo;
+		int end = po + (int) n;
+		
+		Arrays.fill(pd.doubledata, po, end, c);
+		if (pd.objectdata != null)
+			Arrays.fill(pd.objectdata, po, end, null);
+		if (pd.functiondata != null)
+			Arrays.fill(pd.functiondata, po, end, null);
+		
+		retbase = pd;
+		return destpo;
+	}
 	
-	protected static final ClueRunnable _gettimeofday = new ClueRunnable()
+	protected static final double _memcpy(double sp, ClueMemory stack,
+			double destpo, ClueMemory destpd, double srcpo, ClueMemory srcpd,
+			double n)
 	{
-		public void run()
+		int d = (int) destpo;
+		int s = (int) srcpo;
+		int count = (int) n;
+		
+		System.arraycopy(srcpd.doubledata, s, destpd.doubledata, d, count);
+		
+		if (srcpd.objectdata != null)
 		{
-			int tvpo = args.intOf(2);
-			ClueMemory tvpd = args.objectdata[3];
-			
-			long t = System.currentTimeMillis();
-			tvpd.doubledata[tvpo+0] = (int) (t / 1000);
-			tvpd.doubledata[tvpo+1] = (int) ((t % 1000) * 1000);
-			
-			args.doubledata[0] = 0;
+			if (destpd.objectdata == null)
+				destpd.objectdata = new ClueMemory[destpd.length];
+			System.arraycopy(srcpd.objectdata, s, destpd.objectdata, d, count);
 		}
-	};
+		else if (destpd.objectdata != null)
+			Arrays.fill(destpd.objectdata, d, d + count, null);
+		
+		if (srcpd.functiondata != null)
+		{
+			if (destpd.functiondata == null)
+				destpd.functiondata = new ClueRunnable[destpd.length];
+			System.arraycopy(srcpd.functiondata, s, destpd.functiondata, d,
+					count);
+		}
+		else if (destpd.functiondata != null)
+			Arrays.fill(destpd.functiondata, d, d + count, null);
+		
+		retbase = destpd;
+		return destpo;
+	}
 	
-	protected static final ClueRunnable _strcpy = new ClueRunnable()
+	protected static final double _gettimeofday(double sp, ClueMemory stack,
+			double tvpo, ClueMemory tvpd, double tzpo, ClueMemory tzpd)
 	{
-		public void run()
+		int po = (int) tvpo;
+		
+		long t = System.currentTimeMillis();
+		tvpd.doubledata[po+0] = (int) (t / 1000);
+		tvpd.doubledata[po+1] = (int) ((t % 1000) * 1000);
+		
+		return 0;
+	}
+	
+	protected static final double _strcpy(double sp, ClueMemory stack,
+			double destpo, ClueMemory destpd, double srcpo, ClueMemory srcpd)
+	{
+		int d = (int) destpo;
+		int s = (int) srcpo;
+		
+		for (;;)
 		{
-			int destpo = args.intOf(2);
-			ClueMemory destpd = args.objectdata[3];
-			int srcpo = args.intOf(4);
-			ClueMemory srcpd = args.objectdata[5];
+			int c = srcpd.intOf(s++);
+			destpd.doubledata[d++] = c;
 			
-			for (;;)
-			{
-				int c = srcpd.intOf(srcpo++);
-				destpd.doubledata[destpo++] = c;
-				
-				if (c == 0)
-					break;
-			}
-			
-			args.doubledata[0] = destpo;
-			args.objectdata[1] = destpd;
+			if (c == 0)
+				break;
 		}
-	};
+		
+		retbase = destpd;
+		return destpo;
+	}
+	
+	/* printf is variadic, so it still uses the args ABI. */
 	
 	protected static final ClueRunnable _printf = new ClueRunnable()
 	{
 		public void run()
 		{
 			int formatpo = args.intOf(2);
-			ClueMemory formatpd = args.objectdata[3];
+			ClueMemory formatpd = args.objectOf(3);
 			String format = ptrToString(formatpo, formatpd);
 
 			Vector<Object> outargs = new Vector<Object>();
@@ -221,7 +319,7 @@ class ClueRuntime
 							case 's':
 							{
 								int po = args.intOf(argindex++);
-								ClueMemory pd = args.objectdata[argindex++];
+								ClueMemory pd = args.objectOf(argindex++);
 								outargs.add(ptrToString(po, pd));
 								break innerloop;
 							}
@@ -255,80 +353,455 @@ class ClueRuntime
 				}
 			}
 			
-			System.out.printf(format, outargs.toArray());
+			writeString(openFiles.get(__stdout),
+					String.format(format, outargs.toArray()));
 			args.doubledata[0] = 0;
 		}
 	};
 	
-	protected static final ClueRunnable _atol = new ClueRunnable()
+	/* printf helpers. All numbers arrive as doubles, so integers are
+	 * converted back before String.format() sees them. */
+	
+	protected static final void printfText(String s)
 	{
-		public void run()
+		writeString(openFiles.get(__stdout), s);
+	}
+	
+	protected static final void printfInt(String spec, double v)
+	{
+		writeString(openFiles.get(__stdout),
+				String.format(spec, Integer.valueOf((int) v)));
+	}
+	
+	protected static final void printfReal(String spec, double v)
+	{
+		writeString(openFiles.get(__stdout),
+				String.format(spec, Double.valueOf(v)));
+	}
+	
+	protected static final void printfString(String spec, double po,
+			ClueMemory pd)
+	{
+		String s = ptrToString((int) po, pd);
+		if (!spec.equals("%s"))
+			s = String.format(spec, s);
+		writeString(openFiles.get(__stdout), s);
+	}
+	
+	/* A FILE is a ClueMemory used only for its identity; its state lives in
+	 * a ClueFile. The buffer is Clue memory, one byte per cell, which is
+	 * handed to the host a chunk at a time. It holds either output or
+	 * input, never both. */
+	
+	private static final int CLUE_BUFSIZ = 4096;
+	
+	private static final class ClueFile
+	{
+		RandomAccessFile file;
+		InputStream in;
+		OutputStream out;
+		final ClueMemory buffer = new ClueMemory(CLUE_BUFSIZ);
+		final byte[] bytes = new byte[CLUE_BUFSIZ];
+		int count;    /* bytes in the buffer */
+		int pos;      /* next byte to be read */
+		boolean writing;
+		boolean eof;
+		boolean unbuffered;
+	};
+	
+	private static final HashMap<ClueMemory, ClueFile> openFiles =
+		new HashMap<ClueMemory, ClueFile>();
+	
+	private static final ClueMemory newFile(ClueFile f)
+	{
+		ClueMemory fp = new ClueMemory(1);
+		openFiles.put(fp, f);
+		return fp;
+	}
+	
+	private static final ClueMemory newStream(InputStream in, OutputStream out,
+			boolean unbuffered)
+	{
+		ClueFile f = new ClueFile();
+		f.in = in;
+		f.out = out;
+		f.unbuffered = unbuffered;
+		return newFile(f);
+	}
+	
+	protected static final ClueMemory __stdin = newStream(
+			new FileInputStream(FileDescriptor.in), null, false);
+	protected static final ClueMemory __stdout = newStream(
+			null, new FileOutputStream(FileDescriptor.out), false);
+	protected static final ClueMemory __stderr = newStream(
+			null, new FileOutputStream(FileDescriptor.err), true);
+	
+	/* Hands any pending output to the host, or discards any pending
+	 * input. */
+	
+	private static final int flush(ClueFile f)
+	{
+		int result = 0;
+		
+		if (f.writing && (f.count > 0))
 		{
-			int formatpo = args.intOf(2);
-			ClueMemory formatpd = args.objectdata[3];
-			String s = ptrToString(formatpo, formatpd);
-
-			args.doubledata[0] = Integer.valueOf(s);
+			for (int i=0; i<f.count; i++)
+				f.bytes[i] = (byte) f.buffer.intOf(i);
+			
+			try
+			{
+				if (f.file != null)
+					f.file.write(f.bytes, 0, f.count);
+				else
+				{
+					f.out.write(f.bytes, 0, f.count);
+					f.out.flush();
+				}
+			}
+			catch (IOException e)
+			{
+				result = -1;
+			}
 		}
-	};
+		
+		f.count = 0;
+		f.pos = 0;
+		f.writing = false;
+		return result;
+	}
 	
-	protected static final ClueRunnable _sin = new ClueRunnable()
+	private static final void flushAll()
 	{
-		public void run()
+		for (ClueFile f : openFiles.values())
+			flush(f);
+	}
+	
+	/* Refills an empty input buffer, after making sure any prompt on
+	 * stdout has appeared. */
+	
+	private static final boolean fill(ClueFile f)
+	{
+		if (f.eof)
+			return false;
+		if (f.writing)
+			flush(f);
+		if (f == openFiles.get(__stdin))
+			flush(openFiles.get(__stdout));
+		
+		int len;
+		try
 		{
-			args.doubledata[0] = Math.sin(args.doubledata[2]);
+			if (f.file != null)
+				len = f.file.read(f.bytes, 0, CLUE_BUFSIZ);
+			else
+				len = f.in.read(f.bytes, 0, CLUE_BUFSIZ);
 		}
-	};
+		catch (IOException e)
+		{
+			len = -1;
+		}
+		
+		if (len <= 0)
+		{
+			f.eof = true;
+			return false;
+		}
+		
+		for (int i=0; i<len; i++)
+			f.buffer.doubledata[i] = f.bytes[i] & 0xff;
+		f.count = len;
+		f.pos = 0;
+		return true;
+	}
 	
-	protected static final ClueRunnable _cos = new ClueRunnable()
+	private static final int getc(ClueFile f)
 	{
-		public void run()
+		if ((f.pos == f.count) || f.writing)
 		{
-			args.doubledata[0] = Math.cos(args.doubledata[2]);
+			if (!fill(f))
+				return -1;
 		}
-	};
+		
+		return f.buffer.intOf(f.pos++);
+	}
+	
+	/* Makes room for at least one byte of output. */
 	
-	protected static final ClueRunnable _atan = new ClueRunnable()
+	private static final void startWrite(ClueFile f)
 	{
-		public void run()
+		if (!f.writing)
 		{
-			args.doubledata[0] = Math.atan(args.doubledata[2]);
+			f.count = 0;
+			f.pos = 0;
 		}
-	};
+		else if (f.count == CLUE_BUFSIZ)
+			flush(f);
+		f.writing = true;
+	}
 	
-	protected static final ClueRunnable _log = new ClueRunnable()
+	private static final void writeBytes(ClueFile f, ClueMemory pd, int po,
+			int len)
 	{
-		public void run()
+		int done = 0;
+		while (done < len)
 		{
-			args.doubledata[0] = Math.log(args.doubledata[2]);
+			startWrite(f);
+			
+			int chunk = Math.min(CLUE_BUFSIZ - f.count, len - done);
+			for (int i=0; i<chunk; i++)
+				f.buffer.doubledata[f.count + i] = pd.intOf(po + done + i) & 0xff;
+			f.count += chunk;
+			done += chunk;
 		}
-	};
+		
+		if (f.unbuffered)
+			flush(f);
+	}
 	
-	protected static final ClueRunnable _exp = new ClueRunnable()
+	private static final void writeString(ClueFile f, String s)
 	{
-		public void run()
+		writeBytes(f, stringToPtr(s), 0, s.length());
+	}
+	
+	protected static final double _fopen(double sp, ClueMemory stack,
+			double namepo, ClueMemory namepd, double modepo, ClueMemory modepd)
+	{
+		String name = ptrToString((int) namepo, namepd);
+		String mode = ptrToString((int) modepo, modepd).replace("b", "");
+		
+		ClueFile f = new ClueFile();
+		try
 		{
-			args.doubledata[0] = Math.exp(args.doubledata[2]);
+			if (mode.equals("r"))
+				f.file = new RandomAccessFile(name, "r");
+			else if (mode.equals("r+"))
+			{
+				if (!new File(name).exists())
+					throw new IOException();
+				f.file = new RandomAccessFile(name, "rw");
+			}
+			else if (mode.equals("w") || mode.equals("w+"))
+			{
+				f.file = new RandomAccessFile(name, "rw");
+				f.file.setLength(0);
+			}
+			else if (mode.equals("a") || mode.equals("a+"))
+			{
+				f.file = new RandomAccessFile(name, "rw");
+				f.file.seek(f.file.length());
+			}
+			else
+				throw new IOException();
 		}
-	};
+		catch (IOException e)
+		{
+			retbase = null;
+			return 0;
+		}
+		
+		retbase = newFile(f);
+		return 1;
+	}
 	
-	protected static final ClueRunnable _sqrt = new ClueRunnable()
+	protected static final double _fclose(double sp, ClueMemory stack,
+			double fppo, ClueMemory fppd)
 	{
-		public void run()
+		ClueFile f = openFiles.remove(fppd);
+		int result = flush(f);
+		
+		try
 		{
-			args.doubledata[0] = Math.sqrt(args.doubledata[2]);
+			if (f.file != null)
+				f.file.close();
 		}
-	};
-
-	protected static final ClueRunnable _pow = new ClueRunnable()
+		catch (IOException e)
+		{
+			result = -1;
+		}
+		return result;
+	}
+	
+	protected static final double _fflush(double sp, ClueMemory stack,
+			double fppo, ClueMemory fppd)
 	{
-		public void run()
+		if (fppd == null)
 		{
-			args.doubledata[0] = Math.pow(args.doubledata[2],
-					args.doubledata[3]);
+			flushAll();
+			return 0;
 		}
-	};
+		
+		return flush(openFiles.get(fppd));
+	}
+	
+	protected static final double _fread(double sp, ClueMemory stack,
+			double po, ClueMemory pd, double size, double nmemb,
+			double fppo, ClueMemory fppd)
+	{
+		ClueFile f = openFiles.get(fppd);
+		int total = (int) size * (int) nmemb;
+		int done = 0;
+		
+		while (done < total)
+		{
+			if ((f.pos == f.count) || f.writing)
+			{
+				if (!fill(f))
+					break;
+			}
+			
+			int chunk = Math.min(f.count - f.pos, total - done);
+			System.arraycopy(f.buffer.doubledata, f.pos,
+					pd.doubledata, (int) po + done, chunk);
+			f.pos += chunk;
+			done += chunk;
+		}
+		
+		return (size == 0) ? 0 : (done / (int) size);
+	}
+	
+	protected static final double _fwrite(double sp, ClueMemory stack,
+			double po, ClueMemory pd, double size, double nmemb,
+			double fppo, ClueMemory fppd)
+	{
+		writeBytes(openFiles.get(fppd), pd, (int) po,
+				(int) size * (int) nmemb);
+		return nmemb;
+	}
+	
+	protected static final double _fgets(double sp, ClueMemory stack,
+			double po, ClueMemory pd, double size,
+			double fppo, ClueMemory fppd)
+	{
+		ClueFile f = openFiles.get(fppd);
+		int i = 0;
+		
+		while (i < ((int) size - 1))
+		{
+			int c = getc(f);
+			if (c == -1)
+				break;
+			
+			pd.doubledata[(int) po + i++] = c;
+			if (c == '\n')
+				break;
+		}
+		
+		if (i == 0)
+		{
+			retbase = null;
+			return 0;
+		}
+		
+		pd.doubledata[(int) po + i] = 0;
+		retbase = pd;
+		return po;
+	}
+	
+	protected static final double _fputs(double sp, ClueMemory stack,
+			double po, ClueMemory pd, double fppo, ClueMemory fppd)
+	{
+		writeString(openFiles.get(fppd), ptrToString((int) po, pd));
+		return 0;
+	}
+	
+	protected static final double _getc(double sp, ClueMemory stack,
+			double fppo, ClueMemory fppd)
+	{
+		return getc(openFiles.get(fppd));
+	}
+	
+	protected static final double _putc(double sp, ClueMemory stack,
+			double c, double fppo, ClueMemory fppd)
+	{
+		ClueFile f = openFiles.get(fppd);
+		
+		startWrite(f);
+		f.buffer.doubledata[f.count++] = (int) c & 0xff;
+		if (f.unbuffered)
+			flush(f);
+		return c;
+	}
+	
+	protected static final double _atol(double sp, ClueMemory stack,
+			double po, ClueMemory pd)
+	{
+		return Integer.valueOf(ptrToString((int) po, pd));
+	}
+	
+	protected static final double _sin(double sp, ClueMemory stack, double n)
+	{
+		return Math.sin(n);
+	}
+	
+	protected static final double _cos(double sp, ClueMemory stack, double n)
+	{
+		return Math.cos(n);
+	}
+	
+	protected static final double _atan(double sp, ClueMemory stack, double n)
+	{
+		return Math.atan(n);
+	}
+	
+	protected static final double _log(double sp, ClueMemory stack, double n)
+	{
+		return Math.log(n);
+	}
+	
+	protected static final double _exp(double sp, ClueMemory stack, double n)
+	{
+		return Math.exp(n);
+	}
+	
+	protected static final double _sqrt(double sp, ClueMemory stack, double n)
+	{
+		return Math.sqrt(n);
+	}
 
+	protected static final double _pow(double sp, ClueMemory stack,
+			double x, double y)
+	{
+		return Math.pow(x, y);
+	}
+
+	/* The file is simply read in. Cell 0 is padding, so that the pointer
+	 * doesn't compare equal to NULL. */
+	
+	protected static final double _clue_mmap(double sp, ClueMemory stack,
+			double namepo, ClueMemory namepd,
+			double lengthpo, ClueMemory lengthpd)
+	{
+		byte[] data;
+		try
+		{
+			RandomAccessFile file = new RandomAccessFile(
+					ptrToString((int) namepo, namepd), "r");
+			data = new byte[(int) file.length()];
+			file.readFully(data);
+			file.close();
+		}
+		catch (IOException e)
+		{
+			retbase = null;
+			return 0;
+		}
+		
+		ClueMemory pd = new ClueMemory(data.length + 2);
+		for (int i=0; i<data.length; i++)
+			pd.doubledata[i+1] = data[i] & 0xff;
+		
+		if (lengthpd != null)
+			lengthpd.doubledata[(int) lengthpo] = data.length;
+		retbase = pd;
+		return 1;
+	}
+	
+	protected static final double _clue_munmap(double sp, ClueMemory stack,
+			double po, ClueMemory pd)
+	{
+		return 0;
+	}
+	
 	// --- Main runtime ---
 	
 	public static void main(String[] argv)
@@ -339,18 +812,12 @@ class ClueRuntime
 		while (i < argv.length)
 		{
 			argvobj.doubledata[i*2 + 0] = 0;
-			argvobj.objectdata[i*2 + 1] = stringToPtr(argv[i]);
+			argvobj.setObject(i*2 + 1, stringToPtr(argv[i]));
 			i++;
 		}
 		argvobj.doubledata[i*2 + 0] = 0;
-		argvobj.objectdata[i*2 + 1] = null;
 		
-		args.doubledata[0] = 0;
-		args.objectdata[1] = new ClueMemory(4096);
-		args.doubledata[2] = argv.length;
-		args.doubledata[3] = 0;
-		args.objectdata[4] = argvobj;
-			
-		ClueProgram.runMain();
+		ClueProgram.runMain(new ClueMemory(4096), argv.length, argvobj);
+		flushAll();
 	}
 }
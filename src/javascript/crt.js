@@ -12,6 +12,22 @@
 
 var clue_initializer_list = [];
 
+/* Secondary return register: functions returning pointers return the
+ * offset normally and leave the base here. */
+
+var clue_rp;
+
+/* Set by programs compiled with --packed-chars, whose char arrays are
+ * Int8Arrays (or Uint8Arrays, for unsigned chars) rather than ordinary
+ * arrays. */
+
+var clue_packed_chars = false;
+
+/* Large strings are converted a block at a time, to keep within the
+ * engine's limit on the number of arguments to a function. */
+
+var CLUE_STRING_CHUNK = 8192;
+
 function clue_add_initializer(i)
 {
 	clue_initializer_list.push(i);
@@ -23,24 +39,83 @@ function clue_run_initializers()
 		clue_initializer_list.shift()();
 }
 
+/* Copies an array of initializer constants into memory. */
+
+function clue_setdata(d, o, data)
+{
+	if (ArrayBuffer.isView(d))
+	{
+		d.set(data, o);
+		return;
+	}
+	
+	for (var i = 0; i < data.length; i++)
+		d[o + i] = data[i];
+}
+
+/* Marks memory holding a string constant. Its conversions are kept on the
+ * memory itself, indexed by offset. */
+
+function clue_newliteral(d)
+{
+	d.clue_strings = {};
+	return d;
+}
+
+/* Returns the characters from start to end of some memory as bytes. Chars
+ * are signed, so negative ones are masked back into the range 0..255. */
+
+function clue_getbytes(pd, start, end)
+{
+	if (ArrayBuffer.isView(pd))
+		return new Uint8Array(pd.buffer, pd.byteOffset + start, end - start);
+	
+	var bytes = pd.slice(start, end);
+	for (var i = 0; i < bytes.length; i++)
+		bytes[i] &= 0xff;
+	return bytes;
+}
+
 function clue_ptrtostring(po, pd)
 {
-	var s = [];
-	for (;;)
+	var cache = pd.clue_strings;
+	if (cache)
 	{
-		var c = pd[po];
-		if (c == 0)
-			break;
-		else
-			s.push(c);
-		po++;
+		var s = cache[po];
+		if (s !== undefined)
+			return s;
 	}
 	
-	return String.fromCharCode.apply(null, s);
+	var end = pd.indexOf(0, po);
+	if (end == -1)
+		end = pd.length;
+	
+	var s;
+	if ((end - po) <= CLUE_STRING_CHUNK)
+		s = String.fromCharCode.apply(null, clue_getbytes(pd, po, end));
+	else
+	{
+		var chunks = [];
+		for (var i = po; i < end; i += CLUE_STRING_CHUNK)
+			chunks.push(String.fromCharCode.apply(null,
+				clue_getbytes(pd, i, Math.min(i + CLUE_STRING_CHUNK, end))));
+		s = chunks.join("");
+	}
+	
+	if (cache)
+		cache[po] = s;
+	return s;
 }
 
 function clue_newstring(s)
 {
+	if (clue_packed_chars)
+	{
+		var d = new Int8Array(s.length + 1);
+		d.set(Buffer.from(s, "latin1"));
+		return d;
+	}
+	
 	var d = [];
 	
 	for (var i = 0; i < s.length; i++)
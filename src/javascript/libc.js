@@ -276,22 +276,156 @@ sprintf.regex = /%%|%(\d+\$)?([-+#0 ]*)(\*\d+\$|\*|\d+)?(\.(\*\d+\$|\*|\d+))?([s
  *                                 STDIO                                    *
  ****************************************************************************/
 
-var clue_output_buffer = "";
+/* A FILE is a Clue memory array whose properties hold the host file
+ * descriptor and a buffer of Clue memory (one byte per cell), which is
+ * handed to the host a chunk at a time through fs. The buffer holds either
+ * output or input, never both. */
 
-var __stdout = 0;
+var CLUE_BUFSIZ = 4096;
+var clue_open_files = [];
 
-function clue_add_to_output_buffer(s)
+function clue_newfile(fd, unbuffered)
 {
-	clue_output_buffer += s;
+	var fp = [];
+	fp.fd = fd;
+	fp.unbuffered = unbuffered;
+	fp.buffer = [];
+	fp.count = 0;       /* bytes in the buffer */
+	fp.pos = 0;         /* next byte to be read */
+	fp.writing = false;
+	fp.eof = false;
+	clue_open_files.push(fp);
+	return fp;
 }
 
-function clue_flush_output_buffer()
-{	
-	var strings = clue_output_buffer.split("\n")
-	for (var i = 0; i < (strings.length - 1); i++)
-		print(strings[i]);
-		
-	clue_output_buffer = strings[strings.length - 1];
+var __stdin = clue_newfile(0, false);
+var __stdout = clue_newfile(1, false);
+var __stderr = clue_newfile(2, true);
+
+function clue_make_host_buffer(size)
+{
+	return Buffer.alloc ? Buffer.alloc(size) : new Buffer(size);
+}
+
+/* Hands any pending output to the host, or discards any pending input. */
+
+function clue_flush(fp)
+{
+	var result = 0;
+	if (fp.writing && (fp.count > 0))
+	{
+		var count = fp.count;
+		var buffer = fp.buffer;
+		var bytes = clue_make_host_buffer(count);
+		for (var i = 0; i < count; i++)
+			bytes[i] = buffer[i];
+
+		try
+		{
+			var done = 0;
+			while (done < count)
+				done += fs.writeSync(fp.fd, bytes, done, count - done, null);
+		}
+		catch (e)
+		{
+			result = -1;
+		}
+	}
+
+	fp.count = 0;
+	fp.pos = 0;
+	fp.writing = false;
+	return result;
+}
+
+function clue_flush_all()
+{
+	for (var i = 0; i < clue_open_files.length; i++)
+		clue_flush(clue_open_files[i]);
+}
+
+/* Refills an empty input buffer, after making sure any prompt on stdout
+ * has appeared. */
+
+function clue_fill(fp)
+{
+	if (fp.eof)
+		return false;
+	if (fp.writing)
+		clue_flush(fp);
+	if (fp === __stdin)
+		clue_flush(__stdout);
+
+	var bytes = clue_make_host_buffer(CLUE_BUFSIZ);
+	var len;
+	try
+	{
+		len = fs.readSync(fp.fd, bytes, 0, CLUE_BUFSIZ, null);
+	}
+	catch (e)
+	{
+		len = 0;
+	}
+
+	if (len <= 0)
+	{
+		fp.eof = true;
+		return false;
+	}
+
+	var buffer = fp.buffer;
+	for (var i = 0; i < len; i++)
+		buffer[i] = bytes[i];
+	fp.count = len;
+	fp.pos = 0;
+	return true;
+}
+
+function clue_getc(fp)
+{
+	if ((fp.pos == fp.count) || fp.writing)
+	{
+		if (!clue_fill(fp))
+			return -1;
+	}
+
+	return fp.buffer[fp.pos++];
+}
+
+/* Makes room for at least one byte of output. */
+
+function clue_start_write(fp)
+{
+	if (!fp.writing)
+		fp.count = fp.pos = 0;
+	else if (fp.count == CLUE_BUFSIZ)
+		clue_flush(fp);
+	fp.writing = true;
+}
+
+/* Strings are written as their character codes, truncated to bytes. */
+
+function clue_write_string(fp, s)
+{
+	var len = s.length;
+	var i = 0;
+	while (i < len)
+	{
+		clue_start_write(fp);
+
+		var buffer = fp.buffer;
+		var count = fp.count;
+		var chunk = CLUE_BUFSIZ - count;
+		if (chunk > (len - i))
+			chunk = len - i;
+		for (var j = 0; j < chunk; j++)
+			buffer[count + j] = s.charCodeAt(i + j) & 0xff;
+		fp.count = count + chunk;
+		i += chunk;
+	}
+
+	if (fp.unbuffered)
+		clue_flush(fp);
 }
 
 function _printf(stackpo, stackpd, formatpo, formatpd)
@@ -320,16 +454,183 @@ function _printf(stackpo, stackpd, formatpo, formatpd)
 		outargs.push(thisarg);
 	}
 
-	clue_add_to_output_buffer(sprintf.apply(null, outargs));
-	clue_flush_output_buffer();
+	clue_write_string(__stdout, sprintf.apply(null, outargs));
 	return 1
 }
 
+/* printf helpers. Plain %d, %c and %s have their own, which don't need to
+ * go through sprintf(). */
+
+function clue_printf_text(s)
+{
+	clue_write_string(__stdout, s);
+}
+
+function clue_printf_int(i)
+{
+	clue_write_string(__stdout, String(i));
+}
+
+function clue_printf_char(c)
+{
+	clue_write_string(__stdout, String.fromCharCode(c & 0xff));
+}
+
+function clue_printf_string(po, pd)
+{
+	clue_write_string(__stdout, clue_ptrtostring(po, pd));
+}
+
+function clue_printf_format(spec, value)
+{
+	clue_write_string(__stdout, sprintf(spec, value));
+}
+
+function _fopen(sp, stack, namepo, namepd, modepo, modepd)
+{
+	var name = clue_ptrtostring(namepo, namepd);
+	var mode = clue_ptrtostring(modepo, modepd).replace("b", "");
+	var fd;
+
+	try
+	{
+		fd = fs.openSync(name, mode);
+	}
+	catch (e)
+	{
+		clue_rp = null;
+		return 0;
+	}
+
+	clue_rp = clue_newfile(fd, false);
+	return 1;
+}
+
+function _fclose(sp, stack, fppo, fppd)
+{
+	var result = clue_flush(fppd);
+	try
+	{
+		fs.closeSync(fppd.fd);
+	}
+	catch (e)
+	{
+		result = -1;
+	}
+
+	var i = clue_open_files.indexOf(fppd);
+	if (i != -1)
+		clue_open_files.splice(i, 1);
+	return result;
+}
+
+function _fflush(sp, stack, fppo, fppd)
+{
+	if (!fppd)
+	{
+		clue_flush_all();
+		return 0;
+	}
+
+	return clue_flush(fppd);
+}
+
+function _fread(sp, stack, po, pd, size, nmemb, fppo, fppd)
+{
+	var total = size * nmemb;
+	var done = 0;
+
+	while (done < total)
+	{
+		if ((fppd.pos == fppd.count) || fppd.writing)
+		{
+			if (!clue_fill(fppd))
+				break;
+		}
+
+		var buffer = fppd.buffer;
+		var pos = fppd.pos;
+		var chunk = fppd.count - pos;
+		if (chunk > (total - done))
+			chunk = total - done;
+		for (var i = 0; i < chunk; i++)
+			pd[po + done + i] = buffer[pos + i];
+		fppd.pos = pos + chunk;
+		done += chunk;
+	}
+
+	return size ? ((done / size) | 0) : 0;
+}
+
+function _fwrite(sp, stack, po, pd, size, nmemb, fppo, fppd)
+{
+	var total = size * nmemb;
+	var done = 0;
+
+	while (done < total)
+	{
+		clue_start_write(fppd);
+
+		var buffer = fppd.buffer;
+		var count = fppd.count;
+		var chunk = CLUE_BUFSIZ - count;
+		if (chunk > (total - done))
+			chunk = total - done;
+		for (var i = 0; i < chunk; i++)
+			buffer[count + i] = pd[po + done + i] & 0xff;
+		fppd.count = count + chunk;
+		done += chunk;
+	}
+
+	if (fppd.unbuffered)
+		clue_flush(fppd);
+	return nmemb;
+}
+
+function _fgets(sp, stack, po, pd, size, fppo, fppd)
+{
+	var i = 0;
+	while (i < (size - 1))
+	{
+		var c = clue_getc(fppd);
+		if (c == -1)
+			break;
+
+		pd[po + i] = c;
+		i++;
+		if (c == 10)
+			break;
+	}
+
+	if (i == 0)
+	{
+		clue_rp = null;
+		return 0;
+	}
+
+	pd[po + i] = 0;
+	clue_rp = pd;
+	return po;
+}
+
+function _fputs(sp, stack, po, pd, fppo, fppd)
+{
+	clue_write_string(fppd, clue_ptrtostring(po, pd));
+	return 0;
+}
+
+function _getc(sp, stack, fppo, fppd)
+{
+	return clue_getc(fppd);
+}
+
 function _putc(sp, stack, c, fppo, fppd)
 {
-	clue_add_to_output_buffer(String.fromCharCode(c));
-	if (c == '\n')
-		clue_flush_output_buffer();
+	clue_start_write(fppd);
+	fppd.buffer[fppd.count++] = c & 0xff;
+	if (fppd.unbuffered)
+		clue_flush(fppd);
+	return c;
 }
 
 function _atoi(sp, stack, po, pd)
@@ -361,7 +662,8 @@ function _strcpy(sp, stack, destpo, destpd, srcpo, srcpd)
 			break;
 	}
 
-	return [origdestpo, destpd];
+	clue_rp = destpd;
+	return origdestpo;
 }
 
 function _memset(sp, stack, destpo, destpd, c, n)
@@ -369,7 +671,8 @@ function _memset(sp, stack, destpo, destpd, c, n)
 	for (var offset = 0; offset < (n-1); offset++)
 		destpd[destpo + offset] = c;
 	
-	return [destpo, destpd];
+	clue_rp = destpd;
+	return destpo;
 }
 
 /****************************************************************************
@@ -405,7 +708,8 @@ function _sqrt(sp, stack, n) { return Math.sqrt(n); }
 
 function _malloc(sp, stack, size)
 {
-	return [0, []];
+	clue_rp = [];
+	return 0;
 }
 
 function _calloc(sp, stack, size1, size2)
@@ -413,7 +717,8 @@ function _calloc(sp, stack, size1, size2)
 	var d = [];
 	for (var i = 0; i < (size1*size2); i++)
 		d[i] = 0;
-	return [0, d];
+	clue_rp = d;
+	return 0;
 }
 
 function _free(sp, stack, po, pd)
@@ -422,5 +727,52 @@ function _free(sp, stack, po, pd)
 
 function _realloc(sp, stack, po, pd, size)
 {
-	return [po, pd];
+	clue_rp = pd;
+	return po;
+}
+
+/****************************************************************************
+ *                               MAPPED FILES                               *
+ ****************************************************************************/
+
+/* Node can't map files, so they're simply read in. Cell 0 is padding, so
+ * that the pointer doesn't compare equal to NULL. */
+
+function _clue_mmap(sp, stack, namepo, namepd, lengthpo, lengthpd)
+{
+	var data;
+	try
+	{
+		data = fs.readFileSync(clue_ptrtostring(namepo, namepd));
+	}
+	catch (e)
+	{
+		clue_rp = null;
+		return 0;
+	}
+	
+	var d;
+	if (clue_packed_chars)
+	{
+		d = new Int8Array(data.length + 2);
+		d.set(data, 1);
+	}
+	else
+	{
+		d = new Array(data.length + 2);
+		d[0] = 0;
+		for (var i = 0; i < data.length; i++)
+			d[i+1] = data[i];
+		d[data.length+1] = 0;
+	}
+	
+	if (lengthpd)
+		lengthpd[lengthpo] = data.length;
+	clue_rp = d;
+	return 1;
+}
+
+function _clue_munmap(sp, stack, po, pd)
+{
+	return 0;
 }
@@ -69,5 +69,6 @@ while (argv[argc] != "--")
 
     clue_run_initializers();
     _main(0, [], argv.length - argc, 0, cargs);
+    clue_flush_all();
     quit();
 }
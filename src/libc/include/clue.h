@@ -0,0 +1,30 @@
+/* Clue libc headers
+ *
+ * © 2008 David Given.
+ * Clue is licensed under the Revised BSD open source license. To get the
+ * full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2007-04-30 22:41:42 +0000 (Mon, 30 Apr 2007) $
+ */
+
+#ifndef CLUE_CLUE_H
+#define CLUE_CLUE_H
+
+#include <stdlib.h>
+
+/* Clue-specific extensions.
+ *
+ * clue_mmap() makes the contents of a file available, read-only, as an
+ * array of chars (followed by a '\0'), and stores its length through
+ * length if that isn't NULL. It returns NULL if the file can't be read.
+ * On the C run-time the file is mapped and only decoded into Clue memory
+ * a window at a time, as it is read, so very large files can be scanned
+ * cheaply; elsewhere it is simply read in. Writing to the array is
+ * undefined. */
+
+extern const char* clue_mmap(const char* filename, size_t* length);
+extern int clue_munmap(const char* data);
+
+#endif
@@ -14,8 +14,16 @@
 
 #include <stdlib.h>
 
+#define EOF (-1)
+#define BUFSIZ 4096
+
 extern int printf(const char* format, ...);
 
+/* FILEs are opaque; the run-time owns their contents. Each one has a
+ * BUFSIZ buffer in Clue memory, which is handed to the host a chunk at a
+ * time. stdout is flushed at exit and before reading stdin; stderr is
+ * unbuffered. */
+
 typedef int FILE;
 extern FILE _stdin;
 extern FILE _stdout;
@@ -24,6 +32,20 @@ extern FILE _stderr;
 #define stdout (&_stdout)
 #define stderr (&_stderr)
 
+extern FILE* fopen(const char* filename, const char* mode);
+extern int fclose(FILE* fp);
+extern int fflush(FILE* fp);
+
+extern size_t fread(void* ptr, size_t size, size_t nmemb, FILE* fp);
+extern size_t fwrite(const void* ptr, size_t size, size_t nmemb, FILE* fp);
+extern char* fgets(char* s, int size, FILE* fp);
+extern int fputs(const char* s, FILE* fp);
+extern int getc(FILE* fp);
 extern int putc(int c, FILE* fp);
 
+#define fgetc getc
+#define fputc putc
+#define getchar() getc(stdin)
+#define putchar(c) putc((c), stdout)
+
 #endif
@@ -11,11 +11,10 @@
 (write-line "crt.lisp running")
 
 (defun clue-newstring (s)
-  "Given a Lisp string, create an object usable with clue and return the (offset str)"
-  ;; we want to create an array whose elements are the byte values of
+  "Given a Lisp string, create an object usable with clue and return the offset and str as two values"
+  ;; we want to create a simple-vector whose elements are the byte values of
   ;; the string's characters
-  (list 0 (make-array (+ 1 (length s)) :fill-pointer t :adjustable t 
-              :initial-contents (nconc (map 'list #'char-code s) '(0)))))
+  (values 0 (coerce (nconc (map 'list #'char-code s) (list 0)) 'simple-vector)))
 
 (defun clue-ptr-to-string (po pd)
   "Given a Clue pointer (offset and base) convert back to Lisp string"
@@ -30,10 +29,9 @@
   (mapc #'funcall *clue-initializer-list*)
   (setf *clue-initializer-list* nil))
 
-;;; aref doesn't autoextend arrays so we provide a helper fn
-(defun clue-set-aref (base off value)
-  "Set element off of array base to value, extending array as necessary"
-  (if (<= (fill-pointer base) off)
-      (adjust-array base (+ 1 off) :fill-pointer t))
-  (setf (aref base off) value))
+;;; All C objects are fixed-size simple-vectors, allocated at their full size
+;;; up front, so generated code can use svref directly.
+(defun clue-make-memory (size)
+  "Create a zero-filled C object of size slots"
+  (make-array size :initial-element 0))
 
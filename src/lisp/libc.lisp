@@ -20,26 +20,34 @@
 ;;; MEMORY
 
 (defcfn _malloc (ln)
-  (declare (ignore ln))
-  (list 0 (make-array 0 :adjustable t :fill-pointer t)))
+  (values 0 (clue-make-memory ln)))
 
 (defcfn _calloc (s1 s2)
-  (list 0 (make-array (* s1 s2) :initial-element 0 :adjustable t :fill-pointer t)))
+  (values 0 (clue-make-memory (* s1 s2))))
+
+(defcfn _free (po pd)
+  (declare (ignore po pd))
+  nil)
 
 ;;; STRINGS
 
 (defcfn _strcpy (doff dd soff sd)
-  (list doff (replace dd sd :start1 doff :start2 soff :end2 (position 0 sd :start soff))))
+  (values doff (replace dd sd :start1 doff :start2 soff
+                        :end2 (1+ (position 0 sd :start soff)))))
 
 (defcfn _memset (doff dd c n)
-  (list doff (fill dd c :start doff :end (+ doff n))))
+  (values doff (fill dd c :start doff :end (+ doff n))))
+
+(defcfn _memcpy (doff dd soff sd n)
+  (values doff (replace dd sd :start1 doff :start2 soff :end2 (+ soff n))))
 
 ;;; STDIO
 
 (defcfn _printf (formatpo formatpd)
   (let ((fmt (clue-ptr-to-string formatpo formatpd)))
     ;; FIXME just prints the format string!
-    (format t "~a" fmt)))
+    (format t "~a" fmt)
+    (length fmt)))
 
 ; putc
 ; atoi
@@ -24,6 +24,10 @@
 
 (format t "command line: ~a~%" *posix-argv*)
 
+;;; The generated code is compiled with (optimize speed), which makes SBCL
+;;; very chatty about everything it couldn't optimise.
+(declaim (sb-ext:muffle-conditions sb-ext:compiler-note))
+
 (load "src/lisp/crt.lisp")
 (load "src/lisp/libc.lisp")
 
@@ -39,14 +43,20 @@
              do (load arg)
              finally (return rest))))
   
-  (setf cargs (map 'list #'clue-newstring userargs))
+  ;; argv is an array of (offset, string) pairs, terminated by a null
+  ;; pointer
+  (setf cargs (clue-make-memory (* 2 (1+ (length userargs)))))
+  (loop for arg in userargs
+        for i from 0 by 2
+        do (setf (svref cargs (1+ i)) (nth-value 1 (clue-newstring arg))))
+  (setf (svref cargs (1+ (* 2 (length userargs)))) nil)
 
   (write-line "run.lisp about to run initializers")
   (clue-run-initializers)
   
   (write-line "run.lisp about to call main")
   ;; FIXME we should propagate return value
-  (funcall _main 0 (make-array 0 :fill-pointer 0 :adjustable t) 
+  (funcall _main 0 (clue-make-memory 65536)
            (length userargs) 0 cargs)
   (write-line "run.lisp main returned")
  )
@@ -17,6 +17,8 @@ local string_sub = string.sub
 local string_find = string.find
 local string_len = string.len
 local math_floor = math.floor
+local table_concat = table.concat
+local setmetatable = setmetatable
 local bit = bit
 local bit32 = bit32
 
@@ -34,12 +36,9 @@ function add_initializer(i)
 end
 
 function run_initializers()
-	-- Foul, foul hack. Run all initializers twice to resolve mutually
-	-- dependent function references.
-	 
-	for _, i in ipairs(initializer_list) do
-		i()
-	end
+	-- Storage is created when each file is loaded, so a single run
+	-- resolves all cross references.
+	
 	for _, i in ipairs(initializer_list) do
 		i()
 	end
@@ -47,6 +46,14 @@ function run_initializers()
 	initializer_list = {}
 end
 
+-- Copies a table of initializer constants into memory.
+
+function setdata(d, o, t)
+	for i = 1, #t do
+		d[o + i - 1] = t[i]
+	end
+end
+
 local READ_FN = 1
 local WRITE_FN = 2
 local OFFSET_FN = 3
@@ -55,19 +62,55 @@ local TOSTRING_FN = 4
 local DATA_I = 1
 local OFFSET_I = 2
 
+-- Conversions of string constants, indexed by the memory and then the
+-- offset. The keys are weak, so the table doesn't keep memory alive.
+
+local literal_strings = setmetatable({}, {__mode = "k"})
+
+function newliteral()
+	local d = {}
+	literal_strings[d] = {}
+	return d
+end
+
+-- Strings are converted straight out of memory, a block at a time to keep
+-- within the limit on the number of values unpack can return.
+
+local STRING_CHUNK = 4096
+
 function ptrtostring(po, pd)
-	local s = {}
-	while true do
-		local c = pd[po]
-		if (c == 0) then
-			break;
-		else
-			s[#s+1] = c
+	local cache = literal_strings[pd]
+	if cache then
+		local s = cache[po]
+		if s then
+			return s
+		end
+	end
+	
+	local e = po
+	while (pd[e] ~= 0) do
+		e = e + 1
+	end
+	
+	local s
+	if ((e - po) <= STRING_CHUNK) then
+		s = string_char(unpack(pd, po, e - 1))
+	else
+		local chunks = {}
+		for i = po, e - 1, STRING_CHUNK do
+			local j = i + STRING_CHUNK - 1
+			if (j >= e) then
+				j = e - 1
+			end
+			chunks[#chunks+1] = string_char(unpack(pd, i, j))
 		end
-		po = po + 1
+		s = table_concat(chunks)
 	end
 	
-	return string_char(unpack(s))
+	if cache then
+		cache[po] = s
+	end
+	return s
 end
 	
 -- Construct a string array.
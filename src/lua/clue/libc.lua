@@ -22,11 +22,16 @@ local ptrtostring = clue.crt.ptrtostring
 local newptr = clue.crt.newptr
 local math_floor = math.floor
 local tonumber = tonumber
-local io_write = io.write
+local io_open = io.open
 local io_stdin = io.stdin
 local io_stdout = io.stdout
 local io_stderr = io.stderr
 local string_format = string.format
+local string_char = string.char
+local string_byte = string.byte
+local string_find = string.find
+local string_sub = string.sub
+local pairs = pairs
 local string_gsub = string.gsub
 local math_sin = math.sin
 local math_cos = math.cos
@@ -79,6 +84,149 @@ end
 
 _atol = _atoi
 
+-----------------------------------------------------------------------------
+--                                 STDIO                                   --
+-----------------------------------------------------------------------------
+
+-- A FILE is a table holding the host file and a buffer of Clue memory (one
+-- byte per cell, starting at 1), which is handed to the host a chunk at a
+-- time. The buffer holds either output or input, never both.
+
+local BUFSIZ = 4096
+local open_files = {}
+
+local function newfile(handle, unbuffered)
+	local fp = {
+		handle = handle,
+		unbuffered = unbuffered,
+		buffer = {},
+		count = 0,      -- bytes in the buffer
+		pos = 0,        -- bytes already read from it
+		writing = false,
+		eof = false
+	}
+	open_files[fp] = true
+	return fp
+end
+
+__stdin = newfile(io_stdin, false)
+__stdout = newfile(io_stdout, false)
+__stderr = newfile(io_stderr, true)
+
+-- Hands any pending output to the host, or discards any pending input.
+
+local function flush(fp)
+	local ok = true
+	if fp.writing and (fp.count > 0) then
+		ok = fp.handle:write(string_char(unpack(fp.buffer, 1, fp.count)))
+		if fp.unbuffered then
+			fp.handle:flush()
+		end
+	end
+	
+	fp.count = 0
+	fp.pos = 0
+	fp.writing = false
+	if ok then
+		return 0
+	end
+	return -1
+end
+
+function flush_all()
+	for fp in pairs(open_files) do
+		flush(fp)
+		fp.handle:flush()
+	end
+end
+
+-- Refills an empty input buffer. stdin is read a line at a time (so that
+-- interactive programs work), after making sure any prompt has appeared.
+
+local function fill(fp)
+	if fp.eof then
+		return false
+	end
+	if fp.writing then
+		flush(fp)
+	end
+	
+	local s
+	if (fp == __stdin) then
+		flush(__stdout)
+		io_stdout:flush()
+		s = fp.handle:read("*l")
+		if s then
+			s = s .. "\n"
+		end
+	else
+		s = fp.handle:read(BUFSIZ)
+	end
+	
+	if (not s) or (s == "") then
+		fp.eof = true
+		return false
+	end
+	
+	local buffer = fp.buffer
+	for i = 1, #s do
+		buffer[i] = string_byte(s, i)
+	end
+	fp.count = #s
+	fp.pos = 0
+	return true
+end
+
+local function getc(fp)
+	if (fp.pos == fp.count) or fp.writing then
+		if not fill(fp) then
+			return -1
+		end
+	end
+	
+	local pos = fp.pos + 1
+	fp.pos = pos
+	return fp.buffer[pos]
+end
+
+-- Makes room for at least one byte of output.
+
+local function start_write(fp)
+	if not fp.writing then
+		fp.count = 0
+		fp.pos = 0
+	elseif (fp.count == BUFSIZ) then
+		flush(fp)
+	end
+	fp.writing = true
+end
+
+local function write_string(fp, s)
+	local len = #s
+	start_write(fp)
+	
+	if (len >= BUFSIZ) then
+		flush(fp)
+		fp.handle:write(s)
+	else
+		if ((fp.count + len) > BUFSIZ) then
+			flush(fp)
+			fp.writing = true
+		end
+		
+		local buffer = fp.buffer
+		local count = fp.count
+		for i = 1, len do
+			buffer[count+i] = string_byte(s, i)
+		end
+		fp.count = count + len
+	end
+	
+	if fp.unbuffered then
+		flush(fp)
+	end
+end
+
 function _printf(sp, stack, formatpo, formatpd, ...)
 	format = ptrtostring(formatpo, formatpd)
 	local inargs = {...}
@@ -109,16 +257,157 @@ function _printf(sp, stack, formatpo, formatpd, ...)
 	
 	-- Use Lua's string.format to actually do the rendering.
 	
-	io_write(string_format(format, unpack(outargs)))
+	write_string(__stdout, string_format(format, unpack(outargs)))
 	return 1
 end
 
-__stdin = io_stdin
-__stdout = io_stdout
-__stderr = io_stderr
- 
+-- printf helpers. Strings need converting out of memory first; everything
+-- else goes straight to string.format.
+
+function printf_text(s)
+	write_string(__stdout, s)
+end
+
+function printf_format(spec, value)
+	write_string(__stdout, string_format(spec, value))
+end
+
+function printf_string(spec, po, pd)
+	local s = ptrtostring(po, pd)
+	if (spec ~= "%s") then
+		s = string_format(spec, s)
+	end
+	write_string(__stdout, s)
+end
+
+function _fopen(sp, stack, namepo, namepd, modepo, modepd)
+	local mode = ptrtostring(modepo, modepd)
+	local handle = io_open(ptrtostring(namepo, namepd), mode)
+	if not handle then
+		return 0, nil
+	end
+	
+	return 2, newfile(handle, false)
+end
+
+function _fclose(sp, stack, fppo, fppd)
+	local result = flush(fppd)
+	fppd.handle:close()
+	open_files[fppd] = nil
+	return result
+end
+
+function _fflush(sp, stack, fppo, fppd)
+	if not fppd then
+		flush_all()
+		return 0
+	end
+	
+	local result = flush(fppd)
+	fppd.handle:flush()
+	return result
+end
+
+function _fread(sp, stack, po, pd, size, nmemb, fppo, fppd)
+	local total = size * nmemb
+	local done = 0
+	
+	while (done < total) do
+		if (fppd.pos == fppd.count) or fppd.writing then
+			if not fill(fppd) then
+				break
+			end
+		end
+		
+		local buffer = fppd.buffer
+		local pos = fppd.pos
+		local chunk = fppd.count - pos
+		if (chunk > (total - done)) then
+			chunk = total - done
+		end
+		
+		for i = 1, chunk do
+			pd[po+done+i-1] = buffer[pos+i]
+		end
+		fppd.pos = pos + chunk
+		done = done + chunk
+	end
+	
+	if (size == 0) then
+		return 0
+	end
+	return math_floor(done / size)
+end
+
+function _fwrite(sp, stack, po, pd, size, nmemb, fppo, fppd)
+	local total = size * nmemb
+	local done = 0
+	
+	while (done < total) do
+		start_write(fppd)
+		
+		local buffer = fppd.buffer
+		local count = fppd.count
+		local chunk = BUFSIZ - count
+		if (chunk > (total - done)) then
+			chunk = total - done
+		end
+		
+		for i = 1, chunk do
+			buffer[count+i] = pd[po+done+i-1] % 256
+		end
+		fppd.count = count + chunk
+		done = done + chunk
+	end
+	
+	if fppd.unbuffered then
+		flush(fppd)
+	end
+	return nmemb
+end
+
+function _fgets(sp, stack, po, pd, size, fppo, fppd)
+	local i = 0
+	while (i < (size - 1)) do
+		local c = getc(fppd)
+		if (c == -1) then
+			break
+		end
+		
+		pd[po+i] = c
+		i = i + 1
+		if (c == 10) then
+			break
+		end
+	end
+	
+	if (i == 0) then
+		return 0, nil
+	end
+	
+	pd[po+i] = 0
+	return po, pd
+end
+
+function _fputs(sp, stack, po, pd, fppo, fppd)
+	write_string(fppd, ptrtostring(po, pd))
+	return 0
+end
+
+function _getc(sp, stack, fppo, fppd)
+	return getc(fppd)
+end
+
 function _putc(sp, stack, c, fppo, fppd)
-	fppd:write(string_format("%c", c))
+	start_write(fppd)
+	local count = fppd.count + 1
+	fppd.buffer[count] = c % 256
+	fppd.count = count
+	
+	if fppd.unbuffered then
+		flush(fppd)
+	end
+	return c
 end
 
 -----------------------------------------------------------------------------
@@ -187,3 +476,42 @@ function _gettimeofday(sp, stack, tvpo, tvpd, tzpo, tzpd)
 	tvpd[tvpo+1] = usecs
 	return 0
 end
+
+-----------------------------------------------------------------------------
+--                             MAPPED FILES                                --
+-----------------------------------------------------------------------------
+
+-- There's no way of mapping a file here, so it's simply read in, a block at
+-- a time. Cell 1 is padding, so that the pointer doesn't look like NULL.
+
+function _clue_mmap(sp, stack, namepo, namepd, lengthpo, lengthpd)
+	local handle = io_open(ptrtostring(namepo, namepd), "rb")
+	if not handle then
+		return 0, nil
+	end
+	
+	local d = {0}
+	local n = 1
+	while true do
+		local s = handle:read(BUFSIZ)
+		if not s then
+			break
+		end
+		
+		for i = 1, #s do
+			d[n+i] = string_byte(s, i)
+		end
+		n = n + #s
+	end
+	handle:close()
+	d[n+1] = 0
+	
+	if lengthpd then
+		lengthpd[lengthpo] = n - 1
+	end
+	return 2, d
+end
+
+function _clue_munmap(sp, stack, po, pd)
+	return 0
+end
@@ -76,6 +76,7 @@ do
 	clue.crt.run_initializers()
 
 	local result = _main(1, {}, #argv - argc + 1, 1, cargs)
+	clue.libc.flush_all()
 	os.exit(result)
 end
 
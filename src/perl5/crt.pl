@@ -8,6 +8,8 @@
 # $HeadURL$
 # $LastChangedDate: 2008-07-16 11:21:58 +0100 (Wed, 16 Jul 2008) $
 
+use strict;
+
 my @clue_initializer_list = ();
 
 sub clue_add_initializer
@@ -19,7 +21,7 @@ sub clue_add_initializer
 sub clue_run_initializers
 {
 	grep $_->(), @clue_initializer_list;
-	@clue_initializer_list = [];
+	@clue_initializer_list = ();
 }
 
 sub clue_newstring
@@ -36,24 +38,30 @@ sub clue_newstring
 	return 0, \@d;
 }
 
+# Conversions of string constants, indexed by the memory and then the offset.
+
+my %clue_literal_strings = ();
+
+sub clue_newliteral
+{
+	my $d = [];
+	$clue_literal_strings{$d} = {};
+	return $d;
+}
+
 sub clue_ptr_to_string
 {
 	my ($po, $pd) = @_;
-	my @s = ();
-
-	for (;;)
+	my $cache = $clue_literal_strings{$pd};
+	if ($cache && exists($cache->{$po}))
 	{
-		my $c = $pd->[$po];
-		if ($c == 0)
-		{
-			last;
-		}
-		else
-		{
-			push @s, chr($c);
-		}
-		$po++;
+		return $cache->{$po};
 	}
-	
-	return join("", @s);
+
+	my $end = $po;
+	$end++ while ($pd->[$end] != 0);
+	my $s = pack("W*", @{$pd}[$po .. ($end - 1)]);
+
+	$cache->{$po} = $s if $cache;
+	return $s;
 }
@@ -8,45 +8,46 @@
 # $HeadURL$
 # $LastChangedDate: 2008-07-16 11:21:58 +0100 (Wed, 16 Jul 2008) $
 
+use strict;
 use Time::HiRes qw(gettimeofday);
 
 #############################################################################
 #                                 MEMORY                                    #
 #############################################################################
 
-$_malloc = sub
+sub _malloc
 {
 	return 0, [];
-};
+}
 
-$_calloc = sub
+sub _calloc
 {
 	my ($stackpo, $stackpd, $s1, $s2) = @_;
 	my @d = ();
 	
-	for $i (0 .. ($s1 * $s2))
+	for my $i (0 .. ($s1 * $s2))
 	{
 		$d[$i] = 0;
 	}
 	
 	return 0, \@d;
-};
+}
 
-$_free = sub
+sub _free
 {
-};
+}
 
-$_realloc = sub
+sub _realloc
 {
 	my ($stackpo, $stackpd, $po, $pd, $s) = @_;
 	return $po, $pd;
-};
+}
 
 #############################################################################
 #                                 STRINGS                                   #
 #############################################################################
 
-$_strcpy = sub
+sub _strcpy
 {
 	my ($stackpo, $stackpd, $destpo, $destpd, $srcpo, $srcpd) = @_;
 	my $origdestpo = $destpo;
@@ -62,9 +63,9 @@ $_strcpy = sub
 	while ($c != 0);
 	
 	return $origdestpo, $destpd;
-};
+}
  	
-$_memset = sub
+sub _memset
 {
 	my ($stackpo, $stackpd, $destpo, $destpd, $c, $n) = @_;
 	my $origdestpo = $destpo;
@@ -72,19 +73,178 @@ $_memset = sub
 	while ($n > 0)
 	{
 		$destpd->[$destpo] = $c;
+		$destpo++;
 		$n--;
 	}
 	
 	return $origdestpo, $destpd;
-};
+}
+
+sub _memcpy
+{
+	my ($stackpo, $stackpd, $destpo, $destpd, $srcpo, $srcpd, $n) = @_;
+	
+	@{$destpd}[$destpo .. ($destpo + $n - 1)] =
+		@{$srcpd}[$srcpo .. ($srcpo + $n - 1)];
+	
+	return $destpo, $destpd;
+}
 
 #############################################################################
 #                                  STDIO                                    #
 #############################################################################
 
-$| = 1; # force flush on every write
+# A FILE is an array of Clue memory whose first few cells hold the host
+# file handle and a buffer of Clue memory (one byte per cell), which is
+# handed to the host a chunk at a time with syswrite and sysread. The
+# buffer holds either output or input, never both.
+
+use constant
+{
+	CLUE_BUFSIZ => 4096,
+
+	FILE_HANDLE => 0,
+	FILE_BUFFER => 1,
+	FILE_COUNT => 2,         # bytes in the buffer
+	FILE_POS => 3,           # next byte to be read
+	FILE_WRITING => 4,
+	FILE_EOF => 5,
+	FILE_UNBUFFERED => 6,
+};
+
+my %clue_open_files = ();
+
+sub clue_newfile
+{
+	my ($handle, $unbuffered) = @_;
+	binmode($handle);
+
+	my $fp = [$handle, [], 0, 0, 0, 0, $unbuffered];
+	$clue_open_files{$fp} = $fp;
+	return $fp;
+}
+
+our $__stdin = clue_newfile(\*STDIN, 0);
+our $__stdout = clue_newfile(\*STDOUT, 0);
+our $__stderr = clue_newfile(\*STDERR, 1);
+
+# Hands any pending output to the host, or discards any pending input.
+
+sub clue_flush
+{
+	my ($fp) = @_;
+	my $result = 0;
+
+	if ($fp->[FILE_WRITING] && ($fp->[FILE_COUNT] > 0))
+	{
+		my $count = $fp->[FILE_COUNT];
+		my $bytes = pack("C*", @{$fp->[FILE_BUFFER]}[0 .. ($count - 1)]);
+		my $done = 0;
+		while ($done < $count)
+		{
+			my $len = syswrite($fp->[FILE_HANDLE], $bytes, $count - $done,
+				$done);
+			if (!$len)
+			{
+				$result = -1;
+				last;
+			}
+			$done += $len;
+		}
+	}
+
+	$fp->[FILE_COUNT] = 0;
+	$fp->[FILE_POS] = 0;
+	$fp->[FILE_WRITING] = 0;
+	return $result;
+}
+
+sub clue_flush_all
+{
+	for my $fp (values %clue_open_files)
+	{
+		clue_flush($fp);
+	}
+}
+
+# Refills an empty input buffer, after making sure any prompt on stdout has
+# appeared.
+
+sub clue_fill
+{
+	my ($fp) = @_;
+
+	return 0 if $fp->[FILE_EOF];
+	clue_flush($fp) if $fp->[FILE_WRITING];
+	clue_flush($__stdout) if ($fp == $__stdin);
+
+	my $bytes;
+	my $len = sysread($fp->[FILE_HANDLE], $bytes, CLUE_BUFSIZ);
+	if (!$len)
+	{
+		$fp->[FILE_EOF] = 1;
+		return 0;
+	}
+
+	@{$fp->[FILE_BUFFER]}[0 .. ($len - 1)] = unpack("C*", $bytes);
+	$fp->[FILE_COUNT] = $len;
+	$fp->[FILE_POS] = 0;
+	return 1;
+}
+
+sub clue_getc
+{
+	my ($fp) = @_;
+
+	if (($fp->[FILE_POS] == $fp->[FILE_COUNT]) || $fp->[FILE_WRITING])
+	{
+		return -1 if !clue_fill($fp);
+	}
 
-$_printf = sub
+	return $fp->[FILE_BUFFER]->[$fp->[FILE_POS]++];
+}
+
+# Makes room for at least one byte of output.
+
+sub clue_start_write
+{
+	my ($fp) = @_;
+
+	if (!$fp->[FILE_WRITING])
+	{
+		$fp->[FILE_COUNT] = 0;
+		$fp->[FILE_POS] = 0;
+	}
+	elsif ($fp->[FILE_COUNT] == CLUE_BUFSIZ)
+	{
+		clue_flush($fp);
+	}
+	$fp->[FILE_WRITING] = 1;
+}
+
+sub clue_write_bytes
+{
+	my ($fp, @bytes) = @_;
+	my $done = 0;
+
+	while ($done < @bytes)
+	{
+		clue_start_write($fp);
+
+		my $count = $fp->[FILE_COUNT];
+		my $chunk = CLUE_BUFSIZ - $count;
+		$chunk = @bytes - $done if ($chunk > (@bytes - $done));
+
+		@{$fp->[FILE_BUFFER]}[$count .. ($count + $chunk - 1)] =
+			map { $_ & 0xff } @bytes[$done .. ($done + $chunk - 1)];
+		$fp->[FILE_COUNT] = $count + $chunk;
+		$done += $chunk;
+	}
+
+	clue_flush($fp) if $fp->[FILE_UNBUFFERED];
+}
+
+sub _printf
 {
 	my ($stackpo, $stackpd, $formatpo, $formatpd) = @_;
 	my $format = clue_ptr_to_string($formatpo, $formatpd);
@@ -111,31 +271,177 @@ $_printf = sub
 		push @outargs, $thisarg;
 	}
 	
-	print sprintf($format, @outargs);
+	clue_write_bytes($__stdout, unpack("C*", sprintf($format, @outargs)));
 	
 	return 1;
-};
+}
+
+# printf helpers. Their output is unpacked into bytes, as the stdio buffers
+# hold one byte per cell.
+
+sub clue_printf_text
+{
+	clue_write_bytes($__stdout, unpack("C*", $_[0]));
+}
 
-$_putc = sub
+sub clue_printf_format
+{
+	my ($spec, $value) = @_;
+	clue_write_bytes($__stdout, unpack("C*", sprintf($spec, $value)));
+}
+
+sub clue_printf_string
+{
+	my ($spec, $po, $pd) = @_;
+	my $s = clue_ptr_to_string($po, $pd);
+	$s = sprintf($spec, $s) if ($spec ne "%s");
+	clue_write_bytes($__stdout, unpack("C*", $s));
+}
+
+my %clue_open_modes =
+(
+	"r" => "<",
+	"w" => ">",
+	"a" => ">>",
+	"r+" => "+<",
+	"w+" => "+>",
+	"a+" => "+>>",
+);
+
+sub _fopen
+{
+	my ($stackpo, $stackpd, $namepo, $namepd, $modepo, $modepd) = @_;
+	my $name = clue_ptr_to_string($namepo, $namepd);
+	my $mode = clue_ptr_to_string($modepo, $modepd);
+	$mode =~ s/b//g;
+
+	my $handle;
+	if (!exists($clue_open_modes{$mode}) ||
+		!open($handle, $clue_open_modes{$mode}, $name))
+	{
+		return 0, undef;
+	}
+
+	return 1, clue_newfile($handle, 0);
+}
+
+sub _fclose
+{
+	my ($stackpo, $stackpd, $fppo, $fppd) = @_;
+	my $result = clue_flush($fppd);
+
+	$result = -1 if !close($fppd->[FILE_HANDLE]);
+	delete $clue_open_files{$fppd};
+	return $result;
+}
+
+sub _fflush
+{
+	my ($stackpo, $stackpd, $fppo, $fppd) = @_;
+
+	if (!$fppd)
+	{
+		clue_flush_all();
+		return 0;
+	}
+
+	return clue_flush($fppd);
+}
+
+sub _fread
+{
+	my ($stackpo, $stackpd, $po, $pd, $size, $nmemb, $fppo, $fppd) = @_;
+	my $total = $size * $nmemb;
+	my $done = 0;
+
+	while ($done < $total)
+	{
+		if (($fppd->[FILE_POS] == $fppd->[FILE_COUNT]) ||
+			$fppd->[FILE_WRITING])
+		{
+			last if !clue_fill($fppd);
+		}
+
+		my $pos = $fppd->[FILE_POS];
+		my $chunk = $fppd->[FILE_COUNT] - $pos;
+		$chunk = $total - $done if ($chunk > ($total - $done));
+
+		@{$pd}[($po + $done) .. ($po + $done + $chunk - 1)] =
+			@{$fppd->[FILE_BUFFER]}[$pos .. ($pos + $chunk - 1)];
+		$fppd->[FILE_POS] = $pos + $chunk;
+		$done += $chunk;
+	}
+
+	return $size ? int($done / $size) : 0;
+}
+
+sub _fwrite
+{
+	my ($stackpo, $stackpd, $po, $pd, $size, $nmemb, $fppo, $fppd) = @_;
+	my $total = $size * $nmemb;
+
+	clue_write_bytes($fppd, @{$pd}[$po .. ($po + $total - 1)]) if $total;
+	return $nmemb;
+}
+
+sub _fgets
+{
+	my ($stackpo, $stackpd, $po, $pd, $size, $fppo, $fppd) = @_;
+	my $i = 0;
+
+	while ($i < ($size - 1))
+	{
+		my $c = clue_getc($fppd);
+		last if ($c == -1);
+
+		$pd->[$po + $i] = $c;
+		$i++;
+		last if ($c == 10);
+	}
+
+	return 0, undef if ($i == 0);
+
+	$pd->[$po + $i] = 0;
+	return $po, $pd;
+}
+
+sub _fputs
+{
+	my ($stackpo, $stackpd, $po, $pd, $fppo, $fppd) = @_;
+	clue_write_bytes($fppd, unpack("C*", clue_ptr_to_string($po, $pd)));
+	return 0;
+}
+
+sub _getc
+{
+	my ($stackpo, $stackpd, $fppo, $fppd) = @_;
+	return clue_getc($fppd);
+}
+
+sub _putc
 {
 	my ($stackpo, $stackpd, $c, $fppo, $fppd) = @_;
-	printf sprintf("%c", $c);
-};
 
-$_atoi = sub
+	clue_start_write($fppd);
+	$fppd->[FILE_BUFFER]->[$fppd->[FILE_COUNT]++] = $c & 0xff;
+	clue_flush($fppd) if $fppd->[FILE_UNBUFFERED];
+	return $c;
+}
+
+sub _atoi
 {
 	my ($stackpo, $stackpd, $srcpo, $srcpd) = @_;
 	my $s = clue_ptr_to_string($srcpo, $srcpd);
 	return $s | 0;
-};
+}
 
-$_atol = $_atoi;
+sub _atol { return _atoi(@_); }
 	
 #############################################################################
 #                                   TIME                                    #
 #############################################################################
 
-$_gettimeofday = sub
+sub _gettimeofday
 {
 	my ($sp, $stack, $tvpo, $tvpd, $tzpo, $tzpd) = @_;
 	my ($secs, $usecs) = gettimeofday;
@@ -143,16 +449,82 @@ $_gettimeofday = sub
 	$tvpd->[$tvpo+0] = $secs;
 	$tvpd->[$tvpo+1] = $usecs;
 	return 0;
-};
+}
 
 #############################################################################
 #                                  MATHS                                    #
 #############################################################################
 
-$_sin = sub { return sin($_[2]); };
-$_cos = sub { return cos($_[2]); };
-$_atan = sub { return atan2($_[2], 1); };
-$_log = sub { return log($_[2]); };
-$_exp = sub { return exp($_[2]); };
-$_sqrt = sub { return sqrt($_[2]); };
-$_pow = sub { return ($_[2] ** $_[3]); };
+sub _sin { return sin($_[2]); }
+sub _cos { return cos($_[2]); }
+sub _atan { return atan2($_[2], 1); }
+sub _log { return log($_[2]); }
+sub _exp { return exp($_[2]); }
+sub _sqrt { return sqrt($_[2]); }
+sub _pow { return ($_[2] ** $_[3]); }
+
+#############################################################################
+#                              MAPPED FILES                                 #
+#############################################################################
+
+# The file is simply read in. Cell 0 is padding, so that the pointer doesn't
+# compare equal to NULL.
+
+sub _clue_mmap
+{
+	my ($stackpo, $stackpd, $namepo, $namepd, $lengthpo, $lengthpd) = @_;
+	my $handle;
+
+	return 0, undef
+		if !open($handle, "<", clue_ptr_to_string($namepo, $namepd));
+	binmode($handle);
+
+	my $data = do { local $/; <$handle> };
+	close($handle);
+	$data = "" if !defined($data);
+
+	$lengthpd->[$lengthpo] = length($data) if $lengthpd;
+	return 1, [0, unpack("C*", $data), 0];
+}
+
+sub _clue_munmap
+{
+	return 0;
+}
+
+#############################################################################
+#                                 EXPORTS                                   #
+#############################################################################
+
+# Code produced by the perl5 backend calls through package variables rather
+# than named subs.
+
+our $_malloc = \&_malloc;
+our $_calloc = \&_calloc;
+our $_free = \&_free;
+our $_realloc = \&_realloc;
+our $_strcpy = \&_strcpy;
+our $_memset = \&_memset;
+our $_memcpy = \&_memcpy;
+our $_printf = \&_printf;
+our $_fopen = \&_fopen;
+our $_fclose = \&_fclose;
+our $_fflush = \&_fflush;
+our $_fread = \&_fread;
+our $_fwrite = \&_fwrite;
+our $_fgets = \&_fgets;
+our $_fputs = \&_fputs;
+our $_getc = \&_getc;
+our $_putc = \&_putc;
+our $_atoi = \&_atoi;
+our $_atol = \&_atol;
+our $_gettimeofday = \&_gettimeofday;
+our $_sin = \&_sin;
+our $_cos = \&_cos;
+our $_atan = \&_atan;
+our $_log = \&_log;
+our $_exp = \&_exp;
+our $_sqrt = \&_sqrt;
+our $_pow = \&_pow;
+our $_clue_mmap = \&_clue_mmap;
+our $_clue_munmap = \&_clue_munmap;
@@ -50,5 +50,9 @@ while ($ARGV[$argc] ne "--")
 	}
 	
     clue_run_initializers();
-    $_main->(0, [], $#ARGV - $argc, 0, \@cargs);
+
+	# perl5fast programs define main() as a named sub.
+	my $main = defined(&_main) ? \&_main : $_main;
+    $main->(0, [], $#ARGV - $argc, 0, \@cargs);
+    clue_flush_all();
 }
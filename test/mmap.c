@@ -0,0 +1,133 @@
+/* clue_mmap() test program.
+ *
+ * This file is available under the Revised BSD open source license. To get
+ * the full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2008-09-07 12:39:58 +0100 (Sun, 07 Sep 2008) $
+ */
+
+/* Each check prints "ok" or "FAILED" and the program finishes by printing
+ * "done"; check-runtime looks for these.
+ *
+ * On the C run-time a window of the mapping holds 64kB of Clue memory,
+ * which is 8kB of file, and 256 windows are kept decoded at once. BIG_SIZE
+ * is chosen to be well over that, so a full scan makes the run-time evict
+ * windows and decode them again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <clue.h>
+
+#define BIG_FILE "/tmp/clue-mmap-big.tmp"
+#define EMPTY_FILE "/tmp/clue-mmap-empty.tmp"
+#define MISSING_FILE "/tmp/clue-mmap-missing/nothing"
+#define BIG_SIZE (3*1024*1024 + 7)
+#define WINDOW_BYTES (8*1024)
+
+static int failures = 0;
+
+static void check(int ok, const char* what)
+{
+	if (ok)
+		printf("ok - %s\n", what);
+	else
+	{
+		printf("FAILED - %s\n", what);
+		failures++;
+	}
+}
+
+/* The contents of the big file. Every byte is in 1..127, so that the test
+ * doesn't depend on whether chars are signed. */
+
+static int expected(int i)
+{
+	return 1 + ((i * 31) + (i / 4099)) % 127;
+}
+
+static int write_big_file(void)
+{
+	FILE* fp = fopen(BIG_FILE, "w");
+	if (!fp)
+		return 0;
+
+	char* buffer = malloc(BUFSIZ);
+	int i = 0;
+	while (i < BIG_SIZE)
+	{
+		int n = 0;
+		while ((n < BUFSIZ) && (i < BIG_SIZE))
+			buffer[n++] = expected(i++);
+		fwrite(buffer, 1, n, fp);
+	}
+
+	free(buffer);
+	return fclose(fp) == 0;
+}
+
+/* Compares bytes start to end of data with the expected contents. */
+
+static int scan(const char* data, int start, int end)
+{
+	int i;
+	for (i = start; i < end; i++)
+		if (data[i] != expected(i))
+			return 0;
+	return 1;
+}
+
+int main(int argc, const char* argv[])
+{
+	size_t length;
+	const char* data;
+	FILE* fp;
+
+	check(write_big_file(), "write the big file");
+
+	data = clue_mmap(BIG_FILE, &length);
+	check(data != NULL, "map the big file");
+	if (data)
+	{
+		check(length == BIG_SIZE, "big file length");
+		check(scan(data, WINDOW_BYTES - 100, 2*WINDOW_BYTES + 100),
+				"scan across window boundaries");
+		check(scan(data, 0, BIG_SIZE), "scan more than the resident windows");
+		check(scan(data, 0, 100), "rescan an evicted window");
+		check(data[BIG_SIZE] == 0, "terminating zero");
+		check(clue_munmap(data) == 0, "unmap the big file");
+	}
+
+	length = 0;
+	data = clue_mmap(BIG_FILE, &length);
+	check(data != NULL, "map the big file again");
+	if (data)
+	{
+		check(length == BIG_SIZE, "big file length after remapping");
+		check(scan(data, BIG_SIZE - WINDOW_BYTES, BIG_SIZE),
+				"scan the end after remapping");
+		check(scan(data, 0, WINDOW_BYTES), "scan the start after remapping");
+		clue_munmap(data);
+	}
+
+	fp = fopen(EMPTY_FILE, "w");
+	check(fp != NULL, "create the empty file");
+	if (fp)
+		fclose(fp);
+
+	length = 1;
+	data = clue_mmap(EMPTY_FILE, &length);
+	check(data != NULL, "map the empty file");
+	if (data)
+	{
+		check(length == 0, "empty file length");
+		check(data[0] == 0, "empty file is an empty string");
+		clue_munmap(data);
+	}
+
+	check(clue_mmap(MISSING_FILE, NULL) == NULL, "map a missing file");
+
+	printf("done, %d failed\n", failures);
+	return failures;
+}
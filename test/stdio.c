@@ -0,0 +1,171 @@
+/* stdio test program.
+ *
+ * This file is available under the Revised BSD open source license. To get
+ * the full license text, see the README file.
+ *
+ * $Id$
+ * $HeadURL$
+ * $LastChangedDate: 2008-09-07 12:39:58 +0100 (Sun, 07 Sep 2008) $
+ */
+
+/* Each check prints "ok" or "FAILED" and the program finishes by printing
+ * "done"; check-runtime looks for these, and fails on any other output. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_FILE "/tmp/clue-stdio.tmp"
+#define MISSING_FILE "/tmp/clue-stdio-missing/nothing"
+#define BLOCK_SIZE (BUFSIZ + 1000)
+
+static int failures = 0;
+
+static void check(int ok, const char* what)
+{
+	if (ok)
+		printf("ok - %s\n", what);
+	else
+	{
+		printf("FAILED - %s\n", what);
+		failures++;
+	}
+}
+
+static int same(const char* s1, const char* s2)
+{
+	while (*s1 && (*s1 == *s2))
+	{
+		s1++;
+		s2++;
+	}
+	return *s1 == *s2;
+}
+
+/* The contents of the block, which is longer than a FILE's buffer. */
+
+static int expected(int i)
+{
+	return 'a' + (i % 26);
+}
+
+static void write_file(void)
+{
+	FILE* fp = fopen(TEST_FILE, "w");
+	check(fp != NULL, "open for writing");
+	if (!fp)
+		return;
+
+	const char* s = "second";
+	char* block = malloc(BLOCK_SIZE);
+	int i;
+
+	check(fputs("first line\n", fp) >= 0, "fputs");
+	while (*s)
+		putc(*s++, fp);
+	putc('\n', fp);
+
+	for (i = 0; i < BLOCK_SIZE; i++)
+		block[i] = expected(i);
+	check(fwrite(block, 1, BLOCK_SIZE, fp) == BLOCK_SIZE, "fwrite");
+	free(block);
+
+	check(fclose(fp) == 0, "fclose after writing");
+}
+
+static void read_file(void)
+{
+	FILE* fp = fopen(TEST_FILE, "r");
+	check(fp != NULL, "open for reading");
+	if (!fp)
+		return;
+
+	char line[100];
+	char* block = malloc(BLOCK_SIZE + 10);
+	int i;
+	int ok;
+
+	check(fgets(line, 5, fp) == line, "fgets part of a line");
+	check(same(line, "firs"), "fgets stops at size");
+	check(fgets(line, sizeof(line), fp) == line, "fgets rest of a line");
+	check(same(line, "t line\n"), "fgets stops after newline");
+
+	for (i = 0; i < 7; i++)
+		line[i] = getc(fp);
+	line[7] = '\0';
+	check(same(line, "second\n"), "getc");
+
+	check(fread(block, 1, BLOCK_SIZE + 10, fp) == BLOCK_SIZE,
+			"fread stops at end of file");
+	ok = 1;
+	for (i = 0; i < BLOCK_SIZE; i++)
+		if (block[i] != expected(i))
+			ok = 0;
+	check(ok, "fread contents");
+	free(block);
+
+	check(getc(fp) == EOF, "getc at end of file");
+	check(fgets(line, sizeof(line), fp) == NULL, "fgets at end of file");
+	check(fclose(fp) == 0, "fclose after reading");
+}
+
+/* A "+" stream needs an fflush() between writing and reading; after it,
+ * reading carries on from just after what was written. */
+
+static void update_file(void)
+{
+	FILE* fp = fopen(TEST_FILE, "w");
+	if (fp)
+	{
+		fputs("abcdef\n", fp);
+		fclose(fp);
+	}
+
+	fp = fopen(TEST_FILE, "r+");
+	check(fp != NULL, "open for update");
+	if (!fp)
+		return;
+
+	char line[100];
+	fputs("XY", fp);
+	check(fflush(fp) == 0, "fflush after writing");
+	check(getc(fp) == 'c', "read after fflush");
+	fclose(fp);
+
+	fp = fopen(TEST_FILE, "r");
+	if (fp)
+	{
+		check(fgets(line, sizeof(line), fp) == line, "reread updated file");
+		check(same(line, "XYcdef\n"), "update went to the file");
+		fclose(fp);
+	}
+}
+
+/* printf() and putc() write through the same stdout buffer, so this comes
+ * out as one line only if their output stays in order. */
+
+static void mix_stdout(void)
+{
+	printf("ok");
+	putc(' ', stdout);
+	printf("- printf ");
+	putchar('a');
+	printf("nd putc %s", "interleave");
+	putc('\n', stdout);
+}
+
+int main(int argc, const char* argv[])
+{
+	FILE* fp;
+
+	write_file();
+	read_file();
+	update_file();
+	mix_stdout();
+
+	fp = fopen(MISSING_FILE, "r");
+	check(fp == NULL, "fopen failure is NULL");
+	check(!fp, "fopen failure is false");
+
+	printf("done, %d failed\n", failures);
+	return failures;
+}